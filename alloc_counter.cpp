@@ -0,0 +1,58 @@
+/* UDP Blaster -- Allocation counter
+ * Replaces the global operator new so every heap allocation made from C++ bumps a counter. The client takes a
+ * reading before and after its datagram loops; any difference means the hot path allocated.
+ */
+
+// C/C++ Standard Libraries
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+// Local includes
+#include "alloc_counter.hpp"
+
+namespace
+{
+    std::atomic<uint64_t> allocations(0);
+}
+
+uint64_t AllocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = malloc(size > 0 ? size : 1))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
@@ -0,0 +1,11 @@
+#pragma once
+/* UDP Blaster -- Allocation counter
+ * Counts heap allocations made through operator new, so the client can show its datagram loops stay off the heap.
+ */
+
+#include <stdint.h>
+
+/* AllocationCount
+ * Number of times the global operator new (any form) has been called by any thread since the program started.
+ */
+uint64_t AllocationCount();
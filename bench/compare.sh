@@ -0,0 +1,73 @@
+#!/usr/bin/env bash
+# UDP Blaster -- Benchmark comparison
+# Compares a results file from bench/run.sh against a stored baseline, row by row (matched on server, case and
+# payload), and flags every row whose send rate or goodput dropped, or whose p99 RTT rose, by more than the
+# tolerance, or whose loss rose by more than the loss tolerance.
+#
+# Usage: bench/compare.sh baseline.csv results.csv
+# Environment:
+#   TOLERANCE      -- Allowed relative change in percent (default 10)
+#   LOSS_TOLERANCE -- Allowed rise in loss in percentage points (default 1)
+# Exits with status 1 if anything regressed.
+
+set -euo pipefail
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 baseline.csv results.csv" >&2
+    exit 2
+fi
+
+awk -F, -v tolerance="${TOLERANCE:-10}" -v lossTolerance="${LOSS_TOLERANCE:-1}" '
+    # Columns: server,case,payload,sent,acked,pps,goodput_gbps,loss_pct,p50_us,p99_us,p999_us
+    FNR == 1 { next }
+    NR == FNR { key = $1 "," $2 "," $3; pps[key] = $6; goodput[key] = $7; loss[key] = $8; p99[key] = $10; next }
+
+    function change(old, new) { return old > 0 ? 100.0 * (new - old) / old : 0 }
+
+    {
+        key = $1 "," $2 "," $3
+        if (!(key in pps))
+        {
+            printf "%-40s new, not in the baseline\n", key
+            next
+        }
+        seen[key] = 1
+
+        problems = ""
+        if (change(pps[key], $6) < -tolerance)
+            problems = problems sprintf(" pps %.0f -> %.0f (%+.1f%%)", pps[key], $6, change(pps[key], $6))
+        if (change(goodput[key], $7) < -tolerance)
+            problems = problems sprintf(" goodput %.4f -> %.4f Gbit/s (%+.1f%%)", goodput[key], $7,
+                                        change(goodput[key], $7))
+        if ($8 - loss[key] > lossTolerance)
+            problems = problems sprintf(" loss %.2f%% -> %.2f%%", loss[key], $8)
+        if (change(p99[key], $10) > tolerance)
+            problems = problems sprintf(" p99 %.1fus -> %.1fus (%+.1f%%)", p99[key], $10, change(p99[key], $10))
+
+        if (problems != "")
+        {
+            printf "%-40s REGRESSION%s\n", key, problems
+            regressions++
+        }
+        else
+        {
+            printf "%-40s ok (pps %+.1f%%, p99 %+.1f%%)\n", key, change(pps[key], $6), change(p99[key], $10)
+        }
+    }
+
+    END {
+        for (key in pps)
+        {
+            if (!(key in seen))
+            {
+                printf "%-40s missing from the results\n", key
+            }
+        }
+        if (regressions > 0)
+        {
+            printf "\n%d regression(s) beyond %s%% (loss: %s points)\n", regressions, tolerance, lossTolerance
+            exit 1
+        }
+        printf "\nNo regressions beyond %s%% (loss: %s points)\n", tolerance, lossTolerance
+    }
+' "$1" "$2"
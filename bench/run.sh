@@ -0,0 +1,91 @@
+#!/usr/bin/env bash
+# UDP Blaster -- Benchmark suite
+# Runs a matrix of client configurations against each of a few server configurations, every server on a port the
+# kernel picks on localhost, and collects one CSV row per run (one per payload size for sweeps) into a results file.
+# Nothing leaves 127.0.0.1, so the suite runs offline.
+#
+# Usage: bench/run.sh [results.csv]
+# Environment:
+#   DATAGRAMS -- Datagrams per run (default 20000)
+#   DRAIN_MS  -- How long pipelined runs wait for late acks (default 200)
+#   BIN       -- Directory holding the client and server (default .)
+
+set -euo pipefail
+
+RESULTS=${1:-bench_results.csv}
+DATAGRAMS=${DATAGRAMS:-20000}
+DRAIN_MS=${DRAIN_MS:-200}
+BIN=${BIN:-.}
+
+# name|server arguments
+SERVERS=(
+    "plain|"
+    "batched|-b 32"
+    "workers|-t 2"
+)
+
+# name|client arguments
+CASES=(
+    "lockstep|"
+    "lockstep-20k|-r 20k"
+    "pipelined|-P"
+    "pipelined-50k|-P -r 50k"
+    "pipelined-gso|-P -G 16"
+    "sweep|-P -S 64,512,1400"
+    "load-4x2|-F 4 -T 2"
+)
+
+WORK=$(mktemp -d)
+SERVER_PID=
+cleanup()
+{
+    if [ -n "$SERVER_PID" ]; then
+        kill -INT "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# Starts a server on port 0 and sets SERVER_PID and SERVER_PORT once it reports the port it was given
+start_server()
+{
+    "$BIN/server" -p 0 $1 > "$WORK/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        SERVER_PORT=$(sed -n 's/^Listening on port \([0-9]*\)$/\1/p' "$WORK/server.log" | head -n 1)
+        if [ -n "$SERVER_PORT" ]; then
+            return 0
+        fi
+        if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+            break
+        fi
+        sleep 0.1
+    done
+    echo "Server ($1) did not start:" >&2
+    cat "$WORK/server.log" >&2
+    exit 1
+}
+
+stop_server()
+{
+    kill -INT "$SERVER_PID"
+    wait "$SERVER_PID" || true
+    SERVER_PID=
+}
+
+echo "server,case,payload,sent,acked,pps,goodput_gbps,loss_pct,p50_us,p99_us,p999_us" > "$RESULTS"
+for server in "${SERVERS[@]}"; do
+    start_server "${server#*|}"
+    for case in "${CASES[@]}"; do
+        name="${server%%|*},${case%%|*}"
+        echo "Running $name" >&2
+        rm -f "$WORK/run.csv"
+        "$BIN/client" -p "$SERVER_PORT" -n "$DATAGRAMS" -w "$DRAIN_MS" -a "$WORK/run.csv" ${case#*|} \
+            > "$WORK/client.log" 2>&1 || { cat "$WORK/client.log" >&2; exit 1; }
+        tail -n +2 "$WORK/run.csv" | sed "s/^/$name,/" >> "$RESULTS"
+    done
+    stop_server
+done
+
+echo "Wrote $(($(wc -l < "$RESULTS") - 1)) results to $RESULTS" >&2
@@ -0,0 +1,212 @@
+/* UDP Blaster -- Traffic capture
+ * Compact binary traces of the datagrams a server recieved, written and read back through memory mapped files so the
+ * client can replay a traffic pattern that was seen in the field.
+ */
+
+// C/C++ Standard Libraries
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <iomanip>
+
+// System libraries
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local includes
+#include "capture.hpp"
+#include "structure.hpp"
+
+const uint64_t CaptureReader::RELEASE_WINDOW;
+
+namespace
+{
+    const char CAPTURE_MAGIC[8] = {'U', 'D', 'P', 'B', 'C', 'A', 'P', 1};
+
+    uint64_t Padded(uint64_t length)
+    {
+        return (length + 7) & ~uint64_t(7);
+    }
+
+    uint64_t ClockNs(clockid_t clock)
+    {
+        timespec now;
+        clock_gettime(clock, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    }
+}
+
+CaptureWriter::CaptureWriter(const std::string& path, uint64_t capacity) : path(path), capacity(capacity)
+{
+    if (capacity < sizeof(CaptureHeader))
+    {
+        throw std::invalid_argument("Capture file must be at least " + std::to_string(sizeof(CaptureHeader)) +
+                                    " bytes");
+    }
+
+    fileFD = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fileFD == -1)
+    {
+        std::runtime_error ex("Unable to create capture file " + path + ": " + strerror(errno));
+        throw ex;
+    }
+
+    // Allocating the blocks now means a full disk shows up here rather than as SIGBUS in the recieve loop
+    int rv = posix_fallocate(fileFD, 0, capacity);
+    if (rv != 0)
+    {
+        close(fileFD);
+        std::runtime_error ex("Unable to preallocate " + std::to_string(capacity) + " bytes for " + path + ": " +
+                              strerror(rv));
+        throw ex;
+    }
+    void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fileFD, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close(fileFD);
+        std::runtime_error ex("Unable to map capture file " + path + ": " + strerror(errno));
+        throw ex;
+    }
+
+    base = static_cast<uint8_t*>(mapping);
+    header = reinterpret_cast<CaptureHeader*>(base);
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->startRealtimeNs = ClockNs(CLOCK_REALTIME);
+    header->end = sizeof(CaptureHeader);
+    header->records = 0;
+    header->dropped = 0;
+    startNs = ClockNs(CLOCK_MONOTONIC);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    uint64_t end = header->end;
+    munmap(base, capacity);
+    if (ftruncate(fileFD, end) == -1)
+    {
+        perror("Unable to trim the capture file");
+    }
+    close(fileFD);
+}
+
+void CaptureWriter::Record(const sockaddr* source, const uint8_t* datagram, size_t length, size_t captured)
+{
+    uint64_t offset = header->end;
+    uint64_t next = offset + sizeof(CaptureRecord) + Padded(captured);
+    if (next > capacity)
+    {
+        header->dropped++;
+        return;
+    }
+
+    CaptureRecord* record = reinterpret_cast<CaptureRecord*>(base + offset);
+    record->timestampNs = ClockNs(CLOCK_MONOTONIC) - startNs;
+    record->sequence = 0;
+    if (captured >= sizeof(ClientDatagram))
+    {
+        record->sequence = ntohl(reinterpret_cast<const ClientDatagram*>(datagram)->sequence_number);
+    }
+    record->length = length;
+    record->captured = captured;
+    record->family = source->sa_family;
+    record->reserved = 0;
+    memset(record->address, 0, sizeof(record->address));
+    if (source->sa_family == AF_INET6)
+    {
+        const sockaddr_in6* address = reinterpret_cast<const sockaddr_in6*>(source);
+        record->port = address->sin6_port;
+        memcpy(record->address, &address->sin6_addr, sizeof(address->sin6_addr));
+    }
+    else
+    {
+        const sockaddr_in* address = reinterpret_cast<const sockaddr_in*>(source);
+        record->port = address->sin_port;
+        memcpy(record->address, &address->sin_addr, sizeof(address->sin_addr));
+    }
+    memcpy(record + 1, datagram, captured);
+
+    // The record only counts once it is complete, so a trace cut short by a crash still reads up to here
+    header->records++;
+    header->end = next;
+}
+
+void CaptureWriter::PrintReport(std::ostream& out) const
+{
+    out << "Captured " << header->records << " datagrams to " << path << " (" << std::fixed << std::setprecision(1)
+        << header->end / 1048576.0 << " of " << capacity / 1048576.0 << " MiB), " << header->dropped
+        << " left out with the file full\n" << std::defaultfloat;
+}
+
+CaptureReader::CaptureReader(const std::string& path) : path(path)
+{
+    int fileFD = open(path.c_str(), O_RDONLY);
+    if (fileFD == -1)
+    {
+        std::runtime_error ex("Unable to open capture file " + path + ": " + strerror(errno));
+        throw ex;
+    }
+    struct stat info;
+    if (fstat(fileFD, &info) == -1 || static_cast<uint64_t>(info.st_size) < sizeof(CaptureHeader))
+    {
+        close(fileFD);
+        std::runtime_error ex(path + " is too short to be a capture file");
+        throw ex;
+    }
+    size = info.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileFD, 0);
+    close(fileFD);
+    if (mapping == MAP_FAILED)
+    {
+        std::runtime_error ex("Unable to map capture file " + path + ": " + strerror(errno));
+        throw ex;
+    }
+    base = static_cast<uint8_t*>(mapping);
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    const CaptureHeader* header = reinterpret_cast<const CaptureHeader*>(base);
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        munmap(base, size);
+        std::runtime_error ex(path + " is not a capture file of this version");
+        throw ex;
+    }
+    end = std::min<uint64_t>(header->end, size);
+    records = header->records;
+    dropped = header->dropped;
+}
+
+CaptureReader::~CaptureReader()
+{
+    munmap(base, size);
+}
+
+const CaptureRecord* CaptureReader::Next()
+{
+    if (offset >= end)
+    {
+        return nullptr;
+    }
+    const CaptureRecord* record = reinterpret_cast<const CaptureRecord*>(base + offset);
+    if (end - offset < sizeof(CaptureRecord) || end - offset - sizeof(CaptureRecord) < Padded(record->captured))
+    {
+        std::runtime_error ex("Capture file " + path + " is cut short at offset " + std::to_string(offset));
+        throw ex;
+    }
+
+    // Only whole windows the previous records lie entirely below are dropped, never the one being returned
+    while (offset - released >= 2 * RELEASE_WINDOW)
+    {
+        madvise(base + released, RELEASE_WINDOW, MADV_DONTNEED);
+        released += RELEASE_WINDOW;
+    }
+
+    offset += sizeof(CaptureRecord) + Padded(record->captured);
+    return record;
+}
@@ -0,0 +1,130 @@
+#pragma once
+/* UDP Blaster -- Traffic capture
+ * Compact binary traces of the datagrams a server recieved, written and read back through memory mapped files so the
+ * client can replay a traffic pattern that was seen in the field.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+#include <string>
+#include <sys/socket.h>
+
+/* CaptureHeader
+ * Start of a trace file. Everything in a trace is in the recording host's byte order except the source port, which
+ * is kept in network order as it came off the socket.
+ */
+struct CaptureHeader
+{
+    char magic[8];              // "UDPBCAP" and a format version byte
+    uint64_t startRealtimeNs;   // Wall clock time the capture started
+    uint64_t end;               // Offset just past the last complete record, kept current so a crashed capture reads
+    uint64_t records;           // Complete records
+    uint64_t dropped;           // Datagrams left out because the file was full
+};
+
+/* CaptureRecord
+ * One recieved datagram. The first captured bytes of the datagram follow, padded to a multiple of 8 so the next
+ * record stays aligned.
+ */
+struct CaptureRecord
+{
+    uint64_t timestampNs;       // Monotonic time since the capture started
+    uint32_t sequence;          // Sequence number from the datagram's header, 0 if it was too short to have one
+    uint32_t length;            // Length of the datagram as sent
+    uint32_t captured;          // Bytes of it that follow, fewer than length if the server truncated it
+    uint16_t port;              // Source port, network order
+    uint8_t  family;            // AF_INET or AF_INET6
+    uint8_t  reserved;
+    uint8_t  address[16];       // Source address, an IPv4 one in the first 4 bytes
+};
+
+/* CaptureWriter
+ * Records datagrams into a file that is preallocated and mapped, with every page faulted in, before the first one
+ * arrives, so recording a datagram is two copies into memory and never a syscall or a wait on the disk; the kernel
+ * writes the pages back in the background. Once the file is full further datagrams are only counted. Closing trims
+ * the file to what was recorded.
+ * Not thread safe.
+ */
+class CaptureWriter
+{
+public:
+    /* Parameters:
+     *   const std::string& path     -- File to record to, replaced if it exists
+     *   uint64_t           capacity -- Size to preallocate, the most the trace can hold including its header
+     * Exceptions:
+     *   Will throw an exception if the file cannot be created, allocated or mapped.
+     */
+    CaptureWriter(const std::string& path, uint64_t capacity);
+    ~CaptureWriter();
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    /* Record
+     * Appends one datagram, or counts it as dropped if it does not fit.
+     * Parameters:
+     *   const sockaddr* source   -- Address the datagram came from
+     *   const uint8_t*  datagram -- Start of the datagram as recieved
+     *   size_t          length   -- Real length of the datagram as sent
+     *   size_t          captured -- Bytes of it in the buffer, no more than length
+     */
+    void Record(const sockaddr* source, const uint8_t* datagram, size_t length, size_t captured);
+
+    /* PrintReport
+     * Writes how much was recorded and how much was left out.
+     */
+    void PrintReport(std::ostream& out) const;
+
+private:
+    std::string path;
+    int fileFD = -1;
+    uint8_t* base = nullptr;
+    uint64_t capacity;
+    uint64_t startNs;
+    CaptureHeader* header = nullptr;
+};
+
+/* CaptureReader
+ * Walks the records of a trace in order through a read-only mapping. The kernel is told the file is read
+ * sequentially, and every window of the file that has been walked past is dropped from the mapping again, so a trace
+ * larger than memory streams from the disk rather than being held whole.
+ */
+class CaptureReader
+{
+public:
+    // Bytes walked past before they are dropped from the mapping, a multiple of the page size
+    static const uint64_t RELEASE_WINDOW = 64 * 1024 * 1024;
+
+    /* Exceptions:
+     *   Will throw an exception if the file cannot be opened or mapped, or is not a trace.
+     */
+    explicit CaptureReader(const std::string& path);
+    ~CaptureReader();
+
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    /* Next
+     * Returns:
+     *   The next record, with its captured bytes following it, or nullptr after the last.
+     * Exceptions:
+     *   Will throw an exception if a record runs past the end of the trace.
+     */
+    const CaptureRecord* Next();
+
+    static const uint8_t* Data(const CaptureRecord* record) { return reinterpret_cast<const uint8_t*>(record + 1); }
+
+    uint64_t Records() const { return records; }
+    uint64_t Dropped() const { return dropped; }
+
+private:
+    std::string path;
+    uint8_t* base = nullptr;
+    uint64_t size = 0;
+    uint64_t end = 0;
+    uint64_t offset = sizeof(CaptureHeader);
+    uint64_t released = 0;      // Everything below this has been dropped from the mapping
+    uint64_t records = 0;
+    uint64_t dropped = 0;
+};
@@ -7,17 +7,23 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
-#include <set>
 #include <cstdlib>
 #include <stdexcept>
 #include <thread>
 #include <chrono>
 #include <new>
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <fstream>
 
 // C Standard Library and System libraries
 #include <stdio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <netdb.h>
 #include <string.h>
 #include <arpa/inet.h>
@@ -25,22 +31,355 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
 
 // Local includes
 #include "defaults.hpp"
 #include "structure.hpp"
+#include "sequence_tracker.hpp"
+#include "loss_analysis.hpp"
+#include "zerocopy.hpp"
+#include "histogram.hpp"
+#include "pacer.hpp"
+#include "datagram_pool.hpp"
+#include "alloc_counter.hpp"
+#include "payload.hpp"
+#include "timestamping.hpp"
+#include "loop_policy.hpp"
+#include "perf_counters.hpp"
+#include "metrics.hpp"
+#include "socket_tuning.hpp"
+#include "transport.hpp"
+#include "capture.hpp"
+#include "options.hpp"
 
 // Convinience type aliases & using statements
 using US = std::chrono::microseconds;
+using MS = std::chrono::milliseconds;
+using Clock = std::chrono::steady_clock;
+using NS = std::chrono::nanoseconds;
 
 // Global constants
 const std::string PAYLOAD = "jsachtleben";
+const uint32_t MAX_GSO_SEGMENTS = 64;      // Kernel limit on datagrams per UDP_SEGMENT send
+const uint32_t ZEROCOPY_SLOTS = 256;       // Buffers -z sends from, the most zero-copy sends in flight at once
+const uint32_t MAX_LOAD_FLOWS = 1 << 20;   // Most -F flows, about as many sockets as Linux lets a process open
+const uint32_t MAX_LOAD_THREADS = 1024;    // Most -T threads
+const uint32_t MAX_SEARCH_TRIALS = 1000;   // Most -i trials per rate in the -L search
 
 // Constants for errors
 const int32_t UNKNOWN_ARGUMENT = 1;
 const int32_t SETUP_ERROR = 2;
 const int32_t NETWORKING_ERROR = 3;
 
+// Low-latency settings (-Z/-W/-C), set once in main before any socket is opened or thread started
+SocketTuning socketTuning;
+
+/* NowNs
+ * Monotonic timestamp in nanoseconds, used to stamp sends and measure round trips.
+ */
+inline uint64_t NowNs()
+{
+    return std::chrono::duration_cast<NS>(Clock::now().time_since_epoch()).count();
+}
+
+/* ThreadCpuNs
+ * CPU time the calling thread has used so far, user and kernel, in nanoseconds.
+ */
+inline uint64_t ThreadCpuNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/* ReplyBuffer
+ * Room for either reply format the server may send.
+ */
+union ReplyBuffer
+{
+    ServerDatagram single;
+    AggregateAck aggregate;
+    TimedServerDatagram timed;
+};
+
+/* ForEachAck
+ * Decodes one reply from the server and calls onAck(sequence, datagramLength) for every sequence number it
+ * acknowledges. A ServerDatagram or TimedServerDatagram (server -K) acknowledges one datagram; an AggregateAck
+ * (server -a) acknowledges one per bit set in its bitmap. The formats are told apart by their size.
+ * Parameters:
+ *   const ReplyBuffer& reply  -- Reply as recieved
+ *   ssize_t            length -- Bytes recieved
+ *   OnAck              onAck  -- Called with host order values
+ * Returns:
+ *   false if the reply was neither format.
+ */
+template <typename OnAck>
+bool ForEachAck(const ReplyBuffer& reply, ssize_t length, OnAck onAck)
+{
+    if (length == sizeof(ServerDatagram))
+    {
+        onAck(ntohl(reply.single.sequence_number), ntohs(reply.single.datagram_length));
+        return true;
+    }
+    if (length == sizeof(TimedServerDatagram))
+    {
+        onAck(ntohl(reply.timed.sequence_number), ntohs(reply.timed.datagram_length));
+        return true;
+    }
+    if (length != sizeof(AggregateAck))
+    {
+        return false;
+    }
+
+    const uint32_t base = ntohl(reply.aggregate.base_sequence);
+    const uint16_t datagramLength = ntohs(reply.aggregate.datagram_length);
+    for (uint32_t byte = 0; byte < sizeof(reply.aggregate.bitmap); byte++)
+    {
+        unsigned int bits = reply.aggregate.bitmap[byte];
+        while (bits != 0)
+        {
+            onAck(base + byte * 8 + __builtin_ctz(bits), datagramLength);
+            bits &= bits - 1;
+        }
+    }
+    return true;
+}
+
+/* PipelineState
+ * State shared by the sender and reciever threads of the pipelined mode. Neither thread ever takes a lock: the
+ * sender publishes how far it got through the tracker, and the reciever sets one acked bit per sequence number.
+ */
+struct PipelineState
+{
+    PipelineState(SequenceTracker& tracker, uint32_t datagramSize, LatencyHistogram& rtt, ThreadMetrics* metrics)
+        : tracker(tracker), sendTimes(new std::atomic<uint64_t>[tracker.Capacity()]), datagramSize(datagramSize),
+          rtt(rtt), senderMetrics(metrics[0]), recieverMetrics(metrics[1])
+    {
+    }
+
+    SequenceTracker& tracker;
+    std::unique_ptr<std::atomic<uint64_t>[]> sendTimes;  // Send timestamp per sequence number, written by the sender
+    uint32_t datagramSize;                               // Length the server should report back for each datagram
+    LatencyHistogram& rtt;                               // Only ever touched by the reciever
+    ThreadMetrics& senderMetrics;                        // Live counters, each bumped by its own thread only
+    ThreadMetrics& recieverMetrics;
+    std::atomic<bool> started{false};                    // Holds both threads until they have both been created
+    std::atomic<bool> sendingDone{false};                // Set once the sender has finished
+};
+
+/* BuildDatagramTemplate
+ * Formats the datagram every send is stamped from: a ClientDatagram header with sequence number 0 followed by the
+ * payload and its null byte.
+ * Parameters:
+ *   const std::string& payload -- Payload to carry
+ * Returns:
+ *   The formatted datagram.
+ */
+std::vector<uint8_t> BuildDatagramTemplate(const std::string& payload)
+{
+    std::vector<uint8_t> prototype(sizeof(ClientDatagram) + payload.size() + 1, 0); // add one for the null byte
+    ClientDatagram header = {0, htons(static_cast<uint16_t>(payload.size()))};
+    memcpy(prototype.data(), &header, sizeof(ClientDatagram));
+    memcpy(prototype.data() + sizeof(ClientDatagram), payload.c_str(), payload.size() + 1);
+    return prototype;
+}
+
+/* BuildPatternTemplate
+ * Formats a datagram whose payload is payloadLength bytes of the verifiable fill pattern from payload.hpp.
+ * Parameters:
+ *   uint16_t payloadLength -- Payload size in bytes, may be 0 for a header-only datagram
+ * Returns:
+ *   The formatted datagram.
+ */
+std::vector<uint8_t> BuildPatternTemplate(uint16_t payloadLength)
+{
+    std::vector<uint8_t> prototype(sizeof(ClientDatagram) + payloadLength, 0);
+    ClientDatagram header = {0, htons(payloadLength)};
+    memcpy(prototype.data(), &header, sizeof(ClientDatagram));
+    FillPattern(prototype.data() + sizeof(ClientDatagram), payloadLength);
+    return prototype;
+}
+
+/* PrintAllocationReport
+ * Displays how many heap allocations happened while datagrams were flowing. Anything but zero is a regression.
+ */
+void PrintAllocationReport(uint64_t allocations)
+{
+    std::cout << "Heap allocations during datagram loop: " << allocations << "\n";
+}
+
+/* LatencyBreakdown
+ * Where the time of each timestamped round trip went (client -K against a server -K). Every part comes from kernel
+ * software stamps, which share CLOCK_REALTIME with user space, except the wire/stack part, which uses NIC stamps
+ * whenever both of its ends have one. Send side stamps are kept per datagram until its reply turns up, so late
+ * replies are broken down as well.
+ */
+struct LatencyBreakdown
+{
+    explicit LatencyBreakdown(uint32_t datagrams)
+        : userSend(datagrams), sendStamps(datagrams), sendIndex(datagrams)
+    {
+    }
+
+    LatencyHistogram toKernel;     // send() called to the kernel's transmit stamp
+    LatencyHistogram wire;         // Transmit stamp to the reply's recieve stamp, less the server's turnaround
+    LatencyHistogram turnaround;   // Server's kernel recieve stamp to its reply, as reported in the reply
+    LatencyHistogram fromKernel;   // The reply's recieve stamp to recv() returning
+    uint64_t hardware = 0;         // Wire samples taken from NIC stamps
+    uint64_t incomplete = 0;       // Acked datagrams missing a stamp or the server's turnaround
+
+    std::vector<uint64_t> userSend;            // CLOCK_REALTIME just before each send(), by datagram
+    std::vector<KernelTimestamps> sendStamps;  // Transmit stamps, by datagram
+    std::vector<uint32_t> sendIndex;           // Datagram of each successful send, by the kernel's stamp ID
+};
+
+/* CollectTransmitStamps
+ * Moves every transmit stamp waiting on the socket's error queue to the datagram it belongs to.
+ * Parameters:
+ *   int               socketFD  -- Socket with transmit stamps enabled
+ *   LatencyBreakdown& breakdown -- Where to file the stamps
+ * Returns:
+ *   Nothing.
+ */
+void CollectTransmitStamps(int socketFD, LatencyBreakdown& breakdown)
+{
+    uint32_t id;
+    KernelTimestamps stamps;
+    while (ReadTransmitTimestamp(socketFD, id, stamps))
+    {
+        if (id < breakdown.sendIndex.size())
+        {
+            breakdown.sendStamps[breakdown.sendIndex[id]] = stamps;
+        }
+    }
+}
+
+/* RecordBreakdown
+ * Splits one round trip into its parts, once its reply has arrived.
+ * Parameters:
+ *   int                     socketFD   -- Socket with transmit stamps enabled
+ *   uint32_t                index      -- Datagram the reply acknowledges, counted from the start of the run
+ *   const KernelTimestamps& recvStamps -- Recieve stamps of the reply
+ *   uint64_t                userRecv   -- CLOCK_REALTIME just after the reply was read
+ *   uint32_t                turnaround -- Server turnaround from the reply, 0 if it had none
+ *   LatencyBreakdown&       breakdown  -- Where to record the parts
+ * Returns:
+ *   Nothing.
+ */
+void RecordBreakdown(int socketFD, uint32_t index, const KernelTimestamps& recvStamps, uint64_t userRecv,
+                     uint32_t turnaround, LatencyBreakdown& breakdown)
+{
+    if (breakdown.sendStamps[index].software == 0)
+    {
+        CollectTransmitStamps(socketFD, breakdown);
+    }
+    const KernelTimestamps& sendStamps = breakdown.sendStamps[index];
+    const uint64_t userSend = breakdown.userSend[index];
+    if (sendStamps.software == 0 || recvStamps.software == 0 || turnaround == 0)
+    {
+        breakdown.incomplete++;
+        return;
+    }
+
+    // Clamped at zero, the parts come from different clocks' views of the same instant and can cross by a hair
+    uint64_t sendSide = sendStamps.software;
+    uint64_t recvSide = recvStamps.software;
+    if (sendStamps.hardware > 0 && recvStamps.hardware > 0)
+    {
+        sendSide = sendStamps.hardware;
+        recvSide = recvStamps.hardware;
+        breakdown.hardware++;
+    }
+    uint64_t inFlight = recvSide > sendSide ? recvSide - sendSide : 0;
+
+    breakdown.toKernel.Record(sendStamps.software > userSend ? sendStamps.software - userSend : 0);
+    breakdown.wire.Record(inFlight > turnaround ? inFlight - turnaround : 0);
+    breakdown.turnaround.Record(turnaround);
+    breakdown.fromKernel.Record(userRecv > recvStamps.software ? userRecv - recvStamps.software : 0);
+}
+
+/* PrintLatencyBreakdown
+ * Displays the parts of the timestamped round trips.
+ * Parameters:
+ *   const LatencyBreakdown& breakdown -- Parts recorded during the run
+ * Returns:
+ *   Nothing.
+ */
+void PrintLatencyBreakdown(const LatencyBreakdown& breakdown)
+{
+    std::cout << "Latency breakdown from kernel timestamps (" << breakdown.turnaround.Count() << " round trips, "
+              << breakdown.incomplete << " without every stamp):\n";
+    breakdown.toKernel.PrintSummary(std::cout, "  user to kernel TX");
+    breakdown.wire.PrintSummary(std::cout, breakdown.hardware > 0 ? "  wire/stack (NIC stamps)" : "  wire/stack");
+    breakdown.turnaround.PrintSummary(std::cout, "  server turnaround");
+    breakdown.fromKernel.PrintSummary(std::cout, "  kernel RX to user");
+}
+
+/* PrintAckReport
+ * Displays the final results of a run, with the loss, reorder and duplicate breakdown.
+ * Parameters:
+ *   const SequenceTracker&  tracker -- Tracker the run recorded its sends and acks in
+ *   const LatencyHistogram& rtt     -- Round trip times of the acknowledged datagrams
+ * Returns:
+ *   Nothing.
+ */
+void PrintAckReport(const SequenceTracker& tracker, const LatencyHistogram& rtt)
+{
+    std::cout << tracker.Sent() << " messages sent.\n"
+              << "Unacknowledged packets: " << tracker.Unacknowledged() << "\n";
+    LossAnalysis analysis;
+    analysis.Add(tracker);
+    analysis.Print(std::cout);
+    rtt.PrintSummary(std::cout, "RTT");
+}
+
+/* AppendResult
+ * Appends one CSV row summarizing a run to a results file, starting the file with a header row if it is empty.
+ * Columns: payload bytes, datagrams sent, datagrams acknowledged, achieved send rate in packets/s, goodput in Gbit/s
+ * (acknowledged payload bits over the time spent sending), loss % and the RTT p50/p99/p99.9 in microseconds.
+ * Parameters:
+ *   const std::string&      path          -- File to append to
+ *   uint32_t                payloadLength -- Payload bytes per datagram
+ *   uint64_t                sent          -- Datagrams sent
+ *   uint64_t                acknowledged  -- Datagrams acknowledged
+ *   double                  pps           -- Achieved send rate in packets/s
+ *   const LatencyHistogram& rtt           -- Round trip times of the run
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if the file cannot be written.
+ */
+void AppendResult(const std::string& path, uint32_t payloadLength, uint64_t sent, uint64_t acknowledged, double pps,
+                  const LatencyHistogram& rtt)
+{
+    std::ofstream csv(path, std::ios::app);
+    if (!csv)
+    {
+        throw std::runtime_error("Unable to open " + path + " for writing");
+    }
+
+    double sendSeconds = pps > 0 ? sent / pps : 0.0;
+    double goodput = sendSeconds > 0 ? acknowledged * payloadLength * 8.0 / sendSeconds / 1e9 : 0.0;
+    if (csv.tellp() == 0)
+    {
+        csv << "payload,sent,acked,pps,goodput_gbps,loss_pct,p50_us,p99_us,p999_us\n";
+    }
+    csv << std::fixed << payloadLength << ',' << sent << ',' << acknowledged << ',' << std::setprecision(0) << pps
+        << ',' << std::setprecision(4) << goodput << ',' << std::setprecision(3)
+        << (sent > 0 ? 100.0 * (sent - acknowledged) / sent : 0.0) << ',' << std::setprecision(1)
+        << rtt.Percentile(50.0) / 1000.0 << ',' << rtt.Percentile(99.0) / 1000.0 << ','
+        << rtt.Percentile(99.9) / 1000.0 << '\n';
+
+    if (!csv)
+    {
+        throw std::runtime_error("Error writing " + path);
+    }
+}
+
 /* EstablishConnection
  * Responsible for opening a socket to the server.
  * Parameters:
@@ -161,6 +500,16 @@ int EstablishConnection(std::string serverAddress, uint16_t port, bool debug)
         throw ex;
     }
 
+    try
+    {
+        TuneSocket(socketFD, socketTuning);
+    }
+    catch (...)
+    {
+        close(socketFD);
+        throw;
+    }
+
     if (debug)
     {
         std::cout << "Set socket to nonblocking IO.\n\n"
@@ -172,110 +521,178 @@ int EstablishConnection(std::string serverAddress, uint16_t port, bool debug)
     return socketFD;
 }
 
+/* PinToCpu
+ * Pins a thread to the CPU -C chose for its slot, if any. Failing to pin is reported but not fatal.
+ * Parameters:
+ *   pthread_t    thread -- Thread to pin
+ *   unsigned int slot   -- Which of the chosen CPUs to use, round robin
+ * Returns:
+ *   Nothing.
+ */
+void PinToCpu(pthread_t thread, unsigned int slot)
+{
+    int cpu = socketTuning.Cpu(slot);
+    int rv = PinThread(thread, cpu);
+    if (rv != 0)
+    {
+        std::cerr << "Unable to pin to CPU " << cpu << ": " << strerror(rv) << "\n";
+    }
+}
+
+/* ReportSendError, ReportLengthMismatch, ReportAckProblem, ReportUnexpectedReply
+ * Explain the problems the lockstep loop can run into. Kept out of line and marked cold, so none of the loop's
+ * specializations carries formatting code for them.
+ */
+__attribute__((noinline, cold)) void ReportSendError(ssize_t sentBytes, ssize_t datagramSize)
+{
+    if (sentBytes == -1)
+    {
+        std::cerr << "Error sending on socket\n";
+        perror("send()");
+        return;
+    }
+    std::cerr << "send() error: " << datagramSize << " bytes were requested to be sent, but " << sentBytes
+              << " were actually sent!\n";
+}
+
+__attribute__((noinline, cold)) void ReportLengthMismatch(uint32_t sequence, uint16_t length, ssize_t datagramSize)
+{
+    std::cout << "Sequence number " << sequence << " reports that " << length
+              << " bytes were sent, but we (expected to) send " << datagramSize << " bytes!\n";
+}
+
+__attribute__((noinline, cold)) void ReportAckProblem(SequenceTracker::AckResult result, uint32_t sequence)
+{
+    if (result == SequenceTracker::AckResult::Unknown)
+    {
+        std::cerr << "Recieved packet for unknown sequence ID " << sequence << "!\n";
+    }
+    else
+    {
+        std::cerr << "Recieved duplicate ack for sequence ID " << sequence << "!\n";
+    }
+}
+
+__attribute__((noinline, cold)) void ReportUnexpectedReply(ssize_t recvBytes)
+{
+    std::cerr << "Recieved a reply of unexpected size (" << recvBytes << " bytes)\n";
+}
+
 /* SendAndRecieve
  * Main loop for sending and recieving packets. Keeps track of sequence numbers sent and recieved and displays
  * the final results. Will inform the users of any errors that occur, such as incorrect # of bytes sent or unknown
  * sequence numbers recieved.
+ * Specialized on a loop policy (loop_policy.hpp): the quiet policy keeps no send times, RTTs or timestamps, and
+ * only the debug policy has any logging compiled in.
  * Parameters:
- *   int      socketFD         -- File descriptor for socket as prepared by EstablishConnection
- *   uint32_t datagramsToSend  -- Number of packets to send
- *   US       delay            -- Time in us to wait between sending packets
- *   bool     debug            -- Enable debug messages
+ *   int               socketFD  -- File descriptor for socket as prepared by EstablishConnection
+ *   SequenceTracker&  tracker   -- Tracker to record sends and acks in, its capacity is the number of packets to send
+ *   DatagramPool&     pool      -- Preformatted datagrams to send from
+ *   Pacer&            pacer     -- Decides when each datagram may be sent
+ *   LatencyHistogram& rtt       -- Histogram to record round trip times in
+ *   LatencyBreakdown* breakdown -- Where to record kernel timestamped latency parts, nullptr to not stamp
+ *   ZeroCopySender*   zeroCopy  -- Send with MSG_ZEROCOPY from this sender's buffers instead of pool, nullptr to copy
+ *   ThreadMetrics&    metrics   -- Live counters for this thread, kept by every policy
  * Returns:
- *   Nothing.
+ *   The number of heap allocations made while datagrams were flowing.
  * Exceptions:
- *   Will thow an exception if there is an error during any memory allocation or if a standard function throws.
+ *   Will thow an exception if the tracking state cannot be allocated, if timestamping cannot be enabled, if
+ *   zero-copy completions stop arriving, or if a standard function throws.
  */
-void SendAndRecieve(int socketFD, uint32_t datagramsToSend, US delay, bool debug)
+template <typename Policy>
+uint64_t SendAndRecieve(int socketFD, SequenceTracker& tracker, DatagramPool& pool, Pacer& pacer, LatencyHistogram& rtt,
+                        LatencyBreakdown* breakdown, ZeroCopySender* zeroCopy, ThreadMetrics& metrics)
 {
-    std::set<uint32_t> sentIDs;
+    const uint32_t datagramsToSend = tracker.Capacity();
+    const uint32_t base = tracker.Base();
+    std::unique_ptr<uint64_t[]> sendTimes(Policy::STATS ? new uint64_t[datagramsToSend] : nullptr);
 
-    if (debug)
+    if (Policy::LOG)
     {
         std::cout << "Entering SendAndRecieve...\n\n";
     }
 
+    // Everything the loop needs is allocated by now, so the counter should not move until it finishes
+    const ssize_t datagramSize = pool.DatagramSize();
+    ReplyBuffer serverDG;
+    KernelTimestamps recvStamps;
+    uint64_t userRecv = 0;
+    uint32_t sendCount = 0;   // The kernel numbers transmit stamps by successful sends since stamping was enabled
+    if (Policy::STATS && breakdown != nullptr)
+    {
+        EnableTimestamping(socketFD, true);
+    }
+    uint64_t allocationsBefore = AllocationCount();
 
     for (uint32_t i = 0; i < datagramsToSend; i++)
     {
         // Sending data
 
-        if (debug)
+        if (Policy::LOG)
         {
             std::cout << "Preparing to send packet " << i << "\n";
         }
 
 
-        ClientDatagram prepDG = {i, static_cast<uint16_t>(PAYLOAD.size())}; // prepDG holds the info but not the payload
+        // The header and payload were formatted once up front, only the sequence number changes per send
+        uint8_t* realDG = zeroCopy != nullptr ? zeroCopy->Acquire(base + i) : pool.Stamp(i, base + i);
 
-        if (debug)
+        if (Policy::LOG)
         {
-            std::cout << "Prep DG made, sequence # " << prepDG.sequence_number << " and payload size "
-                      << prepDG.payload_length << "\n";
+            std::cout << "Stamped sequence # " << base + i << " into pool slot " << i % pool.Slots() << "\n";
         }
 
-        ssize_t datagramSize = sizeof(ClientDatagram) + prepDG.payload_length + 1; // add one to account for null byte
-        ClientDatagram* realDG = static_cast<ClientDatagram*>(malloc(datagramSize));
-        if (realDG == 0)
+        pacer.Wait();
+        tracker.MarkSent(base + i);
+        if (Policy::STATS)
         {
-            std::bad_alloc ex;
-            throw ex;
+            sendTimes[i] = NowNs();
         }
-
-        realDG->sequence_number = htonl(prepDG.sequence_number);
-        realDG->payload_length = htons(prepDG.payload_length);
-        /* The next statement is... complicated.
-         * The pointer arithmetic takes the pointer to realDG and moves it to point to the byte past the "end" of the
-         * datagram struct. This is the designated space for the payload.
-         * We then copy the C string representation of the payload into this space. The size of the payload is used to
-         * make certain we only write the intended number of bytes.
-         */
-        //strncpy((reinterpret_cast<char*>(realDG) + sizeof(ClientDatagram)),
-        strncpy((reinterpret_cast<char*>(realDG + 1)),
-                PAYLOAD.c_str(), PAYLOAD.size() + 1);
-        // The realDG is now ready to be sent!
-
-        if (debug)
+        if (Policy::STATS && breakdown != nullptr)
         {
-                std::cout << "Real DG made and ready to be sent!\n";
+            breakdown->userSend[i] = RealtimeNs();
+        }
+        ssize_t sentBytes = zeroCopy != nullptr ? zeroCopy->Send(realDG, datagramSize)
+                                                : send(socketFD, static_cast<void*>(realDG), datagramSize, 0);
+        if (Policy::STATS && breakdown != nullptr && sentBytes != -1)
+        {
+            breakdown->sendIndex[sendCount++] = i;
         }
-
-
-        std::this_thread::sleep_for(delay);
-        ssize_t sentBytes = send(socketFD, static_cast<void*>(realDG), datagramSize, 0);
         if (sentBytes == -1)
         {
-            std::cerr << "Error sending on socket\n";
-            perror("send()");
+            metrics.Failed(errno);
         }
-        else if (sentBytes != datagramSize)
+        else
         {
-            std::cerr << "send() error: " << datagramSize << " bytes were requested to be sent, but " << sentBytes
-                      << " were actually sent!\n";
+            metrics.sent++;
+            metrics.bytes += sentBytes;
         }
-
-        if (debug)
+        if (sentBytes != datagramSize)
         {
-            std::cout << "Asked to send " << datagramSize << " bytes, sent " << sentBytes << " bytes\n"
-                      << "Inserting sequence number " << prepDG.sequence_number << "\n\n";
+            ReportSendError(sentBytes, datagramSize);
         }
-        sentIDs.insert(prepDG.sequence_number);
-        free(realDG);
 
-        // Reciving data
-        ServerDatagram* serverDG = static_cast<ServerDatagram*>(malloc(sizeof(ServerDatagram)));
-        if (serverDG == 0)
+        if (Policy::LOG)
         {
-            std::bad_alloc ex;
-            throw ex;
+            std::cout << "Asked to send " << datagramSize << " bytes, sent " << sentBytes << " bytes\n"
+                      << "Marked sequence number " << base + i << " as sent\n\n";
         }
 
+        // Reciving data, into the same reply buffer every time
         const size_t RECIEVE_ATTEMPTS = 8;
         ssize_t recvBytes = 0;
         for (size_t i = 0; i < RECIEVE_ATTEMPTS; i++)
         {
-            recvBytes = recv(socketFD, static_cast<void *>(serverDG), sizeof(ServerDatagram), 0);
-            if (debug)
+            if (Policy::STATS && breakdown != nullptr)
+            {
+                recvBytes = RecieveTimestamped(socketFD, static_cast<void*>(&serverDG), sizeof(ReplyBuffer), 0,
+                                               nullptr, nullptr, recvStamps);
+            }
+            else
+            {
+                recvBytes = recv(socketFD, static_cast<void *>(&serverDG), sizeof(ReplyBuffer), 0);
+            }
+            if (Policy::LOG)
             {
                 if (recvBytes == -1 && (errno != EAGAIN || errno != EWOULDBLOCK))
                 {
@@ -291,117 +708,1834 @@ void SendAndRecieve(int socketFD, uint32_t datagramsToSend, US delay, bool debug
             }
             if (recvBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
             {
+                metrics.eagain++;
                 continue;
             }
+            if (recvBytes == -1)
+            {
+                metrics.Failed(errno);
+            }
 
             // We must have recieved something, if we get here, so break
             break;
         }
         if (recvBytes <= 0)
         {
-            free(serverDG);
             continue;
         }
-
-
-        if (debug)
+        if (Policy::STATS && breakdown != nullptr)
         {
-            std::cout << "Expected to recieve " << sizeof(ServerDatagram) << " bytes, recieved " << recvBytes
-                      << "bytes\n";
+            userRecv = RealtimeNs();
         }
 
-        // I suppose we're assuming that something was read here... Not anymore?
-        ServerDatagram data = {ntohl(serverDG->sequence_number), ntohs(serverDG->datagram_length)};
 
-        if (debug)
+        if (Policy::LOG)
         {
-            std::cout << "Recieved data: sequence number " << data.sequence_number << ", length "
-                      << data.datagram_length << "\n"
-                      << "Searching for recieved sequence number...\n";
+            std::cout << "Recieved " << recvBytes << " bytes\n";
         }
 
-        if (data.datagram_length != static_cast<uint16_t>(datagramSize))
+        // One reply may acknowledge many datagrams when the server aggregates its acks
+        bool known = ForEachAck(serverDG, recvBytes, [&](uint32_t sequence, uint16_t length)
         {
-            std::cout << "Sequence number " << data.sequence_number << " reports that " << data.datagram_length
-                      << " bytes were sent, but we (expected to) send " << datagramSize << " bytes!\n";
-        }
+            if (Policy::LOG)
+            {
+                std::cout << "Recieved data: sequence number " << sequence << ", length " << length << "\n"
+                          << "Searching for recieved sequence number...\n";
+            }
 
-        auto recvID = sentIDs.find(data.sequence_number); // sorry I can't be bothered to get the type right
-        if ( recvID == sentIDs.end())
-        {
-            std::cerr << "Recieved packet for unknown sequence ID " << serverDG->sequence_number << "!\n";
-        }
-        else
-        {
-            if (debug)
+            if (length != static_cast<uint16_t>(datagramSize))
             {
-                std::cout << "Found sequence number " << data.sequence_number << " and removing from set\n\n";
+                ReportLengthMismatch(sequence, length, datagramSize);
             }
 
-            sentIDs.erase(recvID);
+            SequenceTracker::AckResult result = tracker.MarkAcked(sequence);
+            switch (result)
+            {
+            case SequenceTracker::AckResult::Unknown:
+                metrics.unknown++;
+                ReportAckProblem(result, sequence);
+                break;
+            case SequenceTracker::AckResult::Duplicate:
+                metrics.duplicates++;
+                ReportAckProblem(result, sequence);
+                break;
+            case SequenceTracker::AckResult::New:
+                metrics.received++;
+                if (Policy::STATS)
+                {
+                    rtt.Record(NowNs() - sendTimes[sequence - base]);
+                }
+                if (Policy::STATS && breakdown != nullptr)
+                {
+                    // Aggregated replies carry no turnaround and are counted as incomplete
+                    uint32_t turnaround = recvBytes == sizeof(TimedServerDatagram)
+                                              ? ntohl(serverDG.timed.turnaround_ns) : 0;
+                    RecordBreakdown(socketFD, sequence - base, recvStamps, userRecv, turnaround, *breakdown);
+                }
+                if (Policy::LOG)
+                {
+                    std::cout << "Found sequence number " << sequence << " and marked it acked\n\n";
+                }
+                break;
+            }
+        });
+        if (!known)
+        {
+            ReportUnexpectedReply(recvBytes);
         }
-        free(serverDG);
     }
 
-    std::cout << datagramsToSend << " messages sent.\n"
-              << "Unacknowledged packets: " << sentIDs.size() << "\n";
+    if (zeroCopy != nullptr)
+    {
+        zeroCopy->Finish();
+    }
+    uint64_t loopAllocations = AllocationCount() - allocationsBefore;
 
 
-    if (debug)
+    if (Policy::LOG)
     {
         std::cout << "Finished network transmission!\n\n";
     }
 
-
+    return loopAllocations;
 }
 
-int main(int argc, char* argv[])
+/* LockstepLoop
+ * One specialization of SendAndRecieve, picked once in main.
+ */
+using LockstepLoop = uint64_t (*)(int, SequenceTracker&, DatagramPool&, Pacer&, LatencyHistogram&, LatencyBreakdown*,
+                                  ZeroCopySender*, ThreadMetrics&);
+
+/* PipelinedSender
+ * Sender half of the pipelined mode. Sends every datagram without waiting on any acknowledgments, publishing its
+ * progress through the shared state. With more than one segment per send, runs of datagrams are stamped into
+ * consecutive slots of a packed pool and handed to the kernel in one send(), which UDP_SEGMENT splits back up.
+ * Parameters:
+ *   int            socketFD        -- Connected, nonblocking socket
+ *   uint32_t       datagramsToSend -- Number of packets to send
+ *   uint32_t       segments        -- Datagrams per send() call, no larger than the pool
+ *   DatagramPool&  pool            -- Preformatted datagrams to send from
+ *   Pacer&         pacer           -- Decides when each datagram may be sent
+ *   PipelineState& state           -- State shared with the reciever
+ *   bool           debug           -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ */
+void PipelinedSender(int socketFD, uint32_t datagramsToSend, uint32_t segments, DatagramPool& pool, Pacer& pacer,
+                     PipelineState& state, bool debug)
 {
-    int retval = 0;
-    int udpSocket = -1;
-    uint16_t serverPort = PORT_NUMBER;
-    std::string serverName = SERVER_IP;
-    uint32_t datagramsToSend = NUMBER_OF_DATAGRAMS;
-    US sendDelay(0);
-    bool debug = false;
-    bool earlyStop = false;
+    const ssize_t datagramSize = pool.DatagramSize();
+    while (!state.started.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
 
-    try
+    const uint32_t base = state.tracker.Base();
+    for (uint32_t i = 0; i < datagramsToSend; i += segments)
     {
-        char c;
-        while ((c = getopt(argc, argv, "dhs:p:n:y:")) != -1)
+        const uint32_t run = std::min(segments, datagramsToSend - i);
+        for (uint32_t j = 0; j < run; j++)
         {
-            switch (c)
-            {
-            case 'd':
-                debug = true;
-                break;
-            case 'h':
-                std::cout << argv[0] << " (UDP Blaster Client) options:\n"
-                          << "-d           Enables debug output\n"
-                          << "-h           Displays this help and exit\n"
-                          << "-s [address] Set server address (default 127.0.0.1)\n"
-                          << "-p [port]    Set server port (default 39390)\n"
-                          << "-n [n]       Set number of datagrams to send (default 2^18)\n"
-                          << "-y [n]       Set delay in microseconds between datagrams (default 0)\n";
-                throw 0;
-
-            case 's':
-                serverName = optarg;
-                break;
-            case 'p':
-                serverPort = std::stoi(optarg);
-                break;
-            case 'n':
-                datagramsToSend = std::stoul(optarg);
-                break;
-            case 'y':
-                sendDelay = US(std::stoi(optarg));
-                break;
-            default:
-                std::cerr << "Unknown argument encountered.\n";
-                throw UNKNOWN_ARGUMENT;
-            }
+            pool.Stamp(j, base + i + j);
+            pacer.Wait();
+        }
+
+        // Publish the send before making it, the ack can beat send() back to user space
+        state.tracker.MarkSent(base + i + run - 1);
+        uint64_t now = NowNs();
+        for (uint32_t j = 0; j < run; j++)
+        {
+            state.sendTimes[i + j].store(now, std::memory_order_relaxed);
+        }
+
+        uint8_t* realDG = pool.Slot(0);
+        const ssize_t length = run * datagramSize;
+        ssize_t sentBytes = send(socketFD, static_cast<void*>(realDG), length, 0);
+
+        // A full send buffer is not a loss, wait for room and try again
+        while (sentBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            state.senderMetrics.eagain++;
+            pollfd writable = {socketFD, POLLOUT, 0};
+            poll(&writable, 1, 1);
+            sentBytes = send(socketFD, static_cast<void*>(realDG), length, 0);
+        }
+
+        if (sentBytes == -1)
+        {
+            state.senderMetrics.Failed(errno, run);
+        }
+        else
+        {
+            state.senderMetrics.sent += run;
+            state.senderMetrics.bytes += sentBytes;
+        }
+
+        if (sentBytes == -1)
+        {
+            std::cerr << "Error sending on socket\n";
+            perror("send()");
+        }
+        else if (sentBytes != length)
+        {
+            std::cerr << "send() error: " << length << " bytes were requested to be sent, but " << sentBytes
+                      << " were actually sent!\n";
+        }
+        else if (debug)
+        {
+            std::cout << "Sent packets " << base + i << " through " << base + i + run - 1 << "\n";
+        }
+    }
+
+    state.sendingDone.store(true, std::memory_order_release);
+}
+
+/* PipelinedReciever
+ * Reciever half of the pipelined mode. Matches acks whenever they arrive, and keeps doing so after the sender
+ * finishes until either every datagram is acknowledged or the drain timeout expires.
+ * Parameters:
+ *   int            socketFD     -- Connected, nonblocking socket
+ *   MS             drainTimeout -- How long to keep listening once the sender is done
+ *   PipelineState& state        -- State shared with the sender
+ *   bool           debug        -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ */
+void PipelinedReciever(int socketFD, MS drainTimeout, PipelineState& state, bool debug)
+{
+    const uint32_t datagramSize = state.datagramSize;
+    const int POLL_INTERVAL_MS = 10;
+    bool draining = false;
+    Clock::time_point drainDeadline;
+    while (!state.started.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+    while (true)
+    {
+        if (!draining && state.sendingDone.load(std::memory_order_acquire))
+        {
+            draining = true;
+            drainDeadline = Clock::now() + drainTimeout;
+        }
+        if (draining && (state.tracker.Unacknowledged() == 0 || Clock::now() >= drainDeadline))
+        {
+            break;
+        }
+
+        pollfd readable = {socketFD, POLLIN, 0};
+        if (poll(&readable, 1, POLL_INTERVAL_MS) <= 0)
+        {
+            continue;
+        }
+
+        // Drain everything that is queued before polling again
+        ReplyBuffer serverDG;
+        ssize_t recvBytes;
+        while ((recvBytes = recv(socketFD, static_cast<void*>(&serverDG), sizeof(ReplyBuffer), 0)) > 0)
+        {
+            uint64_t recvTime = NowNs();
+            bool known = ForEachAck(serverDG, recvBytes, [&](uint32_t sequence, uint16_t length)
+            {
+                if (length != static_cast<uint16_t>(datagramSize))
+                {
+                    std::cout << "Sequence number " << sequence << " reports that " << length
+                              << " bytes were sent, but we (expected to) send " << datagramSize << " bytes!\n";
+                }
+
+                SequenceTracker::AckResult result = state.tracker.MarkAcked(sequence);
+                if (result == SequenceTracker::AckResult::Unknown)
+                {
+                    state.recieverMetrics.unknown++;
+                    std::cerr << "Recieved packet for unknown sequence ID " << sequence << "!\n";
+                }
+                else if (result == SequenceTracker::AckResult::Duplicate)
+                {
+                    state.recieverMetrics.duplicates++;
+                }
+                else
+                {
+                    state.recieverMetrics.received++;
+                    uint32_t index = sequence - state.tracker.Base();
+                    state.rtt.Record(recvTime - state.sendTimes[index].load(std::memory_order_relaxed));
+                    if (debug)
+                    {
+                        std::cout << "Acknowledged sequence number " << sequence << "\n";
+                    }
+                }
+            });
+            if (!known)
+            {
+                std::cerr << "Recieved a reply of unexpected size (" << recvBytes << " bytes)\n";
+            }
+        }
+        if (recvBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            state.recieverMetrics.eagain++;
+        }
+        else if (recvBytes == -1)
+        {
+            state.recieverMetrics.Failed(errno);
+            perror("recv()");
+        }
+    }
+}
+
+/* SendAndRecievePipelined
+ * Pipelined alternative to SendAndRecieve. A dedicated sender thread and a dedicated reciever thread share the
+ * connected socket, so the send rate is not held back by recieving and late acks are still counted.
+ * Parameters:
+ *   int               socketFD     -- File descriptor for socket as prepared by EstablishConnection
+ *   SequenceTracker&  tracker      -- Tracker to record sends and acks in, its capacity is the number of packets to send
+ *   uint32_t          segments     -- Datagrams per send() call, more than one sends with UDP GSO from a packed pool
+ *   DatagramPool&     pool         -- Preformatted datagrams to send from
+ *   Pacer&            pacer        -- Decides when each datagram may be sent
+ *   MS                drainTimeout -- How long to wait for outstanding acks after the last send
+ *   LatencyHistogram& rtt          -- Histogram to record round trip times in
+ *   ThreadMetrics*    metrics      -- Live counters, the first for the sender thread and the second for the reciever
+ *   bool              debug        -- Enable debug messages
+ * Returns:
+ *   The number of heap allocations made while datagrams were flowing.
+ * Exceptions:
+ *   Will thow an exception if the tracking state cannot be allocated, a thread cannot be started, or the kernel
+ *   refuses UDP_SEGMENT.
+ */
+uint64_t SendAndRecievePipelined(int socketFD, SequenceTracker& tracker, uint32_t segments, DatagramPool& pool,
+                                 Pacer& pacer, MS drainTimeout, LatencyHistogram& rtt, ThreadMetrics* metrics,
+                                 bool debug)
+{
+    if (debug)
+    {
+        std::cout << "Entering SendAndRecievePipelined...\n\n";
+    }
+
+    // Every send() on the socket is cut into datagrams of this size until the option is cleared again
+    int segmentSize = segments > 1 ? static_cast<int>(pool.DatagramSize()) : 0;
+    if (segmentSize > 0 && setsockopt(socketFD, SOL_UDP, UDP_SEGMENT, &segmentSize, sizeof(segmentSize)) == -1)
+    {
+        std::runtime_error ex(std::string("Unable to enable UDP_SEGMENT: ") + strerror(errno));
+        throw ex;
+    }
+
+    PipelineState state(tracker, pool.DatagramSize(), rtt, metrics);
+
+    std::thread reciever(PipelinedReciever, socketFD, drainTimeout, std::ref(state), debug);
+    std::thread sender(PipelinedSender, socketFD, tracker.Capacity(), segments, std::ref(pool), std::ref(pacer),
+                       std::ref(state), debug);
+    PinToCpu(sender.native_handle(), 0);
+    PinToCpu(reciever.native_handle(), 1);
+
+    // Creating the threads allocates, so the counting window only opens once both exist
+    uint64_t allocationsBefore = AllocationCount();
+    state.started.store(true, std::memory_order_release);
+    sender.join();
+    reciever.join();
+    uint64_t loopAllocations = AllocationCount() - allocationsBefore;
+
+    if (segmentSize > 0)
+    {
+        segmentSize = 0;
+        setsockopt(socketFD, SOL_UDP, UDP_SEGMENT, &segmentSize, sizeof(segmentSize));
+    }
+
+    if (debug)
+    {
+        std::cout << "Finished network transmission!\n\n";
+    }
+
+    return loopAllocations;
+}
+
+/* RunDatagrams
+ * Runs one pass of datagrams through whichever send/recieve loop was selected.
+ * Parameters:
+ *   int               socketFD     -- File descriptor for socket as prepared by EstablishConnection
+ *   bool              pipelined    -- Use the pipelined loop rather than the lockstep one
+ *   SequenceTracker&  tracker      -- Tracker to record sends and acks in
+ *   uint32_t          segments     -- Datagrams per send() in the pipelined loop, the lockstep loop sends one at a time
+ *   DatagramPool&     pool         -- Preformatted datagrams to send from
+ *   Pacer&            pacer        -- Decides when each datagram may be sent
+ *   MS                drainTimeout -- How long the pipelined loop waits for outstanding acks
+ *   LatencyHistogram& rtt          -- Histogram to record round trip times in
+ *   LatencyBreakdown* breakdown    -- Kernel timestamped latency parts for the lockstep loop, nullptr for none
+ *   ZeroCopySender*   zeroCopy     -- Zero-copy sender for the lockstep loop, nullptr to send by copy
+ *   LockstepLoop      lockstep     -- Specialization of the lockstep loop to run
+ *   ThreadMetrics*    metrics      -- Two sets of live counters, the lockstep loop only uses the first
+ *   bool              debug        -- Enable debug messages in the pipelined loop
+ * Returns:
+ *   The number of heap allocations made while datagrams were flowing.
+ */
+uint64_t RunDatagrams(int socketFD, bool pipelined, SequenceTracker& tracker, uint32_t segments, DatagramPool& pool,
+                      Pacer& pacer, MS drainTimeout, LatencyHistogram& rtt, LatencyBreakdown* breakdown,
+                      ZeroCopySender* zeroCopy, LockstepLoop lockstep, ThreadMetrics* metrics, bool debug)
+{
+    if (pipelined)
+    {
+        return SendAndRecievePipelined(socketFD, tracker, segments, pool, pacer, drainTimeout, rtt, metrics, debug);
+    }
+    return lockstep(socketFD, tracker, pool, pacer, rtt, breakdown, zeroCopy, metrics[0]);
+}
+
+/* GsoSegments
+ * Limits a requested GSO run length so a whole run of datagrams still fits in a single UDP send.
+ * Parameters:
+ *   uint32_t requested    -- Datagrams per send asked for, 1 for no GSO
+ *   size_t   datagramSize -- Size of each datagram
+ * Returns:
+ *   The number of datagrams per send to use, at least 1.
+ */
+uint32_t GsoSegments(uint32_t requested, size_t datagramSize)
+{
+    uint32_t fit = datagramSize > 0 ? MAX_DATAGRAM_SIZE / datagramSize : MAX_GSO_SEGMENTS;
+    return std::max(1u, std::min(std::min(requested, MAX_GSO_SEGMENTS), fit));
+}
+
+/* MakeSendPool
+ * Builds the pool a run sends from: a single cache line aligned slot, or a packed slot per datagram of a GSO run.
+ */
+DatagramPool* MakeSendPool(uint32_t segments, const std::vector<uint8_t>& prototype)
+{
+    if (segments > 1)
+    {
+        return new DatagramPool(segments, prototype, 1);
+    }
+    return new DatagramPool(1, prototype);
+}
+
+/* RunSizeSweep
+ * Benchmark mode that repeats the run once per payload size and prints one row per size: achieved send rate,
+ * goodput (acknowledged payload bits over the time spent sending), loss and RTT percentiles. Each size gets its
+ * own block of sequence numbers so stragglers from the previous size are not mistaken for acks.
+ * Parameters:
+ *   int                          socketFD        -- File descriptor for socket as prepared by EstablishConnection
+ *   const std::vector<uint16_t>& sizes           -- Payload sizes to step through
+ *   uint32_t                     datagramsToSend -- Number of packets to send per size
+ *   bool                         pipelined       -- Use the pipelined loop rather than the lockstep one
+ *   uint32_t                     segments        -- Datagrams per GSO send in the pipelined loop, capped per size
+ *   double                       packetRate      -- Target rate in packets/s, 0 for none
+ *   double                       bitRate         -- Target rate in bits/s, 0 for none, converted per size
+ *   uint32_t                     burst           -- Pacer burst size
+ *   US                           delay           -- Fixed delay between sends when no rate is given
+ *   MS                           drainTimeout    -- How long the pipelined loop waits for outstanding acks
+ *   LockstepLoop                 lockstep        -- Specialization of the lockstep loop to run
+ *   ThreadMetrics*               metrics         -- Two sets of live counters, kept across every size
+ *   const std::string&           resultsPath     -- CSV file to append a row per size to, empty for none
+ *   bool                         debug           -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ */
+void RunSizeSweep(int socketFD, const std::vector<uint16_t>& sizes, uint32_t datagramsToSend, bool pipelined,
+                  uint32_t segments, double packetRate, double bitRate, uint32_t burst, US delay, MS drainTimeout,
+                  LockstepLoop lockstep, ThreadMetrics* metrics, const std::string& resultsPath, bool debug)
+{
+    std::cout << std::left << std::setw(10) << "payload" << std::setw(12) << "pps" << std::setw(12) << "Gbit/s"
+              << std::setw(10) << "loss%" << std::setw(12) << "p50(us)" << std::setw(12) << "p99(us)"
+              << std::setw(12) << "p99.9(us)" << "\n";
+
+    uint32_t base = 0;
+    for (uint16_t payloadLength : sizes)
+    {
+        const std::vector<uint8_t> prototype = BuildPatternTemplate(payloadLength);
+        const uint32_t runSegments = GsoSegments(segments, prototype.size());
+        std::unique_ptr<DatagramPool> pool(MakeSendPool(runSegments, prototype));
+        const uint32_t datagramSize = pool->DatagramSize();
+        double rate = bitRate > 0 ? bitRate / (datagramSize * 8.0) : packetRate;
+
+        SequenceTracker tracker(datagramsToSend, base);
+        LatencyHistogram rtt;
+        Pacer pacer(rate, burst, delay, datagramSize);
+        RunDatagrams(socketFD, pipelined, tracker, runSegments, *pool, pacer, drainTimeout, rtt, nullptr, nullptr,
+                     lockstep, metrics, debug);
+        base += datagramsToSend;
+
+        double pps = pacer.AchievedRate();
+        double sendSeconds = pps > 0 ? tracker.Sent() / pps : 0.0;
+        double goodput = sendSeconds > 0 ? tracker.Acknowledged() * payloadLength * 8.0 / sendSeconds / 1e9 : 0.0;
+        double loss = tracker.Sent() > 0 ? 100.0 * tracker.Unacknowledged() / tracker.Sent() : 0.0;
+
+        std::cout << std::left << std::fixed << std::setprecision(3)
+                  << std::setw(10) << payloadLength
+                  << std::setw(12) << std::setprecision(0) << pps
+                  << std::setw(12) << std::setprecision(3) << goodput
+                  << std::setw(10) << std::setprecision(2) << loss
+                  << std::setprecision(1)
+                  << std::setw(12) << rtt.Percentile(50.0) / 1000.0
+                  << std::setw(12) << rtt.Percentile(99.0) / 1000.0
+                  << std::setw(12) << rtt.Percentile(99.9) / 1000.0 << "\n";
+
+        if (!resultsPath.empty())
+        {
+            AppendResult(resultsPath, payloadLength, tracker.Sent(), tracker.Acknowledged(), pps, rtt);
+        }
+    }
+    std::cout << std::defaultfloat << std::right;
+}
+
+/* SearchMaxRate
+ * RFC 2544 style throughput search. Binary searches the offered rate for the highest one at which every one of a
+ * number of trials, each a fixed number of datagrams followed by the ack drain, keeps its loss within the threshold.
+ * The search starts from the given ceiling, or without one from what an unpaced trial manages, and stops once the
+ * passing and failing rates are within 1% of each other, or of the ceiling, so a host that loses too much at every
+ * rate does not send ever slower trials. Each trial gets its own block of sequence numbers, so late
+ * acks from the one before are not mistaken for its own.
+ * Parameters:
+ *   int                         socketFD        -- File descriptor for socket as prepared by EstablishConnection
+ *   const std::vector<uint8_t>& prototype       -- Formatted datagram to send
+ *   uint32_t                    datagramsToSend -- Number of packets to send per trial
+ *   bool                        pipelined       -- Use the pipelined loop rather than the lockstep one
+ *   uint32_t                    segments        -- Datagrams per GSO send in the pipelined loop
+ *   double                      maxRate         -- Highest rate to try in packets/s, 0 to measure it
+ *   uint32_t                    burst           -- Pacer burst size
+ *   double                      lossThreshold   -- Most loss a trial may see and still pass, in percent
+ *   unsigned int                trials          -- Trials per rate, all of which have to pass
+ *   MS                          drainTimeout    -- How long the pipelined loop waits for outstanding acks
+ *   LockstepLoop                lockstep        -- Specialization of the lockstep loop to run
+ *   ThreadMetrics*              metrics         -- Two sets of live counters, kept across every trial
+ *   const std::string&          resultsPath     -- CSV file to append the best passing trial to, empty for none
+ *   bool                        debug           -- Enable debug messages
+ * Returns:
+ *   The highest passing rate in packets/s, 0 if even the lowest rate tried lost too much.
+ */
+double SearchMaxRate(int socketFD, const std::vector<uint8_t>& prototype, uint32_t datagramsToSend, bool pipelined,
+                     uint32_t segments, double maxRate, uint32_t burst, double lossThreshold, unsigned int trials,
+                     MS drainTimeout, LockstepLoop lockstep, ThreadMetrics* metrics, const std::string& resultsPath,
+                     bool debug)
+{
+    const double PRECISION = 0.01;
+    const unsigned int MAX_STEPS = 30;
+    std::unique_ptr<DatagramPool> pool(MakeSendPool(segments, prototype));
+    const uint32_t datagramSize = pool->DatagramSize();
+    const uint32_t payloadLength = datagramSize - sizeof(ClientDatagram);
+
+    uint32_t base = 0;
+    uint64_t bestSent = 0;
+    uint64_t bestAcked = 0;
+    LatencyHistogram bestRtt;
+
+    std::cout << std::left << std::setw(14) << "offered pps" << std::setw(8) << "trial" << std::setw(14)
+              << "achieved pps" << std::setw(10) << "loss%" << std::setw(12) << "p99(us)" << "result\n";
+
+    // Runs every trial at a rate (0 for unpaced), stopping at the first failure
+    auto tryRate = [&](double rate, double& achieved)
+    {
+        achieved = 0;
+        for (unsigned int t = 0; t < trials; t++)
+        {
+            SequenceTracker tracker(datagramsToSend, base);
+            LatencyHistogram rtt;
+            Pacer pacer(rate, burst, US(0), datagramSize);
+            RunDatagrams(socketFD, pipelined, tracker, segments, *pool, pacer, drainTimeout, rtt, nullptr, nullptr,
+                         lockstep, metrics, debug);
+            base += datagramsToSend;
+
+            double loss = tracker.Sent() > 0 ? 100.0 * tracker.Unacknowledged() / tracker.Sent() : 100.0;
+            bool passed = loss <= lossThreshold;
+            achieved = t == 0 ? pacer.AchievedRate() : std::min(achieved, pacer.AchievedRate());
+            std::cout << std::left << std::fixed << std::setprecision(0) << std::setw(14) << rate << std::setw(8)
+                      << t + 1 << std::setw(14) << pacer.AchievedRate() << std::setprecision(3) << std::setw(10)
+                      << loss << std::setprecision(1) << std::setw(12) << rtt.Percentile(99.0) / 1000.0
+                      << (passed ? "pass" : "fail") << "\n" << std::flush;
+            if (!passed)
+            {
+                return false;
+            }
+            if (t == trials - 1)
+            {
+                bestSent = tracker.Sent();
+                bestAcked = tracker.Acknowledged();
+                bestRtt.Reset();
+                bestRtt.Merge(rtt);
+            }
+        }
+        return true;
+    };
+
+    // Without a ceiling, an unpaced trial shows the most this host can offer, and may pass outright
+    double low = 0;
+    double lowAchieved = 0;   // Slowest trial actually managed at the passing rate, pacing can fall short of it
+    double high = maxRate;
+    double achieved = 0;
+    if (high <= 0)
+    {
+        if (tryRate(0, achieved))
+        {
+            low = achieved;
+            lowAchieved = achieved;
+        }
+        high = achieved;
+    }
+    else if (tryRate(high, achieved))
+    {
+        low = high;
+        lowAchieved = achieved;
+    }
+
+    // Fixed at 1% of the ceiling rather than of the shrinking high end, so failing trials cannot halve forever
+    const double resolution = high * PRECISION;
+    for (unsigned int step = 0; low < high && high - low > resolution && step < MAX_STEPS; step++)
+    {
+        double rate = (low + high) / 2;
+        if (tryRate(rate, achieved))
+        {
+            low = rate;
+            lowAchieved = achieved;
+        }
+        else
+        {
+            high = rate;
+        }
+    }
+    std::cout << std::defaultfloat << std::right;
+
+    if (low <= 0)
+    {
+        std::cout << "\nNo rate kept loss within " << lossThreshold << "%\n";
+        return 0;
+    }
+    std::cout << std::fixed << std::setprecision(0) << "\nMaximum rate within " << std::setprecision(3)
+              << lossThreshold << "% loss: " << std::setprecision(0) << low << " pps offered, " << lowAchieved
+              << " pps achieved, goodput " << std::setprecision(3)
+              << lowAchieved * payloadLength * 8.0 * bestAcked / std::max<uint64_t>(bestSent, 1) / 1e6 << " Mbit/s ("
+              << trials << " trials per rate, " << datagramsToSend << " datagrams of " << datagramSize
+              << " bytes per trial)\n" << std::defaultfloat;
+    if (maxRate > 0 && low >= maxRate)
+    {
+        std::cout << "The -r/-R ceiling itself passed, so the host may manage more: raise it or leave it off\n";
+    }
+    if (!resultsPath.empty())
+    {
+        AppendResult(resultsPath, payloadLength, bestSent, bestAcked, lowAchieved, bestRtt);
+    }
+    return low;
+}
+
+/* CpuMsPerGbit
+ * Milliseconds of CPU time spent per gigabit of datagrams sent.
+ */
+double CpuMsPerGbit(uint64_t cpuNs, uint64_t datagrams, size_t datagramSize)
+{
+    double gigabits = datagrams * datagramSize * 8.0 / 1e9;
+    return gigabits > 0 ? cpuNs / 1e6 / gigabits : 0.0;
+}
+
+/* MeasureCopyingCpu
+ * Reference pass for -z: runs the lockstep loop the ordinary copying way, with the same datagrams, rate and length
+ * as the zero-copy run that follows, and measures the CPU time the thread spent per gigabit sent. The pass gets its
+ * own block of sequence numbers after the zero-copy run's.
+ * Parameters:
+ *   int                         socketFD        -- File descriptor for socket as prepared by EstablishConnection
+ *   const std::vector<uint8_t>& prototype       -- Formatted datagram to send
+ *   uint32_t                    datagramsToSend -- Number of packets to send
+ *   double                      rate            -- Target rate in packets/s, 0 for none
+ *   uint32_t                    burst           -- Pacer burst size
+ *   US                          delay           -- Fixed delay between sends when no rate is given
+ *   LockstepLoop                lockstep        -- Specialization of the lockstep loop to run
+ *   ThreadMetrics&              metrics         -- Live counters, shared with the zero-copy run
+ * Returns:
+ *   Milliseconds of CPU per Gbit sent by copy.
+ */
+double MeasureCopyingCpu(int socketFD, const std::vector<uint8_t>& prototype, uint32_t datagramsToSend, double rate,
+                         uint32_t burst, US delay, LockstepLoop lockstep, ThreadMetrics& metrics)
+{
+    SequenceTracker tracker(datagramsToSend, datagramsToSend);
+    LatencyHistogram rtt;
+    Pacer pacer(rate, burst, delay, prototype.size());
+    DatagramPool pool(1, prototype);
+
+    uint64_t cpuBefore = ThreadCpuNs();
+    lockstep(socketFD, tracker, pool, pacer, rtt, nullptr, nullptr, metrics);
+    double cpu = CpuMsPerGbit(ThreadCpuNs() - cpuBefore, tracker.Sent(), prototype.size());
+    std::cout << "Copying reference pass: " << tracker.Sent() << " messages sent, " << tracker.Unacknowledged()
+              << " unacknowledged, " << std::fixed << std::setprecision(1) << cpu << " ms CPU per Gbit\n"
+              << std::defaultfloat;
+    return cpu;
+}
+
+/* RunLoopBenchmark
+ * Microbenchmark of the lockstep loop: runs it unpaced once per policy against the server and prints what each
+ * datagram cost in user space instructions and cycles. Output is sent to /dev/null during the runs, so the debug
+ * policy pays for formatting its messages but not for a terminal.
+ * Parameters:
+ *   int                         socketFD        -- File descriptor for socket as prepared by EstablishConnection
+ *   uint32_t                    datagramsToSend -- Number of packets to send per policy
+ *   const std::vector<uint8_t>& prototype       -- Formatted datagram to send
+ *   ThreadMetrics&              metrics         -- Live counters, kept across every policy
+ * Returns:
+ *   Nothing.
+ */
+void RunLoopBenchmark(int socketFD, uint32_t datagramsToSend, const std::vector<uint8_t>& prototype,
+                      ThreadMetrics& metrics)
+{
+    struct Variant
+    {
+        const char* name;
+        LockstepLoop loop;
+    };
+    const Variant variants[] = {{QuietPolicy::Name(), SendAndRecieve<QuietPolicy>},
+                                {StatsPolicy::Name(), SendAndRecieve<StatsPolicy>},
+                                {DebugPolicy::Name(), SendAndRecieve<DebugPolicy>}};
+
+    std::cout << std::left << std::setw(10) << "policy" << std::setw(16) << "instr/dgram" << std::setw(16)
+              << "cycles/dgram" << std::setw(10) << "loss%" << "\n";
+
+    std::ofstream devNull("/dev/null");
+    uint32_t base = 0;
+    bool fromTsc = false;
+    for (const Variant& variant : variants)
+    {
+        SequenceTracker tracker(datagramsToSend, base);
+        LatencyHistogram rtt;
+        Pacer pacer(0, 1, US(0), prototype.size());
+        DatagramPool pool(1, prototype);
+        PerfCounters counters;
+
+        std::streambuf* savedOut = std::cout.rdbuf(devNull.rdbuf());
+        std::streambuf* savedErr = std::cerr.rdbuf(devNull.rdbuf());
+        counters.Start();
+        variant.loop(socketFD, tracker, pool, pacer, rtt, nullptr, nullptr, metrics);
+        counters.Stop();
+        std::cout.rdbuf(savedOut);
+        std::cerr.rdbuf(savedErr);
+        base += datagramsToSend;
+        fromTsc = counters.CyclesFromTsc();
+
+        double loss = tracker.Sent() > 0 ? 100.0 * tracker.Unacknowledged() / tracker.Sent() : 0.0;
+        std::cout << std::left << std::fixed << std::setprecision(1) << std::setw(10) << variant.name
+                  << std::setw(16);
+        if (counters.CountsInstructions())
+        {
+            std::cout << static_cast<double>(counters.Instructions()) / datagramsToSend;
+        }
+        else
+        {
+            std::cout << "n/a";
+        }
+        std::cout << std::setw(16) << static_cast<double>(counters.Cycles()) / datagramsToSend
+                  << std::setw(10) << std::setprecision(2) << loss << "\n";
+    }
+    std::cout << std::defaultfloat << std::right;
+
+    if (fromTsc)
+    {
+        std::cout << "No hardware counters available: cycles are " << PerfCounters::FallbackUnit()
+                  << " and include time in the kernel\n";
+    }
+}
+
+/* SendAndRecieveTransport
+ * Lockstep loop over a Transport (transport.hpp) instead of a socket: sends a datagram, then waits for its reply
+ * before sending the next. The kernel UDP path and the shared memory rings go through this same loop, so the
+ * difference between their round trips is the cost of the network stack.
+ * Parameters:
+ *   Transport&        transport -- Where datagrams go and replies come from
+ *   SequenceTracker&  tracker   -- Tracker to record sends and acks in, its capacity is the number of packets to send
+ *   DatagramPool&     pool      -- Preformatted datagrams to send from
+ *   Pacer&            pacer     -- Decides when each datagram may be sent
+ *   LatencyHistogram& rtt       -- Histogram to record round trip times in
+ *   ThreadMetrics&    metrics   -- Live counters for this thread
+ *   bool              debug     -- Enable debug messages
+ * Returns:
+ *   The number of heap allocations made while datagrams were flowing.
+ */
+uint64_t SendAndRecieveTransport(Transport& transport, SequenceTracker& tracker, DatagramPool& pool, Pacer& pacer,
+                                 LatencyHistogram& rtt, ThreadMetrics& metrics, bool debug)
+{
+    // How long a reply is waited for before its datagram is counted as lost
+    const int REPLY_TIMEOUT_MS = 100;
+
+    const uint32_t datagramsToSend = tracker.Capacity();
+    const uint32_t base = tracker.Base();
+    const ssize_t datagramSize = pool.DatagramSize();
+    std::unique_ptr<uint64_t[]> sendTimes(new uint64_t[datagramsToSend]);
+    ReplyBuffer reply;
+
+    if (debug)
+    {
+        std::cout << "Entering SendAndRecieveTransport over " << transport.Describe() << "...\n\n";
+    }
+
+    uint64_t allocationsBefore = AllocationCount();
+    for (uint32_t i = 0; i < datagramsToSend; i++)
+    {
+        uint8_t* datagram = pool.Stamp(i, base + i);
+        pacer.Wait();
+        tracker.MarkSent(base + i);
+        sendTimes[i] = NowNs();
+        ssize_t sentBytes = transport.Send(datagram, datagramSize);
+        if (sentBytes == -1)
+        {
+            metrics.Failed(errno);
+        }
+        else
+        {
+            metrics.sent++;
+            metrics.bytes += sentBytes;
+        }
+        if (sentBytes != datagramSize)
+        {
+            ReportSendError(sentBytes, datagramSize);
+            continue;
+        }
+
+        ssize_t recvBytes = transport.Recieve(&reply, sizeof(reply), REPLY_TIMEOUT_MS);
+        if (recvBytes == -1)
+        {
+            if (errno == EAGAIN)
+            {
+                metrics.eagain++;
+            }
+            else
+            {
+                metrics.Failed(errno);
+            }
+            continue;
+        }
+        if (debug)
+        {
+            std::cout << "Sent sequence number " << base + i << ", recieved " << recvBytes << " bytes back\n";
+        }
+
+        // A reply too long for the buffer was truncated, and is no format the server sends
+        bool known = static_cast<size_t>(recvBytes) <= sizeof(reply) &&
+                     ForEachAck(reply, recvBytes, [&](uint32_t sequence, uint16_t length)
+        {
+            if (length != static_cast<uint16_t>(datagramSize))
+            {
+                ReportLengthMismatch(sequence, length, datagramSize);
+            }
+
+            SequenceTracker::AckResult result = tracker.MarkAcked(sequence);
+            switch (result)
+            {
+            case SequenceTracker::AckResult::Unknown:
+                metrics.unknown++;
+                ReportAckProblem(result, sequence);
+                break;
+            case SequenceTracker::AckResult::Duplicate:
+                metrics.duplicates++;
+                ReportAckProblem(result, sequence);
+                break;
+            case SequenceTracker::AckResult::New:
+                metrics.received++;
+                rtt.Record(NowNs() - sendTimes[sequence - base]);
+                break;
+            }
+        });
+        if (!known)
+        {
+            ReportUnexpectedReply(recvBytes);
+        }
+    }
+
+    return AllocationCount() - allocationsBefore;
+}
+
+/* RunOverTransport
+ * Transport mode (-X): opens the chosen transport, runs one pass of the transport lockstep loop over it and reports
+ * the run along with the CPU each round trip cost this thread, user and kernel time together.
+ * Parameters:
+ *   const TransportOptions&     options         -- Transport to use
+ *   const std::string&          serverName      -- Address/IP of the server, for the UDP transport
+ *   uint16_t                    serverPort      -- Port of the server, for the UDP transport
+ *   const std::vector<uint8_t>& prototype       -- Formatted datagram to send
+ *   uint32_t                    datagramsToSend -- Number of packets to send
+ *   double                      packetRate      -- Target rate in packets/s, 0 for none
+ *   uint32_t                    burst           -- Pacer burst size
+ *   US                          delay           -- Fixed delay between sends when no rate is given
+ *   const std::string&          histogramPath   -- File to write the RTT histogram to, empty for none
+ *   const std::string&          resultsPath     -- CSV file to append the results to, empty for none
+ *   ThreadMetrics&              metrics         -- Live counters
+ *   bool                        debug           -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if the transport cannot be opened.
+ */
+void RunOverTransport(const TransportOptions& options, const std::string& serverName, uint16_t serverPort,
+                      const std::vector<uint8_t>& prototype, uint32_t datagramsToSend, double packetRate,
+                      uint32_t burst, US delay, const std::string& histogramPath, const std::string& resultsPath,
+                      ThreadMetrics& metrics, bool debug)
+{
+    int udpSocket = -1;
+    std::unique_ptr<Transport> transport;
+    if (options.kind == TransportOptions::Kind::Shm)
+    {
+        transport.reset(new ShmTransport(options.shmName, false, 0));
+    }
+    else
+    {
+        udpSocket = EstablishConnection(serverName, serverPort, debug);
+        if (socketTuning.Active())
+        {
+            PrintSocketBuffers(std::cout, udpSocket, socketTuning);
+        }
+        transport.reset(new UdpTransport(udpSocket, false));
+    }
+    std::cout << "Transport: " << transport->Describe() << "\n";
+    PinToCpu(pthread_self(), 0);
+
+    SequenceTracker tracker(datagramsToSend);
+    LatencyHistogram rtt;
+    Pacer pacer(packetRate, burst, delay, prototype.size());
+    DatagramPool pool(1, prototype);
+    uint64_t cpuBefore = ThreadCpuNs();
+    uint64_t loopAllocations = SendAndRecieveTransport(*transport, tracker, pool, pacer, rtt, metrics, debug);
+    uint64_t cpuNs = ThreadCpuNs() - cpuBefore;
+
+    PrintAckReport(tracker, rtt);
+    transport->PrintReport(std::cout);
+    std::cout << "CPU per round trip (client thread): " << std::fixed << std::setprecision(2)
+              << (tracker.Sent() > 0 ? cpuNs / 1000.0 / tracker.Sent() : 0.0) << " us\n" << std::defaultfloat;
+    PrintAllocationReport(loopAllocations);
+    if (pacer.Active())
+    {
+        pacer.PrintReport(std::cout);
+    }
+    if (!histogramPath.empty())
+    {
+        rtt.WriteCSV(histogramPath);
+    }
+    if (!resultsPath.empty())
+    {
+        AppendResult(resultsPath, prototype.size() - sizeof(ClientDatagram), tracker.Sent(), tracker.Acknowledged(),
+                     pacer.AchievedRate(), rtt);
+    }
+
+    transport.reset();
+    if (udpSocket >= 0)
+    {
+        close(udpSocket);
+    }
+}
+
+/* DrainReplies
+ * Reads every reply waiting on a nonblocking socket without blocking, counting the acks they carry.
+ * Parameters:
+ *   int            socketFD -- Connected, nonblocking socket
+ *   ReplyBuffer&   reply    -- Buffer to read into
+ *   ThreadMetrics& metrics  -- Counters to update, acks count as recieved
+ * Returns:
+ *   Nothing.
+ */
+void DrainReplies(int socketFD, ReplyBuffer& reply, ThreadMetrics& metrics)
+{
+    while (true)
+    {
+        ssize_t recvBytes = recv(socketFD, &reply, sizeof(reply), MSG_DONTWAIT);
+        if (recvBytes == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                metrics.Failed(errno);
+            }
+            return;
+        }
+        if (!ForEachAck(reply, recvBytes, [&](uint32_t, uint16_t) { metrics.received++; }))
+        {
+            metrics.unknown++;
+        }
+    }
+}
+
+/* ReplayCapture
+ * Replay mode (-Y): sends the datagrams of a trace the server recorded with -r, as they were recorded, with the gaps
+ * between them scaled by 1 / speed. Records stream through CaptureReader's mapping, so the trace may be larger than
+ * memory. Every datagram goes out from this client's one socket whatever its original source was, and one truncated
+ * by the recording server is padded back to its original length with zeros. Replies are counted but not matched up,
+ * since a trace of several clients repeats sequence numbers.
+ * Parameters:
+ *   int                socketFD     -- Connected, nonblocking socket
+ *   const std::string& path         -- Trace to replay
+ *   double             speed        -- Multiple of the recorded timing, 0 to send as fast as possible
+ *   MS                 drainTimeout -- How long to wait for late replies after the last send
+ *   ThreadMetrics&     metrics      -- Live counters
+ *   bool               debug        -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if the trace cannot be read.
+ */
+void ReplayCapture(int socketFD, const std::string& path, double speed, MS drainTimeout, ThreadMetrics& metrics,
+                   bool debug)
+{
+    // Longest a send waits for room in a full socket buffer before the datagram is given up on
+    const int SEND_WAIT_MS = 100;
+
+    CaptureReader reader(path);
+    std::cout << "Replaying " << reader.Records() << " datagrams from " << path;
+    if (speed > 0)
+    {
+        std::cout << " at " << speed << "x the recorded timing\n";
+    }
+    else
+    {
+        std::cout << " as fast as possible\n";
+    }
+    if (reader.Dropped() > 0)
+    {
+        std::cout << "The trace is missing " << reader.Dropped() << " datagrams that did not fit its file\n";
+    }
+
+    std::vector<uint8_t> padded(MAX_DATAGRAM_SIZE, 0);
+    ReplyBuffer reply;
+    LatencyHistogram lateness;
+    uint64_t truncated = 0;
+    uint64_t replayed = 0;
+    uint64_t start = 0;
+    uint64_t firstTimestamp = 0;
+    while (const CaptureRecord* record = reader.Next())
+    {
+        if (replayed == 0)
+        {
+            start = NowNs();
+            firstTimestamp = record->timestampNs;
+        }
+        if (speed > 0)
+        {
+            int64_t deadline = start + static_cast<int64_t>((record->timestampNs - firstTimestamp) / speed);
+            Pacer::SpinUntil(deadline);
+            lateness.Record(NowNs() - deadline);
+        }
+
+        const uint8_t* datagram = CaptureReader::Data(record);
+        size_t length = std::min<size_t>(record->length, MAX_DATAGRAM_SIZE);
+        if (record->captured < length)
+        {
+            memcpy(padded.data(), datagram, record->captured);
+            memset(padded.data() + record->captured, 0, length - record->captured);
+            datagram = padded.data();
+            truncated++;
+        }
+
+        ssize_t sentBytes = send(socketFD, datagram, length, 0);
+        if (sentBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            pollfd waitFor;
+            waitFor.fd = socketFD;
+            waitFor.events = POLLOUT;
+            waitFor.revents = 0;
+            poll(&waitFor, 1, SEND_WAIT_MS);
+            sentBytes = send(socketFD, datagram, length, 0);
+        }
+        if (sentBytes == -1)
+        {
+            metrics.Failed(errno);
+        }
+        else
+        {
+            metrics.sent++;
+            metrics.bytes += sentBytes;
+        }
+        if (debug)
+        {
+            std::cout << "Replayed sequence number " << record->sequence << ", " << length << " bytes at "
+                      << (record->timestampNs - firstTimestamp) / 1000 << "us into the trace\n";
+        }
+        replayed++;
+
+        DrainReplies(socketFD, reply, metrics);
+    }
+    double seconds = replayed > 0 ? (NowNs() - start) / 1e9 : 0.0;
+
+    // Late replies trickle in for a while after the last send
+    pollfd waitFor;
+    waitFor.fd = socketFD;
+    waitFor.events = POLLIN;
+    waitFor.revents = 0;
+    while (poll(&waitFor, 1, drainTimeout.count()) > 0)
+    {
+        DrainReplies(socketFD, reply, metrics);
+    }
+
+    std::cout << std::fixed << std::setprecision(3) << "Replayed " << replayed << " datagrams (" << metrics.bytes
+              << " bytes) in " << seconds << " s, " << metrics.errors << " errors, " << truncated
+              << " padded back out after truncation\n" << std::defaultfloat
+              << "Acks recieved: " << metrics.received << ", unexpected replies: " << metrics.unknown << "\n";
+    if (speed > 0)
+    {
+        lateness.PrintSummary(std::cout, "Send lateness against the trace");
+    }
+}
+
+/* LoadFlow
+ * One simulated client of the load generator: its own connected socket (and so its own source port), sequence
+ * space, send timestamps and RTT histogram. Only the thread that owns the flow ever touches it.
+ */
+struct LoadFlow
+{
+    LoadFlow(int socketFD, uint32_t datagramsToSend, const std::vector<uint8_t>& prototype)
+        : socketFD(socketFD), tracker(datagramsToSend), sendTimes(new uint64_t[datagramsToSend]), pool(1, prototype)
+    {
+    }
+
+    int socketFD;
+    SequenceTracker tracker;
+    std::unique_ptr<uint64_t[]> sendTimes;  // Send timestamp per sequence number
+    DatagramPool pool;
+    LatencyHistogram rtt;
+    uint64_t firstSend = 0;                 // Timestamps bounding the flow's sends, for its rate
+    uint64_t lastSend = 0;
+    uint16_t localPort = 0;                 // Source port the kernel picked, to tell flows apart in the report
+};
+
+/* DrainFlowAcks
+ * Reads every ack queued on a flow's socket and records it against the flow.
+ * Parameters:
+ *   LoadFlow&      flow    -- Flow whose socket is readable
+ *   ThreadMetrics& metrics -- Live counters of the thread that owns the flow
+ *   bool           debug   -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ */
+void DrainFlowAcks(LoadFlow& flow, ThreadMetrics& metrics, bool debug)
+{
+    const uint16_t datagramSize = static_cast<uint16_t>(flow.pool.DatagramSize());
+    ReplyBuffer serverDG;
+    ssize_t recvBytes;
+    while ((recvBytes = recv(flow.socketFD, static_cast<void*>(&serverDG), sizeof(ReplyBuffer), 0)) > 0)
+    {
+        uint64_t recvTime = NowNs();
+        ForEachAck(serverDG, recvBytes, [&](uint32_t sequence, uint16_t length)
+        {
+            if (length != datagramSize)
+            {
+                std::cout << "Flow on port " << flow.localPort << ": sequence number " << sequence
+                          << " reports that " << length << " bytes were sent, but we (expected to) send "
+                          << datagramSize << " bytes!\n";
+            }
+
+            SequenceTracker::AckResult result = flow.tracker.MarkAcked(sequence);
+            if (result == SequenceTracker::AckResult::Unknown)
+            {
+                metrics.unknown++;
+            }
+            else if (result == SequenceTracker::AckResult::Duplicate)
+            {
+                metrics.duplicates++;
+            }
+            else
+            {
+                metrics.received++;
+                flow.rtt.Record(recvTime - flow.sendTimes[sequence]);
+                if (debug)
+                {
+                    std::cout << "Flow on port " << flow.localPort << " acknowledged sequence number " << sequence
+                              << "\n";
+                }
+            }
+        });
+    }
+    if (recvBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        metrics.eagain++;
+    }
+    else if (recvBytes == -1)
+    {
+        metrics.Failed(errno);
+        perror("recv()");
+    }
+}
+
+/* WatchFlows
+ * Creates the epoll instance a load thread waits on and adds its flows' sockets to it. This is done before the thread
+ * starts, so a failure reaches the caller as an exception rather than ending the process from inside the thread.
+ * Parameters:
+ *   const std::vector<LoadFlow*>& flows -- Flows the thread will own
+ * Returns:
+ *   The epoll instance, for the caller to close once the thread is done.
+ * Exceptions:
+ *   Will throw an exception if the instance cannot be created or a socket cannot be added to it.
+ */
+int WatchFlows(const std::vector<LoadFlow*>& flows)
+{
+    int epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFD == -1)
+    {
+        std::runtime_error ex(std::string("epoll_create1: ") + strerror(errno));
+        throw ex;
+    }
+    for (LoadFlow* flow : flows)
+    {
+        epoll_event interest;
+        memset(&interest, 0, sizeof(interest));
+        interest.events = EPOLLIN;
+        interest.data.ptr = flow;
+        if (epoll_ctl(epollFD, EPOLL_CTL_ADD, flow->socketFD, &interest) == -1)
+        {
+            std::runtime_error ex("Unable to watch the flow on port " + std::to_string(flow->localPort) + ": "
+                                  + strerror(errno));
+            close(epollFD);
+            throw ex;
+        }
+    }
+    return epollFD;
+}
+
+/* RunLoadThread
+ * Drives a share of the load generator's flows. Sends go round robin, one datagram per flow per round, and after
+ * every send an epoll check picks out just the flows with acks waiting, so the cost does not grow with the flow
+ * count.
+ * Once every flow has sent its datagrams the thread keeps collecting acks until they are all in or the drain
+ * timeout expires.
+ * Parameters:
+ *   std::vector<LoadFlow*> flows           -- Flows this thread owns
+ *   int                    epollFD         -- epoll instance watching those flows' sockets, see WatchFlows
+ *   uint32_t               datagramsToSend -- Number of packets to send per flow
+ *   double                 packetRate      -- Combined rate of this thread's flows in packets/s, 0 for none
+ *   uint32_t               burst           -- Pacer burst size
+ *   US                     delay           -- Fixed delay between sends when no rate is given
+ *   MS                     drainTimeout    -- How long to wait for outstanding acks after the last send
+ *   ThreadMetrics&         metrics         -- Live counters for this thread
+ *   bool                   debug           -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ */
+void RunLoadThread(std::vector<LoadFlow*> flows, int epollFD, uint32_t datagramsToSend, double packetRate,
+                   uint32_t burst, US delay, MS drainTimeout, ThreadMetrics& metrics, bool debug)
+{
+    if (flows.empty())
+    {
+        return;
+    }
+
+    Pacer pacer(packetRate, burst, delay, flows[0]->pool.DatagramSize());
+
+    // Collects acks from whichever flows have them, waiting up to timeoutMs for the first one
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    auto collect = [&](int timeoutMs)
+    {
+        int ready = epoll_wait(epollFD, events, MAX_EVENTS, timeoutMs);
+        for (int e = 0; e < ready; e++)
+        {
+            DrainFlowAcks(*static_cast<LoadFlow*>(events[e].data.ptr), metrics, debug);
+        }
+    };
+
+
+    for (uint32_t i = 0; i < datagramsToSend; i++)
+    {
+        for (LoadFlow* flow : flows)
+        {
+            const ssize_t datagramSize = flow->pool.DatagramSize();
+            uint8_t* realDG = flow->pool.Stamp(i, i);
+
+            pacer.Wait();
+            flow->tracker.MarkSent(i);
+            uint64_t now = NowNs();
+            flow->sendTimes[i] = now;
+            if (i == 0)
+            {
+                flow->firstSend = now;
+            }
+            flow->lastSend = now;
+
+            ssize_t sentBytes = send(flow->socketFD, static_cast<void*>(realDG), datagramSize, 0);
+            while (sentBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                metrics.eagain++;
+                pollfd writable = {flow->socketFD, POLLOUT, 0};
+                poll(&writable, 1, 1);
+                sentBytes = send(flow->socketFD, static_cast<void*>(realDG), datagramSize, 0);
+            }
+            if (sentBytes == -1)
+            {
+                metrics.Failed(errno);
+                std::cerr << "Flow on port " << flow->localPort << ": error sending on socket\n";
+                perror("send()");
+            }
+            else
+            {
+                metrics.sent++;
+                metrics.bytes += sentBytes;
+            }
+
+            collect(0);
+        }
+    }
+
+    Clock::time_point drainDeadline = Clock::now() + drainTimeout;
+    const int POLL_INTERVAL_MS = 10;
+    while (Clock::now() < drainDeadline)
+    {
+        bool outstanding = false;
+        for (LoadFlow* flow : flows)
+        {
+            if (flow->tracker.Unacknowledged() > 0)
+            {
+                outstanding = true;
+                break;
+            }
+        }
+        if (!outstanding)
+        {
+            break;
+        }
+        collect(POLL_INTERVAL_MS);
+    }
+
+}
+
+/* RaiseFileLimit
+ * Lifts the soft open file limit as far as needed for the load generator's sockets.
+ * Parameters:
+ *   rlim_t needed -- Number of descriptors the process will need
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if the hard limit is too low.
+ */
+void RaiseFileLimit(rlim_t needed)
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur >= needed)
+    {
+        return;
+    }
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed)
+    {
+        std::runtime_error ex("Need " + std::to_string(needed) + " open files but the limit is "
+                              + std::to_string(limit.rlim_max));
+        throw ex;
+    }
+    limit.rlim_cur = needed;
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+/* PrintLoadReport
+ * Displays one row per flow (loss, send rate and RTT percentiles) followed by the same figures for all flows
+ * together.
+ * Parameters:
+ *   const std::vector<std::unique_ptr<LoadFlow>>& flows -- Flows to report on
+ *   LatencyHistogram&                             total -- Histogram to merge every flow's RTTs into
+ * Returns:
+ *   The combined send rate of all flows in packets/s.
+ */
+double PrintLoadReport(const std::vector<std::unique_ptr<LoadFlow>>& flows, LatencyHistogram& total)
+{
+    std::cout << std::left << std::setw(8) << "flow" << std::setw(8) << "port" << std::setw(10) << "sent"
+              << std::setw(10) << "lost" << std::setw(10) << "loss%" << std::setw(12) << "pps" << std::setw(12)
+              << "p50(us)" << std::setw(12) << "p99(us)" << std::setw(12) << "p99.9(us)" << "\n";
+
+    uint64_t sent = 0;
+    uint64_t lost = 0;
+    uint64_t firstSend = UINT64_MAX;
+    uint64_t lastSend = 0;
+    for (size_t f = 0; f < flows.size(); f++)
+    {
+        const LoadFlow& flow = *flows[f];
+        uint32_t flowSent = flow.tracker.Sent();
+        uint32_t flowLost = flow.tracker.Unacknowledged();
+        double seconds = (flow.lastSend - flow.firstSend) / 1e9;
+
+        std::cout << std::left << std::fixed
+                  << std::setw(8) << f
+                  << std::setw(8) << flow.localPort
+                  << std::setw(10) << flowSent
+                  << std::setw(10) << flowLost
+                  << std::setw(10) << std::setprecision(2) << (flowSent > 0 ? 100.0 * flowLost / flowSent : 0.0)
+                  << std::setw(12) << std::setprecision(0) << (seconds > 0 ? (flowSent - 1) / seconds : 0.0)
+                  << std::setprecision(1)
+                  << std::setw(12) << flow.rtt.Percentile(50.0) / 1000.0
+                  << std::setw(12) << flow.rtt.Percentile(99.0) / 1000.0
+                  << std::setw(12) << flow.rtt.Percentile(99.9) / 1000.0 << "\n";
+
+        sent += flowSent;
+        lost += flowLost;
+        firstSend = std::min(firstSend, flow.firstSend);
+        lastSend = std::max(lastSend, flow.lastSend);
+        total.Merge(flow.rtt);
+    }
+    std::cout << std::defaultfloat << std::right;
+
+    double seconds = lastSend > firstSend ? (lastSend - firstSend) / 1e9 : 0.0;
+    std::cout << std::fixed << std::setprecision(2)
+              << "\nAll " << flows.size() << " flows: " << sent << " messages sent, " << lost << " unacknowledged ("
+              << (sent > 0 ? 100.0 * lost / sent : 0.0) << "% loss), " << std::setprecision(0)
+              << (seconds > 0 ? sent / seconds : 0.0) << " pps\n" << std::defaultfloat;
+    total.PrintSummary(std::cout, "RTT");
+    return seconds > 0 ? sent / seconds : 0.0;
+}
+
+/* RunLoadGenerator
+ * Load generator mode: opens flowCount connected sockets, each with its own source port and sequence space, and
+ * drives them from threadCount threads, so the server sees many independent senders at once.
+ * Parameters:
+ *   const std::string&          serverName      -- Address/IP of the server
+ *   uint16_t                    serverPort      -- Port of the server
+ *   unsigned int                flowCount       -- Number of flows (sockets) to open
+ *   unsigned int                threadCount     -- Number of threads to spread the flows over
+ *   const std::vector<uint8_t>& prototype       -- Formatted datagram every flow sends
+ *   uint32_t                    datagramsToSend -- Number of packets to send per flow
+ *   double                      packetRate      -- Combined target rate of all flows in packets/s, 0 for none
+ *   uint32_t                    burst           -- Pacer burst size
+ *   US                          delay           -- Fixed delay between sends of one thread when no rate is given
+ *   MS                          drainTimeout    -- How long to wait for outstanding acks after the last send
+ *   const std::string&          histogramPath   -- File to write the combined RTT histogram to, empty for none
+ *   const std::string&          resultsPath     -- CSV file to append a row for all flows together to, empty for none
+ *   ThreadMetrics*              metrics         -- Live counters, one set for each thread
+ *   bool                        debug           -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if a socket cannot be opened or watched, or a thread cannot be started.
+ */
+void RunLoadGenerator(const std::string& serverName, uint16_t serverPort, unsigned int flowCount,
+                      unsigned int threadCount, const std::vector<uint8_t>& prototype, uint32_t datagramsToSend,
+                      double packetRate, uint32_t burst, US delay, MS drainTimeout, const std::string& histogramPath,
+                      const std::string& resultsPath, ThreadMetrics* metrics, bool debug)
+{
+    RaiseFileLimit(flowCount + 64);
+
+    std::vector<std::unique_ptr<LoadFlow>> flows;
+    std::vector<int> epollFDs;
+    try
+    {
+        for (unsigned int f = 0; f < flowCount; f++)
+        {
+            int socketFD = EstablishConnection(serverName, serverPort, debug);
+            flows.emplace_back(new LoadFlow(socketFD, datagramsToSend, prototype));
+            if (f == 0 && socketTuning.Active())
+            {
+                PrintSocketBuffers(std::cout, socketFD, socketTuning);
+            }
+
+            sockaddr_storage local;
+            socklen_t length = sizeof(local);
+            if (getsockname(socketFD, reinterpret_cast<sockaddr*>(&local), &length) == 0)
+            {
+                flows.back()->localPort = ntohs(local.ss_family == AF_INET6
+                                                ? reinterpret_cast<sockaddr_in6*>(&local)->sin6_port
+                                                : reinterpret_cast<sockaddr_in*>(&local)->sin_port);
+            }
+        }
+
+        threadCount = std::min(threadCount, flowCount);
+        std::cout << "Load generator: " << flowCount << " flows on " << threadCount << " threads, "
+                  << datagramsToSend << " datagrams per flow\n";
+
+        // Flows are dealt out round robin, each thread's pacer gets its share of the combined rate
+        std::vector<std::vector<LoadFlow*>> shares(threadCount);
+        for (unsigned int f = 0; f < flowCount; f++)
+        {
+            shares[f % threadCount].push_back(flows[f].get());
+        }
+        for (unsigned int t = 0; t < threadCount; t++)
+        {
+            epollFDs.push_back(WatchFlows(shares[t]));
+        }
+
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < threadCount; t++)
+        {
+            double threadRate = packetRate * shares[t].size() / flowCount;
+            threads.emplace_back(RunLoadThread, shares[t], epollFDs[t], datagramsToSend, threadRate, burst, delay,
+                                 drainTimeout, std::ref(metrics[t]), debug);
+            PinToCpu(threads.back().native_handle(), t);
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+    }
+    catch (...)
+    {
+        for (int epollFD : epollFDs)
+        {
+            close(epollFD);
+        }
+        for (const std::unique_ptr<LoadFlow>& flow : flows)
+        {
+            close(flow->socketFD);
+        }
+        throw;
+    }
+    for (int epollFD : epollFDs)
+    {
+        close(epollFD);
+    }
+
+    LatencyHistogram total;
+    double pps = PrintLoadReport(flows, total);
+    uint64_t kernelDrops = 0;
+    for (const std::unique_ptr<LoadFlow>& flow : flows)
+    {
+        kernelDrops += SocketDrops(flow->socketFD);
+    }
+    std::cout << "Acks dropped by the kernel (recieve queue full): " << kernelDrops << "\n";
+
+    LossAnalysis analysis;
+    for (const std::unique_ptr<LoadFlow>& flow : flows)
+    {
+        analysis.Add(flow->tracker);
+    }
+    analysis.Print(std::cout);
+    if (!histogramPath.empty())
+    {
+        total.WriteCSV(histogramPath);
+    }
+    if (!resultsPath.empty())
+    {
+        uint64_t sent = 0;
+        uint64_t acknowledged = 0;
+        for (const std::unique_ptr<LoadFlow>& flow : flows)
+        {
+            sent += flow->tracker.Sent();
+            acknowledged += flow->tracker.Acknowledged();
+        }
+        AppendResult(resultsPath, prototype.size() - sizeof(ClientDatagram), sent, acknowledged, pps, total);
+    }
+
+    for (const std::unique_ptr<LoadFlow>& flow : flows)
+    {
+        close(flow->socketFD);
+    }
+}
+
+/* StartMetrics
+ * Starts the live reporter over the counters of every thread, if the options ask for one.
+ * Parameters:
+ *   const MetricsOptions&             options -- Interval, format and path
+ *   const std::vector<ThreadMetrics>& metrics -- Counters of every thread, which must outlive the reporter
+ * Returns:
+ *   The reporter, or an empty pointer if live reporting is off.
+ */
+std::unique_ptr<MetricsReporter> StartMetrics(const MetricsOptions& options, const std::vector<ThreadMetrics>& metrics)
+{
+    if (options.interval.count() == 0)
+    {
+        return std::unique_ptr<MetricsReporter>();
+    }
+
+    MetricsReporter::Sampler sampler = [&metrics](MetricsSnapshot& snapshot)
+    {
+        for (const ThreadMetrics& thread : metrics)
+        {
+            thread.AddTo(snapshot);
+        }
+    };
+    return std::unique_ptr<MetricsReporter>(new MetricsReporter(sampler, options, "client"));
+}
+
+/* ParsePayloadSize
+ * Reads a payload size and checks that it fits in a UDP datagram along with the header.
+ * Parameters:
+ *   const std::string& text -- Size to parse
+ * Returns:
+ *   The size in bytes.
+ * Exceptions:
+ *   Will throw an exception if the size is not a number or is too large.
+ */
+uint16_t ParsePayloadSize(const std::string& text)
+{
+    unsigned long size = std::stoul(text);
+    if (size > MAX_DATAGRAM_SIZE - sizeof(ClientDatagram))
+    {
+        throw std::out_of_range("Payload size " + text + " does not fit in a UDP datagram");
+    }
+    return static_cast<uint16_t>(size);
+}
+
+/* ParseSizeList
+ * Reads a comma separated list of payload sizes, such as 0,64,1400,8972.
+ * Parameters:
+ *   const std::string& text -- List to parse
+ * Returns:
+ *   The sizes, in the order given.
+ * Exceptions:
+ *   Will throw an exception if any size is not a number or does not fit in a UDP datagram.
+ */
+std::vector<uint16_t> ParseSizeList(const std::string& text)
+{
+    std::vector<uint16_t> sizes;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        sizes.push_back(ParsePayloadSize(item));
+    }
+    return sizes;
+}
+
+int main(int argc, char* argv[])
+{
+    int retval = 0;
+    int udpSocket = -1;
+    uint16_t serverPort = PORT_NUMBER;
+    std::string serverName = SERVER_IP;
+    uint32_t datagramsToSend = NUMBER_OF_DATAGRAMS;
+    US sendDelay(0);
+    double packetRate = 0;
+    double bitRate = 0;
+    uint32_t burst = 1;
+    MS drainTimeout(1000);
+    bool pipelined = false;
+    uint32_t gsoSegments = 1;
+    bool kernelTimestamps = false;
+    bool zeroCopy = false;
+    bool quiet = false;
+    bool loopBenchmark = false;
+    double searchLoss = -1;
+    unsigned int searchTrials = 3;
+    std::string histogramPath;
+    std::string resultsPath;
+    bool patternPayload = false;
+    uint16_t payloadLength = 0;
+    std::vector<uint16_t> sweepSizes;
+    unsigned int flowCount = 0;
+    unsigned int loadThreads = std::max(1u, std::thread::hardware_concurrency());
+    MetricsOptions metricsOptions;
+    TransportOptions transportOptions;
+    std::string replayPath;
+    double replaySpeed = 1.0;
+    bool debug = false;
+    bool earlyStop = false;
+
+    try
+    {
+        char c;
+        while ((c = getopt(argc, argv, "dhqMs:p:n:y:r:R:B:PG:w:H:a:Kl:S:F:T:c:o:L:i:C:W:Z:zX:Y:x:")) != -1)
+        {
+            switch (c)
+            {
+            case 'd':
+                debug = true;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 'M':
+                loopBenchmark = true;
+                break;
+            case 'h':
+                std::cout << argv[0] << " (UDP Blaster Client) options:\n"
+                          << "-d           Enables debug output\n"
+                          << "-h           Displays this help and exit\n"
+                          << "-q           Quiet lockstep loop: no RTTs or other statistics beyond the loss count\n"
+                          << "-M           Microbenchmark the lockstep loop: instructions and cycles per datagram\n"
+                          << "             for each of the quiet, stats and debug builds of the loop\n"
+                          << "-s [address] Set server address (default 127.0.0.1)\n"
+                          << "-p [port]    Set server port (default 39390)\n"
+                          << "-n [n]       Set number of datagrams to send (default 2^18)\n"
+                          << "-y [n]       Set delay in microseconds between datagrams (default 0)\n"
+                          << "-r [rate]    Pace sends to a rate in packets/s, k/M/G suffixes allowed (overrides -y)\n"
+                          << "-R [rate]    Pace sends to a rate in bits/s, k/M/G suffixes allowed (overrides -y)\n"
+                          << "-B [n]       Let up to n datagrams go out back to back when paced (default 1)\n"
+                          << "-P           Pipelined mode: separate sender and reciever threads\n"
+                          << "-G [n]       Pipelined mode: hand the kernel runs of n datagrams per send with UDP GSO,\n"
+                          << "             up to " << MAX_GSO_SEGMENTS << " (default 1, no GSO)\n"
+                          << "-w [ms]      Set how long pipelined mode waits for late acks (default 1000)\n"
+                          << "-H [file]    Write the full RTT histogram to file as CSV\n"
+                          << "-a [file]    Append the results (rate, goodput, loss, RTT percentiles) to a CSV file,\n"
+                          << "             one row per run or per size with -S\n"
+                          << "-K           Lockstep mode: break each round trip down with kernel timestamps\n"
+                          << "             (against a server started with -K)\n"
+                          << "-l [bytes]   Send a payload of this many pattern bytes, 0 to "
+                          << MAX_DATAGRAM_SIZE - sizeof(ClientDatagram) << " (default: the name string)\n"
+                          << "-S [list]    Sweep through a comma separated list of payload sizes, one run each\n"
+                          << "-F [n]       Load generator: n flows, each with its own socket and sequence space,\n"
+                          << "             sending -n datagrams apiece (-r/-R is the combined rate)\n"
+                          << "-T [n]       Drive the -F flows from n threads (default: one per core)\n"
+                          << "-L [loss%]   Search for the highest rate whose trials all stay within this much loss,\n"
+                          << "             -n datagrams per trial, never above -r/-R if given, else an unpaced trial's\n"
+                          << "             rate (RFC 2544 style)\n"
+                          << "-i [n]       Trials per rate in the -L search (default 3)\n"
+                          << "-C [cpus]    Pin the datagram threads to these CPUs in turn, e.g. 0,2-3: the main loop\n"
+                          << "             or pipelined sender gets the first, the pipelined reciever the second,\n"
+                          << "             each -F thread the next one\n"
+                          << "-W [n]       Ask for n byte socket recieve and send buffers, and show what was granted\n"
+                          << "-Z [us]      Busy poll recieves for up to us microseconds (SO_BUSY_POLL)\n"
+                          << "-z           Send with MSG_ZEROCOPY from a pool of locked buffers, after a copying\n"
+                          << "             reference pass of the same length, and compare their CPU per Gbit\n"
+                          << "-X [t]       Lockstep through a transport: udp (the socket) or shm:name (shared memory\n"
+                          << "             rings to a server on this host started with the same -X, no network stack)\n"
+                          << "-Y [file]    Replay a trace recorded by server -r with its original timing, waiting -w\n"
+                          << "             for the last replies\n"
+                          << "-x [factor]  Replay at this multiple of the recorded speed, 0 for as fast as possible\n"
+                          << "             (default 1)\n"
+                          << "-c [s]       Report live counters every s seconds (default off, 1s with -o)\n"
+                          << "-o [fmt]     Live report format: text, json[:path] (JSON lines) or prom:path\n"
+                          << "             (Prometheus textfile) (default text)\n";
+                throw 0;
+
+            case 's':
+                serverName = optarg;
+                break;
+            case 'p':
+                serverPort = std::stoi(optarg);
+                break;
+            case 'n':
+                datagramsToSend = std::stoul(optarg);
+                break;
+            case 'y':
+                sendDelay = US(std::stoi(optarg));
+                break;
+            case 'r':
+                packetRate = Pacer::ParseRate(optarg);
+                bitRate = 0;
+                break;
+            case 'R':
+                bitRate = Pacer::ParseRate(optarg);
+                packetRate = 0;
+                break;
+            case 'B':
+                burst = std::stoul(optarg);
+                break;
+            case 'P':
+                pipelined = true;
+                break;
+            case 'G':
+                gsoSegments = std::stoul(optarg);
+                if (gsoSegments == 0 || gsoSegments > MAX_GSO_SEGMENTS)
+                {
+                    throw std::out_of_range("GSO segments must be between 1 and " + std::to_string(MAX_GSO_SEGMENTS));
+                }
+                break;
+            case 'w':
+                drainTimeout = MS(std::stoi(optarg));
+                break;
+            case 'H':
+                histogramPath = optarg;
+                break;
+            case 'a':
+                resultsPath = optarg;
+                break;
+            case 'K':
+                kernelTimestamps = true;
+                break;
+            case 'l':
+                payloadLength = ParsePayloadSize(optarg);
+                patternPayload = true;
+                break;
+            case 'S':
+                sweepSizes = ParseSizeList(optarg);
+                break;
+            case 'F':
+                flowCount = ParseBounded(optarg, 1, MAX_LOAD_FLOWS,
+                                         "Flow count must be between 1 and " + std::to_string(MAX_LOAD_FLOWS));
+                break;
+            case 'T':
+                loadThreads = ParseBounded(optarg, 1, MAX_LOAD_THREADS,
+                                           "Thread count must be between 1 and " + std::to_string(MAX_LOAD_THREADS));
+                break;
+            case 'L':
+                searchLoss = std::stod(optarg);
+                if (searchLoss < 0 || searchLoss >= 100)
+                {
+                    throw std::out_of_range("Loss threshold must be at least 0 and below 100%");
+                }
+                break;
+            case 'i':
+                searchTrials = ParseBounded(optarg, 1, MAX_SEARCH_TRIALS,
+                                            "Trials per rate must be between 1 and "
+                                            + std::to_string(MAX_SEARCH_TRIALS));
+                break;
+            case 'C':
+                socketTuning.cpus = ParseCpuList(optarg);
+                break;
+            case 'W':
+                socketTuning.bufferBytes = std::stoi(optarg);
+                if (socketTuning.bufferBytes <= 0)
+                {
+                    throw std::out_of_range("Socket buffer size must be at least 1 byte");
+                }
+                break;
+            case 'Z':
+                socketTuning.busyPollMicros = ParseBounded(optarg, 0, SocketTuning::MAX_BUSY_POLL_MICROS,
+                                                           "Busy poll budget must be between 0 and "
+                                                           + std::to_string(SocketTuning::MAX_BUSY_POLL_MICROS)
+                                                           + " microseconds");
+                break;
+            case 'z':
+                zeroCopy = true;
+                break;
+            case 'X':
+                transportOptions.Parse(optarg);
+                break;
+            case 'Y':
+                replayPath = optarg;
+                break;
+            case 'x':
+                replaySpeed = std::stod(optarg);
+                if (replaySpeed < 0)
+                {
+                    throw std::out_of_range("Replay speed cannot be negative");
+                }
+                break;
+            case 'c':
+                metricsOptions.interval = MS(static_cast<long>(std::stod(optarg) * 1000));
+                if (metricsOptions.interval.count() <= 0)
+                {
+                    throw std::out_of_range("Report interval must be at least 1 millisecond");
+                }
+                break;
+            case 'o':
+                metricsOptions.ParseFormat(optarg);
+                if (metricsOptions.interval.count() == 0)
+                {
+                    metricsOptions.interval = MS(1000);
+                }
+                break;
+            default:
+                std::cerr << "Unknown argument encountered.\n";
+                throw UNKNOWN_ARGUMENT;
+            }
+        }
+
+        if (flowCount > 0 && !sweepSizes.empty())
+        {
+            throw std::invalid_argument("-F and -S cannot be combined");
+        }
+        if ((quiet || loopBenchmark) && (pipelined || flowCount > 0 || !sweepSizes.empty() || kernelTimestamps))
+        {
+            throw std::invalid_argument("-q and -M only apply to the lockstep loop, not to -P, -F, -S or -K");
+        }
+        if (quiet && (debug || loopBenchmark || !histogramPath.empty()))
+        {
+            throw std::invalid_argument("-q cannot be combined with -d, -M or -H");
+        }
+        if ((quiet || loopBenchmark) && !resultsPath.empty())
+        {
+            throw std::invalid_argument("-a records full runs and cannot be combined with -q or -M");
+        }
+        if (kernelTimestamps && (pipelined || flowCount > 0 || !sweepSizes.empty()))
+        {
+            throw std::invalid_argument("-K needs the lockstep loop and cannot be combined with -P, -F or -S");
+        }
+        if (searchLoss >= 0 && (flowCount > 0 || !sweepSizes.empty() || quiet || loopBenchmark || kernelTimestamps))
+        {
+            throw std::invalid_argument("-L cannot be combined with -F, -S, -q, -M or -K");
+        }
+        if (zeroCopy && (pipelined || flowCount > 0 || !sweepSizes.empty() || searchLoss >= 0 || loopBenchmark ||
+                         kernelTimestamps))
+        {
+            throw std::invalid_argument("-z needs a single lockstep run and cannot be combined with -P, -F, -S, -L, -M "
+                                        "or -K");
+        }
+        if (transportOptions.kind != TransportOptions::Kind::None &&
+            (pipelined || flowCount > 0 || !sweepSizes.empty() || searchLoss >= 0 || quiet || loopBenchmark ||
+             kernelTimestamps || zeroCopy))
+        {
+            throw std::invalid_argument("-X runs its own lockstep loop and cannot be combined with -P, -F, -S, -L, -q, "
+                                        "-M, -K or -z");
+        }
+        if (transportOptions.kind == TransportOptions::Kind::Shm &&
+            (socketTuning.bufferBytes > 0 || socketTuning.busyPollMicros > 0))
+        {
+            throw std::invalid_argument("-X shm has no socket to apply -W or -Z to");
+        }
+        if (!replayPath.empty() &&
+            (pipelined || flowCount > 0 || !sweepSizes.empty() || searchLoss >= 0 || quiet || loopBenchmark ||
+             kernelTimestamps || zeroCopy || transportOptions.kind != TransportOptions::Kind::None ||
+             packetRate > 0 || bitRate > 0))
+        {
+            throw std::invalid_argument("-Y sends the trace's own datagrams on its own timing and cannot be combined "
+                                        "with -P, -F, -S, -L, -q, -M, -K, -z, -X, -r or -R");
+        }
+        if (gsoSegments > 1 && (!pipelined || flowCount > 0))
+        {
+            throw std::invalid_argument("-G needs pipelined mode (-P) and cannot be combined with -F");
         }
     }
     catch (const std::exception& e)
@@ -428,22 +2562,159 @@ int main(int argc, char* argv[])
         return retval;
     }
 
-    std::cout << "Datagram length: " << sizeof(ClientDatagram) << " size of string: " << PAYLOAD.length() + 1
-              << " total length: " << sizeof(ClientDatagram) + PAYLOAD.length() + 1 << "\n"
-              << "Client attempting to connect to address " << serverName << " on port " << serverPort << "\n";
+    const std::vector<uint8_t> prototype = patternPayload ? BuildPatternTemplate(payloadLength)
+                                                          : BuildDatagramTemplate(PAYLOAD);
+    const uint32_t datagramSize = prototype.size();
+    double singleRunRate = bitRate > 0 ? bitRate / (datagramSize * 8.0) : packetRate;
+
+    if (patternPayload)
+    {
+        std::cout << "Datagram length: " << sizeof(ClientDatagram) << " payload size: " << payloadLength
+                  << " total length: " << datagramSize << "\n";
+    }
+    else if (sweepSizes.empty())
+    {
+        std::cout << "Datagram length: " << sizeof(ClientDatagram) << " size of string: " << PAYLOAD.length() + 1
+                  << " total length: " << datagramSize << "\n";
+    }
+    std::cout << "Client attempting to connect to address " << serverName << " on port " << serverPort << "\n";
 
 
     if (debug)
     {
         std::cout << "Additional configuration information: \n"
                   << "Number of datagrams: " << datagramsToSend << "\n"
-                  << "Delay between datagrams: " << sendDelay.count() << "us\n\n";
+                  << "Delay between datagrams: " << sendDelay.count() << "us\n"
+                  << "Target rate: " << singleRunRate << " pps, burst " << burst << "\n\n";
     }
 
+    // One set of live counters per thread: the lockstep loop uses one, pipelined mode two, the load generator one each
+    std::vector<ThreadMetrics> metrics(std::max(2u, flowCount > 0 ? std::min(loadThreads, flowCount) : 0u));
+
     try
     {
+        std::unique_ptr<MetricsReporter> reporter = StartMetrics(metricsOptions, metrics);
+        if (flowCount > 0)
+        {
+            RunLoadGenerator(serverName, serverPort, flowCount, loadThreads, prototype, datagramsToSend,
+                             singleRunRate, burst, sendDelay, drainTimeout, histogramPath, resultsPath, metrics.data(),
+                             debug);
+            return retval;
+        }
+        if (!replayPath.empty())
+        {
+            udpSocket = EstablishConnection(serverName, serverPort, debug);
+            if (socketTuning.Active())
+            {
+                PrintSocketBuffers(std::cout, udpSocket, socketTuning);
+            }
+            PinToCpu(pthread_self(), 0);
+            ReplayCapture(udpSocket, replayPath, replaySpeed, drainTimeout, metrics[0], debug);
+            if (reporter)
+            {
+                reporter->Stop();
+            }
+            std::cout << "Acks dropped by the kernel (recieve queue full): " << SocketDrops(udpSocket) << "\n";
+            close(udpSocket);
+            return retval;
+        }
+        if (transportOptions.kind != TransportOptions::Kind::None)
+        {
+            RunOverTransport(transportOptions, serverName, serverPort, prototype, datagramsToSend, singleRunRate, burst,
+                             sendDelay, histogramPath, resultsPath, metrics[0], debug);
+            return retval;
+        }
+
+        // The lockstep loop is specialized at compile time, this is the one place its build is picked
+        LockstepLoop lockstep = SendAndRecieve<StatsPolicy>;
+        if (debug)
+        {
+            lockstep = SendAndRecieve<DebugPolicy>;
+        }
+        else if (quiet)
+        {
+            lockstep = SendAndRecieve<QuietPolicy>;
+        }
+
         udpSocket = EstablishConnection(serverName, serverPort, debug);
-        SendAndRecieve(udpSocket, datagramsToSend, sendDelay, debug);
+        if (socketTuning.Active())
+        {
+            PrintSocketBuffers(std::cout, udpSocket, socketTuning);
+        }
+        PinToCpu(pthread_self(), 0);
+        if (searchLoss >= 0)
+        {
+            SearchMaxRate(udpSocket, prototype, datagramsToSend, pipelined, GsoSegments(gsoSegments, datagramSize),
+                          singleRunRate, burst, searchLoss, searchTrials, drainTimeout, lockstep, metrics.data(),
+                          resultsPath, debug);
+        }
+        else if (loopBenchmark)
+        {
+            RunLoopBenchmark(udpSocket, datagramsToSend, prototype, metrics[0]);
+        }
+        else if (!sweepSizes.empty())
+        {
+            RunSizeSweep(udpSocket, sweepSizes, datagramsToSend, pipelined, gsoSegments, packetRate, bitRate, burst,
+                         sendDelay, drainTimeout, lockstep, metrics.data(), resultsPath, debug);
+        }
+        else
+        {
+            SequenceTracker tracker(datagramsToSend);
+            LatencyHistogram rtt;
+            Pacer pacer(singleRunRate, burst, sendDelay, datagramSize);
+            const uint32_t segments = GsoSegments(gsoSegments, datagramSize);
+            std::unique_ptr<DatagramPool> pool(MakeSendPool(segments, prototype));
+            std::unique_ptr<LatencyBreakdown> breakdown(kernelTimestamps ? new LatencyBreakdown(datagramsToSend)
+                                                                         : nullptr);
+            std::unique_ptr<ZeroCopySender> zeroCopySender;
+            double copyingCpu = 0;
+            if (zeroCopy)
+            {
+                copyingCpu = MeasureCopyingCpu(udpSocket, prototype, datagramsToSend, singleRunRate, burst, sendDelay,
+                                               lockstep, metrics[0]);
+                zeroCopySender.reset(new ZeroCopySender(udpSocket, prototype, ZEROCOPY_SLOTS));
+            }
+            uint64_t cpuBefore = ThreadCpuNs();
+            uint64_t loopAllocations = RunDatagrams(udpSocket, pipelined, tracker, segments, *pool, pacer,
+                                                    drainTimeout, rtt, breakdown.get(), zeroCopySender.get(),
+                                                    lockstep, metrics.data(), debug);
+            uint64_t cpuNs = ThreadCpuNs() - cpuBefore;
+            if (reporter)
+            {
+                reporter->Stop();
+            }
+
+            PrintAckReport(tracker, rtt);
+            std::cout << "Acks dropped by the kernel (recieve queue full): " << SocketDrops(udpSocket) << "\n";
+            if (breakdown)
+            {
+                PrintLatencyBreakdown(*breakdown);
+            }
+            PrintAllocationReport(loopAllocations);
+            if (zeroCopySender)
+            {
+                zeroCopySender->PrintReport(std::cout);
+                double zeroCopyCpu = CpuMsPerGbit(cpuNs, tracker.Sent(), datagramSize);
+                std::cout << std::fixed << std::setprecision(1) << "CPU per Gbit sent: " << copyingCpu
+                          << " ms copying, " << zeroCopyCpu << " ms zero-copy ("
+                          << (copyingCpu > 0 ? 100.0 * (copyingCpu - zeroCopyCpu) / copyingCpu : 0.0)
+                          << "% saved)\n" << std::defaultfloat;
+            }
+            if (pacer.Active())
+            {
+                pacer.PrintReport(std::cout);
+            }
+
+            if (!histogramPath.empty())
+            {
+                rtt.WriteCSV(histogramPath);
+            }
+            if (!resultsPath.empty())
+            {
+                AppendResult(resultsPath, datagramSize - sizeof(ClientDatagram), tracker.Sent(),
+                             tracker.Acknowledged(), pacer.AchievedRate(), rtt);
+            }
+        }
     }
     catch(const std::exception& e)
     {
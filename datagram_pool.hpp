@@ -0,0 +1,68 @@
+#pragma once
+/* UDP Blaster -- Datagram buffer pool
+ * Preformatted, reusable ClientDatagram buffers for the send path.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <memory>
+#include <vector>
+
+// Local includes
+#include "structure.hpp"
+
+/* DatagramPool
+ * A fixed set of buffer slots, each holding a copy of a fully formatted datagram (header and payload). The pool is
+ * allocated once up front; sending only patches the sequence number in a slot, so the send path never allocates or
+ * copies the payload. Slots are padded out to a cache line unless asked otherwise: a pool packed with an alignment
+ * of 1 holds its datagrams back to back, ready to go out as one UDP_SEGMENT (GSO) send.
+ */
+class DatagramPool
+{
+public:
+    static const size_t SLOT_ALIGNMENT = 64;
+
+    /* Parameters:
+     *   uint32_t                    slots     -- Number of buffers in the pool
+     *   const std::vector<uint8_t>& prototype -- Formatted datagram every slot starts out as
+     *   size_t                      alignment -- Slot boundary, 1 to pack the datagrams back to back
+     */
+    DatagramPool(uint32_t slots, const std::vector<uint8_t>& prototype, size_t alignment = SLOT_ALIGNMENT)
+        : slotCount(slots > 0 ? slots : 1), datagramSize(prototype.size()),
+          stride((prototype.size() + alignment - 1) / alignment * alignment),
+          storage(new uint8_t[slotCount * stride + SLOT_ALIGNMENT])
+    {
+        // Align the first slot by hand, new[] only promises alignment for fundamental types
+        uintptr_t raw = reinterpret_cast<uintptr_t>(storage.get());
+        base = storage.get() + (SLOT_ALIGNMENT - raw % SLOT_ALIGNMENT) % SLOT_ALIGNMENT;
+
+        for (uint32_t i = 0; i < slotCount; i++)
+        {
+            memcpy(Slot(i), prototype.data(), datagramSize);
+        }
+    }
+
+    uint8_t* Slot(uint32_t index) { return base + static_cast<size_t>(index % slotCount) * stride; }
+
+    /* Stamp
+     * Writes a sequence number into a slot and returns the slot, ready to send.
+     */
+    uint8_t* Stamp(uint32_t index, uint32_t sequence)
+    {
+        uint8_t* slot = Slot(index);
+        reinterpret_cast<ClientDatagram*>(slot)->sequence_number = htonl(sequence);
+        return slot;
+    }
+
+    uint32_t Slots() const { return slotCount; }
+    size_t DatagramSize() const { return datagramSize; }
+    size_t Stride() const { return stride; }
+
+private:
+    uint32_t slotCount;
+    size_t datagramSize;
+    size_t stride;
+    std::unique_ptr<uint8_t[]> storage;
+    uint8_t* base;
+};
@@ -0,0 +1,321 @@
+/* UDP Blaster -- Flow table
+ * Per-client statistics for the server, kept in a fixed-size open-addressing hash table keyed by client address.
+ */
+
+// C/C++ Standard Libraries
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include <time.h>
+
+// System libraries
+#include <netdb.h>
+#include <netinet/in.h>
+
+// Local includes
+#include "flow_table.hpp"
+
+const uint64_t FlowTable::MAINTENANCE_INTERVAL_NS;
+
+namespace
+{
+    std::string DescribeKey(const FlowKey& key)
+    {
+        sockaddr_storage address;
+        memset(&address, 0, sizeof(address));
+        socklen_t length = sizeof(sockaddr_in);
+        if (key.family == AF_INET6)
+        {
+            sockaddr_in6* address6 = reinterpret_cast<sockaddr_in6*>(&address);
+            address6->sin6_family = AF_INET6;
+            address6->sin6_port = key.port;
+            memcpy(&address6->sin6_addr, key.addr, sizeof(address6->sin6_addr));
+            length = sizeof(sockaddr_in6);
+        }
+        else
+        {
+            sockaddr_in* address4 = reinterpret_cast<sockaddr_in*>(&address);
+            address4->sin_family = AF_INET;
+            address4->sin_port = key.port;
+            memcpy(&address4->sin_addr, key.addr, sizeof(address4->sin_addr));
+        }
+
+        char host[NI_MAXHOST];
+        char service[NI_MAXSERV];
+        if (getnameinfo(reinterpret_cast<sockaddr*>(&address), length, host, sizeof(host), service, sizeof(service),
+                        NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+        {
+            return "unknown";
+        }
+        if (key.family == AF_INET6)
+        {
+            return std::string("[") + host + "]:" + service;
+        }
+        return std::string(host) + ":" + service;
+    }
+}
+
+FlowKey MakeFlowKey(const sockaddr* client)
+{
+    FlowKey key;
+    memset(&key, 0, sizeof(key));
+    key.family = client->sa_family;
+    if (client->sa_family == AF_INET6)
+    {
+        const sockaddr_in6* address = reinterpret_cast<const sockaddr_in6*>(client);
+        memcpy(key.addr, &address->sin6_addr, sizeof(address->sin6_addr));
+        key.port = address->sin6_port;
+    }
+    else if (client->sa_family == AF_INET)
+    {
+        const sockaddr_in* address = reinterpret_cast<const sockaddr_in*>(client);
+        memcpy(key.addr, &address->sin_addr, sizeof(address->sin_addr));
+        key.port = address->sin_port;
+    }
+    return key;
+}
+
+uint64_t HashFlowKey(const FlowKey& key)
+{
+    // Fold the key into one word, then finish with the splitmix64 mixer so nearby ports spread out
+    uint64_t high;
+    uint64_t low;
+    memcpy(&high, key.addr, sizeof(high));
+    memcpy(&low, key.addr + sizeof(high), sizeof(low));
+    uint64_t h = high ^ (low * 0x9e3779b97f4a7c15ULL) ^ (static_cast<uint64_t>(key.port) << 16) ^ key.family;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+bool FlowKey::operator==(const FlowKey& other) const
+{
+    return port == other.port && family == other.family && memcmp(addr, other.addr, sizeof(addr)) == 0;
+}
+
+FlowTable::FlowTable(size_t capacity, uint64_t idleTimeoutNs, uint64_t reportInterval, size_t topCount,
+                     const std::string& label)
+    : idleTimeout(idleTimeoutNs), reportInterval(reportInterval), topCount(topCount), label(label)
+{
+    size_t slots = 16;
+    while (slots < capacity)
+    {
+        slots <<= 1;
+    }
+    entries.resize(slots);
+    mask = slots - 1;
+    maxActive = slots / 4 * 3;
+    ranking.reserve(maxActive);
+}
+
+uint64_t FlowTable::CoarseNowNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+size_t FlowTable::Hash(const FlowKey& key) const
+{
+    return static_cast<size_t>(HashFlowKey(key)) & mask;
+}
+
+FlowEntry* FlowTable::Find(const FlowKey& key, bool insert)
+{
+    // The table is never more than three quarters full, so the probe always reaches an empty slot
+    for (size_t slot = Hash(key);; slot = (slot + 1) & mask)
+    {
+        FlowEntry& entry = entries[slot];
+        if (!entry.used)
+        {
+            if (!insert)
+            {
+                return nullptr;
+            }
+            if (active >= maxActive)
+            {
+                untracked++;
+                return nullptr;
+            }
+            entry = FlowEntry();
+            entry.key = key;
+            entry.used = true;
+            active++;
+            return &entry;
+        }
+        if (entry.key == key)
+        {
+            return &entry;
+        }
+    }
+}
+
+FlowEntry* FlowTable::Record(const sockaddr* client, uint32_t sequence, size_t bytes, uint64_t now)
+{
+    if (now >= nextMaintenance)
+    {
+        if (nextMaintenance != 0)
+        {
+            Expire(now);
+        }
+        nextMaintenance = now + MAINTENANCE_INTERVAL_NS;
+    }
+    if (reportInterval > 0 && now >= nextReport)
+    {
+        if (nextReport != 0)
+        {
+            PrintTop(std::cout);
+        }
+        nextReport = now + reportInterval;
+    }
+
+    FlowEntry* entry = Find(MakeFlowKey(client), true);
+    if (entry == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (entry->received == 0)
+    {
+        entry->firstSeen = now;
+        entry->highestSequence = sequence;
+        entry->window = 1;
+    }
+    else
+    {
+        // Signed distance, so a run that wraps past 2^32 still moves forward
+        int32_t ahead = static_cast<int32_t>(sequence - entry->highestSequence);
+        if (ahead > 0)
+        {
+            entry->gaps += ahead - 1;
+            entry->window = ahead >= 64 ? 1 : (entry->window << ahead) | 1;
+            entry->highestSequence = sequence;
+        }
+        else if (-static_cast<int64_t>(ahead) < 64)
+        {
+            uint64_t bit = uint64_t(1) << -ahead;
+            if (entry->window & bit)
+            {
+                entry->duplicates++;
+            }
+            else
+            {
+                entry->window |= bit;
+                entry->reorders++;
+            }
+        }
+        else
+        {
+            entry->reorders++;
+        }
+    }
+
+    entry->received++;
+    entry->bytes += bytes;
+    entry->lastSeen = now;
+    return entry;
+}
+
+void FlowTable::Remove(size_t slot)
+{
+    // Backward shift: pull later entries of the probe run into the hole unless that would move them before home
+    entries[slot].used = false;
+    active--;
+    size_t hole = slot;
+    for (size_t next = (slot + 1) & mask; entries[next].used; next = (next + 1) & mask)
+    {
+        size_t home = Hash(entries[next].key);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            entries[hole] = entries[next];
+            entries[next].used = false;
+            hole = next;
+        }
+    }
+}
+
+void FlowTable::Expire(uint64_t now)
+{
+    if (idleTimeout == 0)
+    {
+        return;
+    }
+
+    for (size_t slot = 0; slot <= mask; slot++)
+    {
+        // A removal can shift another entry into this slot, so check it again before moving on
+        while (entries[slot].used && now - entries[slot].lastSeen > idleTimeout)
+        {
+            Remove(slot);
+            expired++;
+        }
+    }
+}
+
+void FlowTable::Merge(const FlowTable& other)
+{
+    for (const FlowEntry& theirs : other.entries)
+    {
+        if (!theirs.used)
+        {
+            continue;
+        }
+
+        FlowEntry* ours = Find(theirs.key, true);
+        if (ours == nullptr)
+        {
+            continue;
+        }
+        if (ours->received == 0)
+        {
+            *ours = theirs;
+            continue;
+        }
+        ours->received += theirs.received;
+        ours->bytes += theirs.bytes;
+        ours->gaps += theirs.gaps;
+        ours->reorders += theirs.reorders;
+        ours->duplicates += theirs.duplicates;
+        ours->highestSequence = std::max(ours->highestSequence, theirs.highestSequence);
+        ours->firstSeen = std::min(ours->firstSeen, theirs.firstSeen);
+        ours->lastSeen = std::max(ours->lastSeen, theirs.lastSeen);
+    }
+    expired += other.expired;
+    untracked += other.untracked;
+}
+
+void FlowTable::PrintTop(std::ostream& out, size_t count) const
+{
+    ranking.clear();
+    for (const FlowEntry& entry : entries)
+    {
+        if (entry.used)
+        {
+            ranking.push_back(&entry);
+        }
+    }
+    count = std::min(count, ranking.size());
+    std::partial_sort(ranking.begin(), ranking.begin() + count, ranking.end(),
+                      [](const FlowEntry* a, const FlowEntry* b) { return a->received > b->received; });
+
+    // Built up front and written at once, so reports from several workers do not interleave
+    std::ostringstream report;
+    report << "\n" << label << ": " << active << " active clients, " << expired << " expired, " << untracked
+           << " untracked\n"
+           << std::left << std::setw(48) << "client" << std::setw(12) << "recieved" << std::setw(14) << "bytes"
+           << std::setw(12) << "highest seq" << std::setw(10) << "gaps" << std::setw(10) << "reorders"
+           << std::setw(10) << "dups" << "\n";
+    for (size_t i = 0; i < count; i++)
+    {
+        const FlowEntry& entry = *ranking[i];
+        report << std::setw(48) << DescribeKey(entry.key) << std::setw(12) << entry.received << std::setw(14)
+               << entry.bytes << std::setw(12) << entry.highestSequence << std::setw(10) << entry.gaps
+               << std::setw(10) << entry.reorders << std::setw(10) << entry.duplicates << "\n";
+    }
+    out << report.str() << std::flush;
+}
@@ -0,0 +1,131 @@
+#pragma once
+/* UDP Blaster -- Flow table
+ * Per-client statistics for the server, kept in a fixed-size open-addressing hash table keyed by client address.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <sys/socket.h>
+
+/* FlowKey
+ * Client address and port in a form that can be hashed and compared directly. IPv4 addresses use the first four
+ * bytes of addr and leave the rest zero.
+ */
+struct FlowKey
+{
+    uint8_t addr[16];
+    uint16_t port;     // Network byte order
+    uint16_t family;
+
+    bool operator==(const FlowKey& other) const;
+};
+
+/* MakeFlowKey
+ * Builds the key for a client address. Anything but IPv4 and IPv6 gets an all zero address.
+ */
+FlowKey MakeFlowKey(const sockaddr* client);
+
+/* HashFlowKey
+ * Mixes a key into 64 well spread bits, for tables that mask off the low ones.
+ */
+uint64_t HashFlowKey(const FlowKey& key);
+
+/* FlowEntry
+ * What the server knows about one client. Sequence numbers are judged against the highest one seen so far with a
+ * 64-wide window below it: anything above opens a gap for every number skipped, anything inside the window is
+ * either a late arrival (a reorder) or a duplicate, and anything older than the window counts as a reorder.
+ */
+struct FlowEntry
+{
+    FlowKey key;
+    bool used = false;
+    uint64_t received = 0;
+    uint64_t bytes = 0;
+    uint32_t highestSequence = 0;
+    uint64_t window = 0;       // Bit n set when highestSequence - n has been seen
+    uint64_t gaps = 0;         // Sequence numbers skipped when a higher one arrived
+    uint64_t reorders = 0;     // Arrivals below the highest sequence number that had not been seen yet
+    uint64_t duplicates = 0;   // Sequence numbers seen more than once within the window
+    uint64_t firstSeen = 0;    // Coarse monotonic nanoseconds
+    uint64_t lastSeen = 0;
+};
+
+/* FlowTable
+ * Open-addressing hash table with linear probing over a fixed array of entries, sized once at construction, so
+ * memory is bounded and recording a datagram never allocates. Once the table is three quarters full new clients are
+ * counted as untracked rather than added. Entries idle for longer than the timeout are removed with backward shift
+ * deletion, which keeps probe sequences intact without tombstones.
+ * Not thread safe, give each recieve loop its own table and Merge them afterwards.
+ */
+class FlowTable
+{
+public:
+    /* Parameters:
+     *   size_t             capacity       -- Number of slots, rounded up to a power of two
+     *   uint64_t           idleTimeoutNs  -- Remove entries that have not been seen for this long, 0 to keep them
+     *   uint64_t           reportInterval -- Print the top entries this often in nanoseconds, 0 for never
+     *   size_t             topCount       -- Number of entries each report shows
+     *   const std::string& label          -- Heading for reports, to tell the tables of several workers apart
+     */
+    FlowTable(size_t capacity, uint64_t idleTimeoutNs, uint64_t reportInterval, size_t topCount,
+              const std::string& label);
+
+    /* Record
+     * Accounts for one datagram from a client, adding an entry for clients not seen before. Every so often this
+     * also expires idle entries and prints the periodic report.
+     * Returns:
+     *   The client's entry, or nullptr if the client is new and the table is full.
+     */
+    FlowEntry* Record(const sockaddr* client, uint32_t sequence, size_t bytes, uint64_t now);
+
+    /* Expire
+     * Removes every entry last seen more than the idle timeout before now.
+     */
+    void Expire(uint64_t now);
+
+    /* Merge
+     * Adds every entry of another table to this one, combining the counters of clients both tables know.
+     */
+    void Merge(const FlowTable& other);
+
+    /* PrintTop
+     * Writes a header line and the busiest count entries by datagrams recieved.
+     */
+    void PrintTop(std::ostream& out, size_t count) const;
+    void PrintTop(std::ostream& out) const { PrintTop(out, topCount); }
+
+    size_t Active() const { return active; }
+    size_t Capacity() const { return entries.size(); }
+    uint64_t Expired() const { return expired; }
+    uint64_t Untracked() const { return untracked; }
+
+    /* CoarseNowNs
+     * Cheap monotonic clock in nanoseconds with a resolution of a few milliseconds, plenty for idle expiry.
+     */
+    static uint64_t CoarseNowNs();
+
+private:
+    // How often Record checks for idle entries
+    static const uint64_t MAINTENANCE_INTERVAL_NS = 1000000000;
+
+    size_t Hash(const FlowKey& key) const;
+    FlowEntry* Find(const FlowKey& key, bool insert);
+    void Remove(size_t slot);
+
+    std::vector<FlowEntry> entries;
+    size_t mask;
+    size_t maxActive;
+    size_t active = 0;
+    uint64_t expired = 0;
+    uint64_t untracked = 0;
+    uint64_t idleTimeout;
+    uint64_t reportInterval;
+    size_t topCount;
+    std::string label;
+    uint64_t nextMaintenance = 0;
+    uint64_t nextReport = 0;
+    mutable std::vector<const FlowEntry*> ranking;  // Preallocated scratch for PrintTop
+};
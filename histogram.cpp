@@ -0,0 +1,172 @@
+/* UDP Blaster -- Latency histogram
+ * Fixed-memory log-linear (HDR-style) histogram for round trip times.
+ */
+
+// C/C++ Standard Libraries
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <string.h>
+
+// Local includes
+#include "histogram.hpp"
+
+const unsigned int LatencyHistogram::SUB_BUCKET_BITS;
+const unsigned int LatencyHistogram::MAX_VALUE_BITS;
+const unsigned int LatencyHistogram::BUCKET_COUNT;
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    sum = 0;
+    min = std::numeric_limits<uint64_t>::max();
+    max = 0;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+    {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    if (other.total > 0 && other.min < min)
+    {
+        min = other.min;
+    }
+    if (other.max > max)
+    {
+        max = other.max;
+    }
+}
+
+/* BucketIndex
+ * Values below 2^SUB_BUCKET_BITS map straight to their own bucket. Above that, the value is shifted right until it
+ * fits in [64, 128), and each shift moves it up one row of 64 buckets.
+ */
+unsigned int LatencyHistogram::BucketIndex(uint64_t value)
+{
+    if (value >> MAX_VALUE_BITS)
+    {
+        return BUCKET_COUNT - 1;
+    }
+    if (value < (uint64_t(1) << SUB_BUCKET_BITS))
+    {
+        return static_cast<unsigned int>(value);
+    }
+
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int shift = msb - SUB_BUCKET_BITS + 1;
+    return (shift << (SUB_BUCKET_BITS - 1)) + static_cast<unsigned int>(value >> shift);
+}
+
+uint64_t LatencyHistogram::BucketLow(unsigned int index)
+{
+    if (index < (1u << SUB_BUCKET_BITS))
+    {
+        return index;
+    }
+
+    unsigned int shift = (index >> (SUB_BUCKET_BITS - 1)) - 1;
+    uint64_t mantissa = index - (shift << (SUB_BUCKET_BITS - 1));
+    return mantissa << shift;
+}
+
+uint64_t LatencyHistogram::BucketHigh(unsigned int index)
+{
+    if (index < (1u << SUB_BUCKET_BITS))
+    {
+        return index;
+    }
+
+    unsigned int shift = (index >> (SUB_BUCKET_BITS - 1)) - 1;
+    uint64_t mantissa = index - (shift << (SUB_BUCKET_BITS - 1));
+    return ((mantissa + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const
+{
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    // Rank of the wanted value, counting from one
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    if (rank > total)
+    {
+        rank = total;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+            uint64_t high = BucketHigh(i);
+            return high < max ? high : max;
+        }
+    }
+    return max;
+}
+
+void LatencyHistogram::PrintSummary(std::ostream& out, const std::string& label) const
+{
+    if (total == 0)
+    {
+        out << label << ": no samples\n";
+        return;
+    }
+
+    std::ios::fmtflags oldFlags = out.flags();
+    std::streamsize oldPrecision = out.precision();
+    out << std::fixed << std::setprecision(1)
+        << label << " (us): p50 " << Percentile(50.0) / 1000.0
+        << ", p90 " << Percentile(90.0) / 1000.0
+        << ", p99 " << Percentile(99.0) / 1000.0
+        << ", p99.9 " << Percentile(99.9) / 1000.0
+        << ", max " << max / 1000.0
+        << " (" << total << " samples)\n";
+    out.flags(oldFlags);
+    out.precision(oldPrecision);
+}
+
+void LatencyHistogram::WriteCSV(const std::string& path) const
+{
+    std::ofstream csv(path);
+    if (!csv)
+    {
+        throw std::runtime_error("Unable to open " + path + " for writing");
+    }
+
+    csv << "low_ns,high_ns,count,cumulative_fraction\n";
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+    {
+        if (counts[i] == 0)
+        {
+            continue;
+        }
+        seen += counts[i];
+        csv << BucketLow(i) << ',' << BucketHigh(i) << ',' << counts[i] << ','
+            << static_cast<double>(seen) / total << '\n';
+    }
+
+    if (!csv)
+    {
+        throw std::runtime_error("Error writing " + path);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+/* UDP Blaster -- Latency histogram
+ * Fixed-memory log-linear (HDR-style) histogram for round trip times.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <ostream>
+
+/* LatencyHistogram
+ * Records nanosecond values into log-linear buckets: values below 128 get exact buckets, and every power of two
+ * above that is split into 64 linear sub-buckets, so any recorded value is off by less than 1.6%. All storage is a
+ * fixed array inside the object, so recording never allocates. Values past ~18 minutes land in the last bucket.
+ * Not thread safe, give each recording thread its own histogram and Merge them afterwards.
+ */
+class LatencyHistogram
+{
+public:
+    static const unsigned int SUB_BUCKET_BITS = 7;
+    static const unsigned int MAX_VALUE_BITS = 40;
+    static const unsigned int BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) << (SUB_BUCKET_BITS - 1);
+
+    LatencyHistogram();
+
+    void Record(uint64_t value)
+    {
+        counts[BucketIndex(value)]++;
+        total++;
+        sum += value;
+        if (value < min)
+        {
+            min = value;
+        }
+        if (value > max)
+        {
+            max = value;
+        }
+    }
+
+    void Merge(const LatencyHistogram& other);
+    void Reset();
+
+    uint64_t Count() const { return total; }
+    uint64_t Min() const { return total > 0 ? min : 0; }
+    uint64_t Max() const { return max; }
+    double Mean() const { return total > 0 ? static_cast<double>(sum) / total : 0.0; }
+
+    /* Percentile
+     * Returns the highest value equivalent to the bucket holding the given percentile (0-100), clamped to the
+     * largest value recorded.
+     */
+    uint64_t Percentile(double percentile) const;
+
+    /* PrintSummary
+     * Writes one line with p50/p90/p99/p99.9/max in microseconds, prefixed with the label.
+     */
+    void PrintSummary(std::ostream& out, const std::string& label) const;
+
+    /* WriteCSV
+     * Dumps every non-empty bucket as low_ns,high_ns,count,cumulative_fraction for plotting. Throws a
+     * std::runtime_error if the file cannot be written.
+     */
+    void WriteCSV(const std::string& path) const;
+
+private:
+    static unsigned int BucketIndex(uint64_t value);
+    static uint64_t BucketLow(unsigned int index);
+    static uint64_t BucketHigh(unsigned int index);
+
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
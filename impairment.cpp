@@ -0,0 +1,121 @@
+/* UDP Blaster -- Link impairment
+ * Seeded model of a lossy, slow, jittery link, deciding the fate of each datagram the relay forwards.
+ */
+
+// Local includes
+#include "impairment.hpp"
+
+namespace
+{
+    uint64_t SplitMix64(uint64_t& x)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    inline uint64_t RotateLeft(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+}
+
+Random::Random(uint64_t seed)
+{
+    for (uint64_t& word : state)
+    {
+        word = SplitMix64(seed);
+    }
+}
+
+uint64_t Random::Next()
+{
+    uint64_t result = RotateLeft(state[1] * 5, 7) * 9;
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = RotateLeft(state[3], 45);
+    return result;
+}
+
+bool ImpairmentOptions::Active() const
+{
+    return delayNs > 0 || jitterNs > 0 || lossRate > 0.0 || burstStartRate > 0.0 || duplicateRate > 0.0 ||
+           reorderRate > 0.0 || bitsPerSecond > 0.0;
+}
+
+Impairment::Impairment(const ImpairmentOptions& options) : options(options)
+{
+}
+
+bool Impairment::Drop(ImpairmentStream& stream)
+{
+    // Two state Gilbert-Elliott model: the bad state loses everything and is left after burstLength datagrams on
+    // average, the good state only loses at the independent rate
+    if (stream.inBurst)
+    {
+        if (stream.random.Chance(1.0 / options.burstLength))
+        {
+            stream.inBurst = false;
+        }
+        else
+        {
+            stats.burstLost++;
+            return true;
+        }
+    }
+    if (stream.random.Chance(options.burstStartRate))
+    {
+        stream.inBurst = true;
+        stats.burstLost++;
+        return true;
+    }
+    if (stream.random.Chance(options.lossRate))
+    {
+        stats.lost++;
+        return true;
+    }
+    return false;
+}
+
+uint64_t Impairment::Departure(ImpairmentStream& stream, uint64_t now, size_t bytes)
+{
+    uint64_t departure = now;
+    if (options.bitsPerSecond > 0.0)
+    {
+        uint64_t start = linkFree > now ? linkFree : now;
+        if (start - now > options.queueNs)
+        {
+            stats.queueDrops++;
+            return 0;
+        }
+        linkFree = start + static_cast<uint64_t>(bytes * 8 * 1e9 / options.bitsPerSecond);
+        departure = linkFree;
+    }
+
+    departure += options.delayNs;
+    if (options.jitterNs > 0)
+    {
+        departure += stream.random.Next() % (options.jitterNs + 1);
+    }
+    if (stream.random.Chance(options.reorderRate))
+    {
+        stats.reordered++;
+        departure += options.reorderDelayNs;
+    }
+    return departure;
+}
+
+bool Impairment::Duplicate(ImpairmentStream& stream)
+{
+    if (stream.random.Chance(options.duplicateRate))
+    {
+        stats.duplicated++;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,119 @@
+#pragma once
+/* UDP Blaster -- Link impairment
+ * Seeded model of a lossy, slow, jittery link, deciding the fate of each datagram the relay forwards.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Random
+ * xoshiro256** generator seeded through splitmix64, small and fast enough to draw several numbers per datagram. The
+ * same seed always gives the same sequence.
+ */
+class Random
+{
+public:
+    explicit Random(uint64_t seed);
+
+    uint64_t Next();
+
+    /* Chance
+     * Returns true with the given probability, 0 to 1.
+     */
+    bool Chance(double probability) { return probability > 0.0 && Uniform() < probability; }
+
+    // Uniform in [0, 1)
+    double Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+    uint64_t state[4];
+};
+
+/* ImpairmentOptions
+ * How bad the link is in one direction. Rates are fractions from 0 to 1, times are in nanoseconds.
+ */
+struct ImpairmentOptions
+{
+    uint64_t delayNs = 0;           // Fixed one way delay
+    uint64_t jitterNs = 0;          // Extra delay drawn uniformly from [0, jitterNs]
+    double lossRate = 0.0;          // Independent loss
+    double burstStartRate = 0.0;    // Chance a datagram starts a loss burst (Gilbert-Elliott bad state)
+    double burstLength = 8.0;       // Mean datagrams lost per burst
+    double duplicateRate = 0.0;
+    double reorderRate = 0.0;       // Chance a datagram is held back so later ones overtake it
+    uint64_t reorderDelayNs = 1000000;
+    double bitsPerSecond = 0.0;     // Bottleneck rate, 0 for unlimited
+    uint64_t queueNs = 50000000;    // Longest backlog the bottleneck holds before tail dropping
+
+    bool Active() const;
+};
+
+/* ImpairmentStats
+ * What happened to the datagrams of one direction.
+ */
+struct ImpairmentStats
+{
+    uint64_t received = 0;
+    uint64_t forwarded = 0;
+    uint64_t lost = 0;          // Independent losses
+    uint64_t burstLost = 0;     // Lost in the bad state
+    uint64_t queueDrops = 0;    // Tail dropped at the bottleneck
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0;
+    uint64_t poolDrops = 0;     // No buffer left in the relay's timer wheel
+    uint64_t truncated = 0;     // Larger than the relay's buffers
+    uint64_t sendErrors = 0;
+    uint64_t sessionDrops = 0;  // From a new client the relay could not open an upstream socket for
+};
+
+/* ImpairmentStream
+ * Random state of one client's datagrams in one direction. Each client gets its own streams, seeded from the relay's
+ * seed and the order clients arrived in, so the first client of a freshly started relay meets the same fates on
+ * every run, and flows of one load test are not lost in lockstep with each other.
+ */
+struct ImpairmentStream
+{
+    explicit ImpairmentStream(uint64_t seed) : random(seed) {}
+
+    Random random;
+    bool inBurst = false;       // Gilbert-Elliott bad state
+};
+
+/* Impairment
+ * Applies one direction's options to each datagram in arrival order, drawing from the datagram's stream. The
+ * bottleneck is shared, so clients queue behind each other as they would on a real link.
+ */
+class Impairment
+{
+public:
+    explicit Impairment(const ImpairmentOptions& options);
+
+    /* Drop
+     * Decides whether a datagram is lost to the random or bursty loss, counting it if so.
+     */
+    bool Drop(ImpairmentStream& stream);
+
+    /* Departure
+     * Works out when a datagram arriving now leaves the link, after queueing at the bottleneck, delay, jitter and
+     * any reordering hold back.
+     * Parameters:
+     *   ImpairmentStream& stream -- Stream of the datagram's client
+     *   uint64_t          now    -- Arrival time in monotonic nanoseconds
+     *   size_t            bytes  -- Datagram size, for the bottleneck
+     * Returns:
+     *   The departure time, or 0 if the bottleneck queue is full and the datagram is tail dropped.
+     */
+    uint64_t Departure(ImpairmentStream& stream, uint64_t now, size_t bytes);
+
+    /* Duplicate
+     * Decides whether a datagram that made it through is sent twice, counting it if so.
+     */
+    bool Duplicate(ImpairmentStream& stream);
+
+    const ImpairmentOptions& Options() const { return options; }
+    ImpairmentStats stats;
+
+private:
+    ImpairmentOptions options;
+    uint64_t linkFree = 0;      // When the bottleneck finishes sending everything queued so far
+};
@@ -0,0 +1,35 @@
+#pragma once
+/* UDP Blaster -- Loop policies
+ * Compile-time switches the per-datagram send/recieve loops are specialized on. main picks a policy once and the
+ * branches it turns off are constant false, so the compiler drops them from the loop entirely.
+ */
+
+/* DebugPolicy
+ * Logs every datagram and keeps every statistic.
+ */
+struct DebugPolicy
+{
+    static const bool LOG = true;
+    static const bool STATS = true;
+    static const char* Name() { return "debug"; }
+};
+
+/* StatsPolicy
+ * No logging, every statistic. The default.
+ */
+struct StatsPolicy
+{
+    static const bool LOG = false;
+    static const bool STATS = true;
+    static const char* Name() { return "stats"; }
+};
+
+/* QuietPolicy
+ * No logging, and only the bookkeeping needed to answer (server) or to count losses (client).
+ */
+struct QuietPolicy
+{
+    static const bool LOG = false;
+    static const bool STATS = false;
+    static const char* Name() { return "quiet"; }
+};
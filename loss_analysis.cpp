@@ -0,0 +1,143 @@
+/* UDP Blaster -- Loss analysis
+ * Loss burst, loss position, reorder and duplicate breakdown of a run, worked out from its sequence tracker.
+ */
+
+// C/C++ Standard Libraries
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+
+// Local includes
+#include "loss_analysis.hpp"
+
+namespace
+{
+    /* PrintBuckets
+     * Writes the non-empty power of two buckets as "low-high: count" pairs on one line.
+     */
+    void PrintBuckets(std::ostream& out, const std::string& label, const uint64_t* counts, unsigned int buckets)
+    {
+        out << "  " << label << ":";
+        const char* separator = " ";
+        for (unsigned int i = 0; i < buckets; i++)
+        {
+            if (counts[i] == 0)
+            {
+                continue;
+            }
+            uint64_t low = uint64_t(1) << i;
+            out << separator << low;
+            if (low > 1)
+            {
+                out << "-" << (low << 1) - 1;
+            }
+            out << ": " << counts[i];
+            separator = ", ";
+        }
+        out << "\n";
+    }
+}
+
+LossAnalysis::LossAnalysis()
+{
+    memset(burstCounts, 0, sizeof(burstCounts));
+    memset(positionSent, 0, sizeof(positionSent));
+    memset(positionLost, 0, sizeof(positionLost));
+    memset(reorderCounts, 0, sizeof(reorderCounts));
+}
+
+void LossAnalysis::EndBurst()
+{
+    if (currentBurst == 0)
+    {
+        return;
+    }
+    bursts++;
+    burstCounts[63 - __builtin_clzll(currentBurst)]++;
+    longestBurst = std::max(longestBurst, currentBurst);
+    currentBurst = 0;
+}
+
+void LossAnalysis::Add(const SequenceTracker& tracker)
+{
+    const uint64_t runSent = tracker.Sent();
+    for (uint64_t bin = 0; bin < POSITION_BINS; bin++)
+    {
+        // Offset o falls in bin o * POSITION_BINS / runSent, so each bin starts at the ceiling of bin * runSent / 10
+        uint64_t start = (bin * runSent + POSITION_BINS - 1) / POSITION_BINS;
+        uint64_t end = ((bin + 1) * runSent + POSITION_BINS - 1) / POSITION_BINS;
+        positionSent[bin] += end - start;
+    }
+
+    for (size_t word = 0; word < tracker.WordCount() && word * 64 < runSent; word++)
+    {
+        uint64_t first = word * 64;
+        uint64_t bits = std::min<uint64_t>(64, runSent - first);
+        uint64_t missing = ~tracker.AckedWord(word);
+        if (bits < 64)
+        {
+            missing &= (uint64_t(1) << bits) - 1;
+        }
+
+        // Nearly every word of a healthy run is fully acked, and those only need to close any open burst
+        if (missing == 0)
+        {
+            EndBurst();
+            continue;
+        }
+        for (uint64_t bit = 0; bit < bits; bit++)
+        {
+            if (!((missing >> bit) & 1))
+            {
+                EndBurst();
+                continue;
+            }
+            uint64_t offset = first + bit;
+            currentBurst++;
+            lost++;
+            firstLoss = std::min(firstLoss, offset);
+            positionLost[offset * POSITION_BINS / runSent]++;
+        }
+    }
+    // Bursts do not carry over from one tracker to the next
+    EndBurst();
+
+    sent += runSent;
+    duplicates += tracker.Duplicates();
+    unknown += tracker.Unknown();
+    for (unsigned int i = 0; i < SequenceTracker::REORDER_BUCKETS; i++)
+    {
+        reorderCounts[i] += tracker.Reorders(i);
+        reordered += tracker.Reorders(i);
+    }
+}
+
+void LossAnalysis::Print(std::ostream& out) const
+{
+    std::ostringstream report;
+    if (lost > 0)
+    {
+        // Independent losses with probability p start a new burst at a rate of p * (1 - p) per datagram
+        double rate = static_cast<double>(lost) / sent;
+        report << "Loss pattern: " << lost << " lost in " << bursts << " bursts (about "
+               << static_cast<uint64_t>(sent * rate * (1.0 - rate) + 0.5) << " if losses were independent), longest "
+               << longestBurst << ", first lost datagram " << firstLoss << "\n";
+        PrintBuckets(report, "burst lengths", burstCounts, BURST_BUCKETS);
+        report << "  loss % by tenth of the run:" << std::fixed << std::setprecision(2);
+        for (unsigned int bin = 0; bin < POSITION_BINS; bin++)
+        {
+            report << " " << (positionSent[bin] > 0 ? 100.0 * positionLost[bin] / positionSent[bin] : 0.0);
+        }
+        report << std::defaultfloat << "\n";
+    }
+
+    report << "Reordered acks: " << reordered << ", duplicate acks: " << duplicates << ", unknown acks: " << unknown
+           << "\n";
+    if (reordered > 0)
+    {
+        PrintBuckets(report, "reorder distances", reorderCounts, SequenceTracker::REORDER_BUCKETS);
+    }
+    out << report.str();
+}
@@ -0,0 +1,54 @@
+#pragma once
+/* UDP Blaster -- Loss analysis
+ * Loss burst, loss position, reorder and duplicate breakdown of a run, worked out from its sequence tracker.
+ */
+
+#include <stdint.h>
+#include <ostream>
+
+// Local includes
+#include "sequence_tracker.hpp"
+
+/* LossAnalysis
+ * Summarizes how datagrams went missing rather than just how many. Add walks a tracker's acked bitmap once, a whole
+ * word at a time where nothing was lost, so it is linear in the number of datagrams and only uses the fixed arrays
+ * below no matter how long the run was. Several trackers (the flows of the load generator) can be added to one
+ * analysis; loss positions are then relative to the start of each flow's run.
+ */
+class LossAnalysis
+{
+public:
+    // Burst lengths are kept in power of two buckets like the reorder distances, and loss positions in tenths of a run
+    static const unsigned int BURST_BUCKETS = 33;
+    static const unsigned int POSITION_BINS = 10;
+
+    LossAnalysis();
+
+    /* Add
+     * Accounts for every datagram a tracker has sent. Call once the run is over and no more acks are coming.
+     */
+    void Add(const SequenceTracker& tracker);
+
+    /* Print
+     * Writes the burst length distribution, where in the run the losses fell, the reorder distance distribution and
+     * the duplicate count, leaving out whichever parts have nothing to show.
+     */
+    void Print(std::ostream& out) const;
+
+private:
+    void EndBurst();
+
+    uint64_t sent = 0;
+    uint64_t lost = 0;
+    uint64_t bursts = 0;
+    uint64_t longestBurst = 0;
+    uint64_t currentBurst = 0;
+    uint64_t firstLoss = UINT64_MAX;  // Offset into its run of the earliest loss of any tracker
+    uint64_t duplicates = 0;
+    uint64_t unknown = 0;
+    uint64_t reordered = 0;
+    uint64_t burstCounts[BURST_BUCKETS];
+    uint64_t positionSent[POSITION_BINS];
+    uint64_t positionLost[POSITION_BINS];
+    uint64_t reorderCounts[SequenceTracker::REORDER_BUCKETS];
+};
@@ -0,0 +1,241 @@
+/* UDP Blaster -- Live metrics
+ * Counters that the datagram loops bump without locks and a reporter thread can read while they run, plus the
+ * reporter that samples them every interval and prints or writes the rates.
+ */
+
+// C/C++ Standard Libraries
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+// System libraries
+#include <pthread.h>
+#include <signal.h>
+
+// Local includes
+#include "metrics.hpp"
+
+namespace
+{
+    const char* ErrnoName(int error)
+    {
+        const char* name = error == 0 ? nullptr : strerrorname_np(error);
+        return name == nullptr ? "other" : name;
+    }
+
+    double Rate(uint64_t now, uint64_t previous, double seconds)
+    {
+        return seconds > 0 ? (now - previous) / seconds : 0;
+    }
+
+    void WriteCounter(std::ostream& out, const std::string& role, const char* name, const char* help, uint64_t value)
+    {
+        out << "# HELP udpblaster_" << name << "_total " << help << "\n"
+            << "# TYPE udpblaster_" << name << "_total counter\n"
+            << "udpblaster_" << name << "_total{role=\"" << role << "\"} " << value << "\n";
+    }
+}
+
+void MetricsSnapshot::Add(const ErrnoCounts& counts)
+{
+    for (int i = 0; i < ErrnoCounts::SLOTS; i++)
+    {
+        errnos[i] += counts.counts[i];
+    }
+}
+
+void ThreadMetrics::AddTo(MetricsSnapshot& snapshot) const
+{
+    snapshot.sent += sent;
+    snapshot.received += received;
+    snapshot.bytes += bytes;
+    snapshot.errors += errors;
+    snapshot.eagain += eagain;
+    snapshot.unknown += unknown;
+    snapshot.duplicates += duplicates;
+    snapshot.Add(errnos);
+}
+
+void MetricsOptions::ParseFormat(const std::string& text)
+{
+    size_t colon = text.find(':');
+    std::string name = text.substr(0, colon);
+    path = colon == std::string::npos ? "" : text.substr(colon + 1);
+    if (name == "text" && path.empty())
+    {
+        format = MetricsFormat::Text;
+    }
+    else if (name == "json")
+    {
+        format = MetricsFormat::Json;
+    }
+    else if (name == "prom" && !path.empty())
+    {
+        format = MetricsFormat::Prometheus;
+    }
+    else
+    {
+        throw std::invalid_argument("Report format must be text, json[:path] or prom:path");
+    }
+}
+
+MetricsReporter::MetricsReporter(Sampler sampler, const MetricsOptions& options, const std::string& role)
+    : sampler(sampler), options(options), role(role)
+{
+    if (options.format == MetricsFormat::Json)
+    {
+        jsonOut = options.path.empty() ? stdout : fopen(options.path.c_str(), "a");
+        if (jsonOut == nullptr)
+        {
+            std::runtime_error ex("Could not open " + options.path + ": " + strerror(errno));
+            throw ex;
+        }
+    }
+    reporter = std::thread(&MetricsReporter::Run, this);
+}
+
+MetricsReporter::~MetricsReporter()
+{
+    Stop();
+    if (jsonOut != nullptr && jsonOut != stdout)
+    {
+        fclose(jsonOut);
+    }
+}
+
+void MetricsReporter::Stop()
+{
+    if (!reporter.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(wakeLock);
+        stopping = true;
+    }
+    wake.notify_one();
+    reporter.join();
+}
+
+void MetricsReporter::Run()
+{
+    // Stop signals have to reach the datagram loops, a blocked recieve only notices them by returning EINTR
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+    Clock::time_point next = start + options.interval;
+    MetricsSnapshot previous;
+
+    bool done = false;
+    while (!done)
+    {
+        {
+            std::unique_lock<std::mutex> guard(wakeLock);
+            wake.wait_until(guard, next, [this] { return stopping; });
+            done = stopping;
+        }
+        next += options.interval;
+
+        MetricsSnapshot now;
+        sampler(now);
+        Clock::time_point sampled = Clock::now();
+        Report(now, previous, std::chrono::duration<double>(sampled - last).count(),
+               std::chrono::duration<double>(sampled - start).count());
+        previous = now;
+        last = sampled;
+    }
+}
+
+void MetricsReporter::Report(const MetricsSnapshot& now, const MetricsSnapshot& previous, double seconds,
+                             double elapsed)
+{
+    std::ostringstream out;
+    switch (options.format)
+    {
+    case MetricsFormat::Text:
+        out << std::fixed << std::setprecision(1) << "[" << role << " " << elapsed << "s] sent "
+            << Rate(now.sent, previous.sent, seconds) << "/s, recieved "
+            << Rate(now.received, previous.received, seconds) << "/s, "
+            << Rate(now.bytes, previous.bytes, seconds) * 8 / 1e6 << " Mbit/s, errors "
+            << now.errors - previous.errors << ", EAGAIN " << now.eagain - previous.eagain;
+        if (now.unknown != 0 || now.duplicates != 0)
+        {
+            out << ", unknown " << now.unknown - previous.unknown << ", duplicates "
+                << now.duplicates - previous.duplicates;
+        }
+        out << "\n";
+        std::cout << out.str() << std::flush;
+        break;
+
+    case MetricsFormat::Json:
+        out << std::fixed << std::setprecision(3) << "{\"role\":\"" << role << "\",\"elapsed\":" << elapsed
+            << ",\"sent\":" << now.sent << ",\"received\":" << now.received << ",\"bytes\":" << now.bytes
+            << ",\"errors\":" << now.errors << ",\"eagain\":" << now.eagain << ",\"unknown\":" << now.unknown
+            << ",\"duplicates\":" << now.duplicates << ",\"sent_rate\":" << Rate(now.sent, previous.sent, seconds)
+            << ",\"received_rate\":" << Rate(now.received, previous.received, seconds)
+            << ",\"bits_rate\":" << Rate(now.bytes, previous.bytes, seconds) * 8 << ",\"errnos\":{";
+        for (int i = 0, listed = 0; i < ErrnoCounts::SLOTS; i++)
+        {
+            if (now.errnos[i] != 0)
+            {
+                out << (listed++ ? "," : "") << "\"" << ErrnoName(i) << "\":" << now.errnos[i];
+            }
+        }
+        out << "}}\n";
+        fputs(out.str().c_str(), jsonOut);
+        fflush(jsonOut);
+        break;
+
+    case MetricsFormat::Prometheus:
+    {
+        WriteCounter(out, role, "sent", "Datagrams sent.", now.sent);
+        WriteCounter(out, role, "received", "Datagrams recieved.", now.received);
+        WriteCounter(out, role, "bytes", "Datagram bytes sent by the client or recieved by the server.", now.bytes);
+        WriteCounter(out, role, "eagain", "Socket calls that would have blocked.", now.eagain);
+        WriteCounter(out, role, "unknown_sequence", "Replies to sequence numbers never sent.", now.unknown);
+        WriteCounter(out, role, "duplicate_sequence", "Replies to sequence numbers already acknowledged.",
+                     now.duplicates);
+        out << "# HELP udpblaster_errors_total Failed socket calls by errno, malformed datagrams as none.\n"
+            << "# TYPE udpblaster_errors_total counter\n";
+        uint64_t unlisted = now.errors;
+        for (int i = 0; i < ErrnoCounts::SLOTS; i++)
+        {
+            if (now.errnos[i] != 0)
+            {
+                out << "udpblaster_errors_total{role=\"" << role << "\",errno=\"" << ErrnoName(i) << "\"} "
+                    << now.errnos[i] << "\n";
+                unlisted -= std::min(unlisted, now.errnos[i]);
+            }
+        }
+        if (unlisted != 0 || now.errors == 0)
+        {
+            out << "udpblaster_errors_total{role=\"" << role << "\",errno=\"none\"} " << unlisted << "\n";
+        }
+
+        // Written beside the target and renamed over it, so a scraper never reads half a file
+        std::string temporary = options.path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "w");
+        if (file == nullptr)
+        {
+            std::cerr << "Could not write " << temporary << ": " << strerror(errno) << std::endl;
+            break;
+        }
+        fputs(out.str().c_str(), file);
+        fclose(file);
+        if (rename(temporary.c_str(), options.path.c_str()) == -1)
+        {
+            std::cerr << "Could not replace " << options.path << ": " << strerror(errno) << std::endl;
+        }
+        break;
+    }
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+/* UDP Blaster -- Live metrics
+ * Counters that the datagram loops bump without locks and a reporter thread can read while they run, plus the
+ * reporter that samples them every interval and prints or writes the rates.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Counter
+ * A 64-bit counter with a single writer. Bumps are a relaxed load and store rather than a locked read-modify-write,
+ * so they cost the same as a plain increment, and any other thread may read the value at any time. Two threads must
+ * never bump the same counter.
+ */
+class Counter
+{
+public:
+    Counter() : value(0) {}
+    Counter(const Counter& other) : value(other.Load()) {}
+    Counter& operator=(const Counter& other)
+    {
+        value.store(other.Load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void operator++(int) { Add(1); }
+    Counter& operator+=(uint64_t amount)
+    {
+        Add(amount);
+        return *this;
+    }
+
+    uint64_t Load() const { return value.load(std::memory_order_relaxed); }
+    operator uint64_t() const { return Load(); }
+
+private:
+    void Add(uint64_t amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> value;
+};
+
+/* ErrnoCounts
+ * Failed syscalls by errno. Slot 0 collects anything out of range.
+ */
+struct ErrnoCounts
+{
+    static const int SLOTS = 134;
+
+    void Record(int error, uint64_t times = 1) { counts[error > 0 && error < SLOTS ? error : 0] += times; }
+
+    Counter counts[SLOTS];
+};
+
+/* MetricsSnapshot
+ * Totals summed over every thread at one instant. The client sends datagrams and recieves acks, the server recieves
+ * datagrams and sends replies; unknown and duplicate sequence numbers are only known to the client.
+ */
+struct MetricsSnapshot
+{
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t eagain = 0;       // Calls that found the socket full or empty and had to wait or spin
+    uint64_t unknown = 0;
+    uint64_t duplicates = 0;
+    uint64_t errnos[ErrnoCounts::SLOTS] = {};
+
+    void Add(const ErrnoCounts& counts);
+};
+
+/* ThreadMetrics
+ * The counters one client thread keeps. Padded with a cache line on either side, so the counters of threads
+ * stored next to each other (in a vector, say) never share a line.
+ */
+struct ThreadMetrics
+{
+    char leadingPad[64];
+    Counter sent;
+    Counter received;
+    Counter bytes;
+    Counter errors;
+    Counter eagain;
+    Counter unknown;
+    Counter duplicates;
+    ErrnoCounts errnos;
+    char trailingPad[64];
+
+    void Failed(int error, uint64_t datagrams = 1)
+    {
+        errors += datagrams;
+        errnos.Record(error, datagrams);
+    }
+
+    void AddTo(MetricsSnapshot& snapshot) const;
+};
+
+enum class MetricsFormat
+{
+    Text,        // One line of rates per interval on stdout
+    Json,        // One JSON object per interval, appended to the path (stdout without one)
+    Prometheus   // Text exposition format, the file at the path is replaced every interval
+};
+
+/* MetricsOptions
+ * How and how often to report. Parsed from the command line of either binary.
+ */
+struct MetricsOptions
+{
+    std::chrono::milliseconds interval{0};   // 0 for no live reporting
+    MetricsFormat format = MetricsFormat::Text;
+    std::string path;
+
+    /* ParseFormat
+     * Reads text, json[:path] or prom:path.
+     * Exceptions:
+     *   Will throw an exception for any other format, or prom without a path.
+     */
+    void ParseFormat(const std::string& text);
+};
+
+/* MetricsReporter
+ * Thread that calls the sampler every interval and reports totals and the rates since the previous sample. The
+ * sampler only reads Counters, so the datagram loops never wait on the reporter; the reporter's own mutex is only
+ * used to wake it early on Stop.
+ */
+class MetricsReporter
+{
+public:
+    using Sampler = std::function<void(MetricsSnapshot&)>;
+
+    /* Parameters:
+     *   Sampler                sampler -- Fills in a snapshot, called from the reporter thread
+     *   const MetricsOptions&  options -- Interval, format and path
+     *   const std::string&     role    -- "client" or "server", labels every report
+     * Exceptions:
+     *   Will throw an exception if the JSON output file cannot be opened.
+     */
+    MetricsReporter(Sampler sampler, const MetricsOptions& options, const std::string& role);
+    ~MetricsReporter();
+
+    MetricsReporter(const MetricsReporter&) = delete;
+    MetricsReporter& operator=(const MetricsReporter&) = delete;
+
+    /* Stop
+     * Takes one last sample, so the final totals are always reported, and ends the thread.
+     */
+    void Stop();
+
+private:
+    void Run();
+    void Report(const MetricsSnapshot& now, const MetricsSnapshot& previous, double seconds, double elapsed);
+
+    Sampler sampler;
+    MetricsOptions options;
+    std::string role;
+    FILE* jsonOut = nullptr;
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread reporter;
+};
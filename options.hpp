@@ -0,0 +1,31 @@
+#pragma once
+/* UDP Blaster -- Option parsing
+ * Helpers the client and server share for reading numeric command line options.
+ */
+
+#include <stdexcept>
+#include <string>
+
+/* ParseBounded
+ * Reads a count and checks it against its bounds before narrowing it, so a number too big for an unsigned int cannot
+ * wrap around into the valid range.
+ * Parameters:
+ *   const std::string& text    -- Number to parse
+ *   unsigned long      lowest  -- Smallest value allowed
+ *   unsigned long      highest -- Largest value allowed, no more than UINT_MAX
+ *   const std::string& message -- Error message when the number is out of bounds
+ * Returns:
+ *   The number.
+ * Exceptions:
+ *   Will throw an exception if the text is not a number or is out of bounds.
+ */
+inline unsigned int ParseBounded(const std::string& text, unsigned long lowest, unsigned long highest,
+                                 const std::string& message)
+{
+    unsigned long value = std::stoul(text);
+    if (value < lowest || value > highest)
+    {
+        throw std::out_of_range(message);
+    }
+    return static_cast<unsigned int>(value);
+}
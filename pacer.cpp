@@ -0,0 +1,178 @@
+/* UDP Blaster -- Send pacing
+ * Token bucket that holds the client to a target send rate.
+ */
+
+// C/C++ Standard Libraries
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+#include <thread>
+
+// Local includes
+#include "pacer.hpp"
+
+using Clock = std::chrono::steady_clock;
+using NS = std::chrono::nanoseconds;
+
+const int64_t Pacer::SPIN_THRESHOLD_NS;
+
+namespace
+{
+    int64_t Now()
+    {
+        return std::chrono::duration_cast<NS>(Clock::now().time_since_epoch()).count();
+    }
+}
+
+Pacer::Pacer(double packetsPerSecond, uint32_t burst, std::chrono::microseconds delay, uint32_t datagramBytes)
+    : rate(packetsPerSecond), burst(burst > 0 ? burst : 1), delay(delay), datagramBytes(datagramBytes)
+{
+    Reset(packetsPerSecond);
+}
+
+void Pacer::Reset(double packetsPerSecond)
+{
+    if (packetsPerSecond > 0)
+    {
+        rate = packetsPerSecond;
+    }
+
+    // Start with a single token so the first datagram goes out at once without an initial burst
+    tokens = 1.0;
+    lastRefill = Now();
+
+    gaps.Reset();
+    firstSend = 0;
+    lastSend = 0;
+    sends = 0;
+    gapMean = 0.0;
+    gapM2 = 0.0;
+}
+
+void Pacer::SpinUntil(int64_t deadline)
+{
+    int64_t remaining = deadline - Now();
+    if (remaining > SPIN_THRESHOLD_NS)
+    {
+        std::this_thread::sleep_for(NS(remaining - SPIN_THRESHOLD_NS));
+    }
+    while (Now() < deadline)
+    {
+        // Spin, the deadline is closer than the scheduler can be trusted with
+    }
+}
+
+void Pacer::Wait()
+{
+    if (rate > 0)
+    {
+        int64_t now = Now();
+        tokens = std::min(burst, tokens + (now - lastRefill) * rate / 1e9);
+        lastRefill = now;
+
+        if (tokens < 1.0)
+        {
+            int64_t deadline = now + static_cast<int64_t>(std::ceil((1.0 - tokens) * 1e9 / rate));
+            SpinUntil(deadline);
+
+            now = Now();
+            tokens = std::min(burst, tokens + (now - lastRefill) * rate / 1e9);
+            lastRefill = now;
+        }
+        tokens -= 1.0;
+    }
+    else if (delay.count() > 0)
+    {
+        std::this_thread::sleep_for(delay);
+    }
+
+    // Welford's running mean/variance of the gaps, alongside the histogram for the tail
+    int64_t sendTime = Now();
+    if (sends > 0)
+    {
+        double gap = static_cast<double>(sendTime - lastSend);
+        gaps.Record(sendTime - lastSend);
+        double delta = gap - gapMean;
+        gapMean += delta / sends;
+        gapM2 += delta * (gap - gapMean);
+    }
+    else
+    {
+        firstSend = sendTime;
+    }
+    lastSend = sendTime;
+    sends++;
+}
+
+double Pacer::AchievedRate() const
+{
+    if (sends < 2 || lastSend == firstSend)
+    {
+        return 0.0;
+    }
+    return (sends - 1) * 1e9 / (lastSend - firstSend);
+}
+
+void Pacer::PrintReport(std::ostream& out) const
+{
+    std::ios::fmtflags oldFlags = out.flags();
+    std::streamsize oldPrecision = out.precision();
+    out << std::fixed << std::setprecision(1);
+
+    double achieved = AchievedRate();
+    if (rate > 0)
+    {
+        out << "Requested rate: " << rate << " pps (" << rate * datagramBytes * 8 / 1e6 << " Mbit/s), burst "
+            << static_cast<uint32_t>(burst) << "\n";
+    }
+    else
+    {
+        out << "Requested delay: " << delay.count() << "us between datagrams\n";
+    }
+    out << "Achieved rate: " << achieved << " pps (" << achieved * datagramBytes * 8 / 1e6 << " Mbit/s)";
+    if (rate > 0)
+    {
+        out << ", " << 100.0 * achieved / rate << "% of requested";
+    }
+    out << "\n";
+
+    if (sends > 2)
+    {
+        out << "Inter-send gap jitter (stddev): " << std::sqrt(gapM2 / (sends - 2)) / 1000.0 << "us\n";
+    }
+    out.flags(oldFlags);
+    out.precision(oldPrecision);
+
+    gaps.PrintSummary(out, "Inter-send gap");
+}
+
+double Pacer::ParseRate(const std::string& text)
+{
+    size_t used = 0;
+    double value = std::stod(text, &used);
+    std::string suffix = text.substr(used);
+
+    if (suffix == "k" || suffix == "K")
+    {
+        value *= 1e3;
+    }
+    else if (suffix == "m" || suffix == "M")
+    {
+        value *= 1e6;
+    }
+    else if (suffix == "g" || suffix == "G")
+    {
+        value *= 1e9;
+    }
+    else if (!suffix.empty())
+    {
+        throw std::invalid_argument("Unknown rate suffix \"" + suffix + "\"");
+    }
+
+    if (!(value > 0))
+    {
+        throw std::invalid_argument("Rate must be positive");
+    }
+    return value;
+}
@@ -0,0 +1,82 @@
+#pragma once
+/* UDP Blaster -- Send pacing
+ * Token bucket that holds the client to a target send rate.
+ */
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <ostream>
+
+// Local includes
+#include "histogram.hpp"
+
+/* Pacer
+ * Decides when the next datagram may go out. With a target rate it runs a token bucket refilled from the monotonic
+ * clock: long waits sleep until shortly before the deadline and the rest is busy-spun, so the rate holds even when
+ * the gap between sends is far below the timer slack. Without a rate it falls back to the old fixed delay between
+ * sends. Either way every inter-send gap is recorded so the achieved rate and jitter can be reported.
+ * Only one thread may call Wait.
+ */
+class Pacer
+{
+public:
+    /* Sleeps shorter than this are left to the spin loop, they would overshoot by about this much */
+    static const int64_t SPIN_THRESHOLD_NS = 60000;
+
+    /* Parameters:
+     *   double                    packetsPerSecond -- Target rate, 0 for no token bucket
+     *   uint32_t                  burst            -- Most datagrams that may go out back to back
+     *   std::chrono::microseconds delay            -- Fixed delay used when there is no target rate
+     *   uint32_t                  datagramBytes    -- Size of each datagram, only used for reporting
+     */
+    Pacer(double packetsPerSecond, uint32_t burst, std::chrono::microseconds delay, uint32_t datagramBytes);
+
+    /* Wait
+     * Blocks until the next datagram is allowed out and takes its token.
+     */
+    void Wait();
+
+    /* Reset
+     * Forgets the gap statistics and refills the bucket, ready for a fresh run at a new rate (0 keeps the old one).
+     */
+    void Reset(double packetsPerSecond = 0);
+
+    /* PrintReport
+     * Displays the requested and achieved rates and the jitter of the gaps between sends.
+     */
+    void PrintReport(std::ostream& out) const;
+
+    bool Active() const { return rate > 0 || delay.count() > 0; }
+    double RequestedRate() const { return rate; }
+    double AchievedRate() const;
+
+    /* ParseRate
+     * Reads a rate such as 400k, 1.5M or 10G. Throws std::invalid_argument if it is not a positive number.
+     */
+    static double ParseRate(const std::string& text);
+
+    /* SpinUntil
+     * Blocks until a steady clock time in nanoseconds, sleeping for all but the last SPIN_THRESHOLD_NS of it.
+     */
+    static void SpinUntil(int64_t deadline);
+
+private:
+
+    double rate;
+    double burst;
+    std::chrono::microseconds delay;
+    uint32_t datagramBytes;
+
+    // Token bucket state
+    double tokens;
+    int64_t lastRefill;
+
+    // Gap statistics
+    LatencyHistogram gaps;
+    int64_t firstSend;
+    int64_t lastSend;
+    uint64_t sends;
+    double gapMean;
+    double gapM2;
+};
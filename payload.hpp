@@ -0,0 +1,40 @@
+#pragma once
+/* UDP Blaster -- Payload pattern
+ * Limits and the verifiable fill pattern for sized payloads, shared by the client and server.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Largest UDP payload that fits in an IPv4 datagram, and the buffer size that covers any datagram
+const uint32_t MAX_DATAGRAM_SIZE = 65507;
+const uint32_t MAX_RECIEVE_BUFFER = 65536;
+
+/* PatternByte
+ * Byte expected at a given payload offset. The multiplier is odd so every offset in a 256-byte cycle is distinct,
+ * which catches shifted or truncated payloads as well as flipped bytes.
+ */
+inline uint8_t PatternByte(size_t offset)
+{
+    return static_cast<uint8_t>(offset * 131 + 17);
+}
+
+inline void FillPattern(uint8_t* payload, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        payload[i] = PatternByte(i);
+    }
+}
+
+inline bool CheckPattern(const uint8_t* payload, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (payload[i] != PatternByte(i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
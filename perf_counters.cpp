@@ -0,0 +1,112 @@
+/* UDP Blaster -- Performance counters
+ * Per-thread user-space instruction and cycle counts around a loop, for comparing how much work each datagram costs.
+ */
+
+// C/C++ Standard Libraries
+#include <initializer_list>
+#include <string.h>
+#include <time.h>
+
+// System libraries
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Local includes
+#include "perf_counters.hpp"
+
+namespace
+{
+    int OpenCounter(uint64_t config)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    uint64_t ReadCounter(int fd)
+    {
+        uint64_t value = 0;
+        if (read(fd, &value, sizeof(value)) != sizeof(value))
+        {
+            return 0;
+        }
+        return value;
+    }
+
+    // The fallback clock: TSC ticks on x86, nanoseconds of the raw monotonic clock elsewhere
+    uint64_t ReadFallbackClock()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+    }
+}
+
+const char* PerfCounters::FallbackUnit()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return "TSC ticks";
+#else
+    return "nanoseconds";
+#endif
+}
+
+PerfCounters::PerfCounters()
+    : instructionsFD(OpenCounter(PERF_COUNT_HW_INSTRUCTIONS)), cyclesFD(OpenCounter(PERF_COUNT_HW_CPU_CYCLES))
+{
+}
+
+PerfCounters::~PerfCounters()
+{
+    if (instructionsFD >= 0)
+    {
+        close(instructionsFD);
+    }
+    if (cyclesFD >= 0)
+    {
+        close(cyclesFD);
+    }
+}
+
+void PerfCounters::Start()
+{
+    for (int fd : {instructionsFD, cyclesFD})
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    tscStart = ReadFallbackClock();
+}
+
+void PerfCounters::Stop()
+{
+    uint64_t tscStop = ReadFallbackClock();
+    for (int fd : {instructionsFD, cyclesFD})
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    instructions = instructionsFD >= 0 ? ReadCounter(instructionsFD) : 0;
+    cycles = cyclesFD >= 0 ? ReadCounter(cyclesFD) : tscStop - tscStart;
+}
@@ -0,0 +1,40 @@
+#pragma once
+/* UDP Blaster -- Performance counters
+ * Per-thread user-space instruction and cycle counts around a loop, for comparing how much work each datagram costs.
+ */
+
+#include <stdint.h>
+
+/* PerfCounters
+ * Counts the instructions and cycles the calling thread retires in user space between Start and Stop, using
+ * perf_event_open. Where the kernel or the machine offers no hardware counters (most VMs and containers), instructions
+ * are unavailable and cycles fall back to TSC ticks (nanoseconds of CLOCK_MONOTONIC_RAW on machines without a TSC),
+ * which also include the time spent in the kernel.
+ * Only counts the thread that constructed it.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    void Start();
+    void Stop();
+
+    bool CountsInstructions() const { return instructionsFD >= 0; }
+    bool CyclesFromTsc() const { return cyclesFD < 0; }
+    // What the cycle counts are in when they come from the fallback clock
+    static const char* FallbackUnit();
+    uint64_t Instructions() const { return instructions; }
+    uint64_t Cycles() const { return cycles; }
+
+private:
+    int instructionsFD = -1;
+    int cyclesFD = -1;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    uint64_t tscStart = 0;
+};
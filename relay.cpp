@@ -0,0 +1,947 @@
+/* CSC 3600 Spring 2023 Project 1
+ * UDP Blaster -- Relay
+ * Impairment proxy that sits between the client and the server on one machine and forwards datagrams both ways with
+ * seeded delay, jitter, loss, duplication, reordering and a bandwidth cap, so lossy links can be tested on loopback.
+ */
+
+// C/C++ Standard Libraries
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <memory>
+#include <utility>
+
+// System libraries
+#include <unistd.h>
+#include <getopt.h>
+#include <memory.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Local includes
+#include "defaults.hpp"
+#include "structure.hpp"
+#include "payload.hpp"
+#include "flow_table.hpp"
+#include "timer_wheel.hpp"
+#include "impairment.hpp"
+#include "socket_tuning.hpp"
+
+// Constants for errors
+const int32_t UNKNOWN_ARGUMENT = 1;
+const int32_t SETUP_ERROR = 2;
+const int32_t NETWORKING_ERROR = 3; // to match with the client and server
+
+// Datagrams moved per recvmmsg/sendmmsg call, and recieve calls per socket before due datagrams get a turn
+const unsigned int RELAY_BATCH = 64;
+const unsigned int MAX_RECIEVE_BATCHES = 16;
+const unsigned int MAX_EVENTS = 64;
+
+// Timer wheel: 10us ticks over 16384 slots, so one turn covers about 164ms of delay before slots are shared
+const uint64_t TICK_NS = 10000;
+const uint32_t WHEEL_SLOTS = 16384;
+
+// Pool defaults: enough buffers for a few hundred milliseconds of a fast client, each big enough for -l 2000
+const uint32_t DEFAULT_QUEUE_DATAGRAMS = 16384;
+const uint32_t DEFAULT_BUFFER_SIZE = 2048;
+
+// epoll tag of the client facing socket, upstream sockets are tagged with their session index
+const uint32_t LISTENER_TAG = UINT32_MAX;
+
+// Idle sessions are looked for once a second, so one closes at most a second after its timeout
+const uint64_t SESSION_SWEEP_NS = 1000000000;
+const unsigned int DEFAULT_IDLE_SECONDS = 30;
+
+// Set from the signal handler to ask the relay loop to wind down
+std::atomic<bool> stopRequested(false);
+
+/* SendBatch
+ * Due datagrams gathered for one sendmmsg call. Every datagram in a batch goes out on the same socket.
+ */
+struct SendBatch
+{
+    mmsghdr messages[RELAY_BATCH];
+    iovec vectors[RELAY_BATCH];
+    QueuedDatagram* datagrams[RELAY_BATCH];
+    unsigned int count = 0;
+    int socketFD = -1;
+};
+
+/* Session
+ * One client seen on the listening socket, and the connected socket its datagrams go on to the server from. Giving
+ * each client its own upstream socket (and so its own source port) lets the server's replies find their way back.
+ * A session that goes quiet is closed and its slot reused, but only once none of its datagrams are left in the wheel
+ * or a batch, as those find their session by index.
+ */
+struct Session
+{
+    Session(uint64_t toServerSeed, uint64_t toClientSeed)
+        : toServer(toServerSeed), toClient(toClientSeed), batch(new SendBatch)
+    {
+    }
+
+    sockaddr_storage client;
+    socklen_t clientLength;
+    int upstreamFD;                     // -1 once the session has been closed
+    uint64_t lastSeenNs = 0;            // Last datagram either way
+    uint32_t queued = 0;                // Datagrams of the session in the wheel or a send batch
+    ImpairmentStream toServer;
+    ImpairmentStream toClient;
+    std::unique_ptr<SendBatch> batch;   // Due datagrams on their way to the server
+};
+
+struct FlowKeyHash
+{
+    size_t operator()(const FlowKey& key) const { return static_cast<size_t>(HashFlowKey(key)); }
+};
+
+/* RelayState
+ * Everything the relay loop works on. Single threaded, the loop is the only one to touch it.
+ */
+struct RelayState
+{
+    RelayState(uint32_t queueDatagrams, uint32_t bufferSize, const ImpairmentOptions& upstream,
+               const ImpairmentOptions& downstream, uint64_t seed, uint64_t now)
+        : seed(seed), wheel(queueDatagrams, bufferSize, TICK_NS, WHEEL_SLOTS, now), toServer(upstream),
+          toClient(downstream)
+    {
+    }
+
+    int listenFD = -1;
+    int epollFD = -1;
+    sockaddr_storage server;
+    socklen_t serverLength = 0;
+    std::vector<Session> sessions;
+    std::unordered_map<FlowKey, uint32_t, FlowKeyHash> sessionIndex;
+    uint64_t seed;
+    SocketTuning tuning;
+    TimerWheel wheel;
+    Impairment toServer;
+    Impairment toClient;
+    SendBatch replies;                  // Due datagrams on their way back to clients, all through listenFD
+    std::vector<uint32_t> pending;      // Sessions whose batch has datagrams in it
+    std::vector<uint32_t> freeSessions; // Slots of closed sessions, reused before the vector grows
+    uint64_t idleTimeoutNs = 0;         // Close sessions quiet for this long, 0 to keep them
+    uint64_t nextSweepNs = 0;
+    uint64_t sessionsOpened = 0;
+    uint64_t sessionsClosed = 0;
+    uint64_t sessionFailures = 0;       // Datagrams from new clients whose session could not be opened
+    uint64_t closedKernelDrops = 0;     // Kernel drops counted on upstream sockets before they were closed
+    uint64_t recvCalls = 0;
+    uint64_t sendCalls = 0;
+};
+
+/* HandleStopSignal
+ * SIGINT/SIGTERM handler. Only flags the request, the loop notices it once its wait is interrupted.
+ */
+void HandleStopSignal(int)
+{
+    stopRequested.store(true);
+}
+
+inline uint64_t NowNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/* OpenListener
+ * Opens the nonblocking socket clients send to, bound to the first local address that works.
+ * Parameters:
+ *   uint16_t port -- Port to bind, 0 for any free port
+ * Returns:
+ *   The socket.
+ * Exceptions:
+ *   Will throw an exception if the address lookup fails or no address can be bound.
+ */
+int OpenListener(uint16_t port)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo* info;
+    int rv = getaddrinfo(nullptr, std::to_string(port).c_str(), &hints, &info);
+    if (rv != 0)
+    {
+        std::runtime_error ex(gai_strerror(rv));
+        throw ex;
+    }
+
+    int socketFD = -1;
+    for (addrinfo* current = info; current != nullptr; current = current->ai_next)
+    {
+        socketFD = socket(current->ai_family, current->ai_socktype | SOCK_NONBLOCK, current->ai_protocol);
+        if (socketFD == -1)
+        {
+            continue;
+        }
+        if (bind(socketFD, current->ai_addr, current->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(socketFD);
+        socketFD = -1;
+    }
+    freeaddrinfo(info);
+
+    if (socketFD == -1)
+    {
+        std::runtime_error ex("Unable to bind the relay's listening socket");
+        throw ex;
+    }
+    return socketFD;
+}
+
+/* BoundPort
+ * Returns the local port a socket ended up bound to.
+ */
+uint16_t BoundPort(int socketFD)
+{
+    sockaddr_storage local;
+    socklen_t length = sizeof(local);
+    if (getsockname(socketFD, reinterpret_cast<sockaddr*>(&local), &length) == -1)
+    {
+        return 0;
+    }
+    if (local.ss_family == AF_INET6)
+    {
+        return ntohs(reinterpret_cast<sockaddr_in6*>(&local)->sin6_port);
+    }
+    return ntohs(reinterpret_cast<sockaddr_in*>(&local)->sin_port);
+}
+
+/* ResolveServer
+ * Looks up the server the relay forwards to and keeps its first address.
+ * Exceptions:
+ *   Will throw an exception if the lookup fails.
+ */
+void ResolveServer(RelayState& state, const std::string& serverName, uint16_t port)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* info;
+    int rv = getaddrinfo(serverName.c_str(), std::to_string(port).c_str(), &hints, &info);
+    if (rv != 0)
+    {
+        std::runtime_error ex(gai_strerror(rv));
+        throw ex;
+    }
+    memcpy(&state.server, info->ai_addr, info->ai_addrlen);
+    state.serverLength = info->ai_addrlen;
+    freeaddrinfo(info);
+}
+
+/* RaiseFileLimit
+ * Lifts the soft open file limit to the hard limit, as every client the relay sees costs it an upstream socket.
+ * Returns:
+ *   The limit now in force.
+ */
+rlim_t RaiseFileLimit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        return 0;
+    }
+    if (limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+        {
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+    return limit.rlim_cur;
+}
+
+/* OpenSession
+ * Connects a new upstream socket for a client seen for the first time and starts watching it for replies. The slot
+ * of a closed session is reused if there is one.
+ * Parameters:
+ *   RelayState&     state        -- Relay to add the session to
+ *   const sockaddr* client       -- The client's address
+ *   socklen_t       clientLength -- Length of the address
+ * Returns:
+ *   The new session's index.
+ * Exceptions:
+ *   Will throw an exception if the socket cannot be opened, connected or watched.
+ */
+uint32_t OpenSession(RelayState& state, const sockaddr* client, socklen_t clientLength)
+{
+    int socketFD = socket(state.server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (socketFD == -1)
+    {
+        std::runtime_error ex(std::string("Unable to open an upstream socket: ") + strerror(errno));
+        throw ex;
+    }
+    if (connect(socketFD, reinterpret_cast<sockaddr*>(&state.server), state.serverLength) == -1)
+    {
+        std::runtime_error ex(std::string("Unable to connect to the server: ") + strerror(errno));
+        close(socketFD);
+        throw ex;
+    }
+
+    try
+    {
+        TuneSocket(socketFD, state.tuning);
+    }
+    catch (...)
+    {
+        close(socketFD);
+        throw;
+    }
+
+    bool reuse = !state.freeSessions.empty();
+    uint32_t index = reuse ? state.freeSessions.back() : static_cast<uint32_t>(state.sessions.size());
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = index;
+    if (epoll_ctl(state.epollFD, EPOLL_CTL_ADD, socketFD, &event) == -1)
+    {
+        std::runtime_error ex(std::string("Unable to watch an upstream socket: ") + strerror(errno));
+        close(socketFD);
+        throw ex;
+    }
+
+    // Every session's pair of streams gets seeds of its own, two apart from the next session's
+    uint64_t order = state.sessionsOpened++;
+    Session session(state.seed + 2 * order, state.seed + 2 * order + 1);
+    memset(&session.client, 0, sizeof(session.client));
+    memcpy(&session.client, client, clientLength);
+    session.clientLength = clientLength;
+    session.upstreamFD = socketFD;
+    if (reuse)
+    {
+        state.freeSessions.pop_back();
+        state.sessions[index] = std::move(session);
+    }
+    else
+    {
+        state.sessions.push_back(std::move(session));
+    }
+    state.sessionIndex[MakeFlowKey(client)] = index;
+    return index;
+}
+
+/* CloseIdleSessions
+ * Closes every session that has seen no datagram for the idle timeout and has none left in flight, and frees its
+ * slot for the next new client.
+ */
+void CloseIdleSessions(RelayState& state, uint64_t now)
+{
+    for (uint32_t index = 0; index < state.sessions.size(); index++)
+    {
+        Session& session = state.sessions[index];
+        if (session.upstreamFD == -1 || session.queued > 0 || now - session.lastSeenNs < state.idleTimeoutNs)
+        {
+            continue;
+        }
+        state.closedKernelDrops += SocketDrops(session.upstreamFD);
+        close(session.upstreamFD);
+        session.upstreamFD = -1;
+        state.sessionIndex.erase(MakeFlowKey(reinterpret_cast<const sockaddr*>(&session.client)));
+        state.freeSessions.push_back(index);
+        state.sessionsClosed++;
+    }
+}
+
+/* FlushBatch
+ * Sends every datagram in a batch and hands their buffers back to the wheel. A datagram the kernel refuses is
+ * counted as a send error and skipped, as a real link would drop it, rather than retried.
+ */
+void FlushBatch(RelayState& state, SendBatch& batch)
+{
+    unsigned int done = 0;
+    while (done < batch.count)
+    {
+        int sent = sendmmsg(batch.socketFD, batch.messages + done, batch.count - done, 0);
+        state.sendCalls++;
+        QueuedDatagram* first = batch.datagrams[done];
+        Impairment& direction = first->toServer ? state.toServer : state.toClient;
+        if (sent <= 0)
+        {
+            direction.stats.sendErrors++;
+            done++;
+            continue;
+        }
+        direction.stats.forwarded += sent;
+        done += sent;
+    }
+
+    for (unsigned int i = 0; i < batch.count; i++)
+    {
+        state.sessions[batch.datagrams[i]->session].queued--;
+        state.wheel.Free(batch.datagrams[i]);
+    }
+    batch.count = 0;
+}
+
+/* QueueSend
+ * Adds a due datagram to its socket's send batch, sending the batch first if it is full. Replies to every client
+ * share the listening socket's batch, datagrams to the server are batched per session.
+ */
+void QueueSend(RelayState& state, QueuedDatagram* datagram)
+{
+    Session& session = state.sessions[datagram->session];
+    SendBatch& batch = datagram->toServer ? *session.batch : state.replies;
+    if (batch.count == RELAY_BATCH)
+    {
+        FlushBatch(state, batch);
+    }
+    if (batch.count == 0 && datagram->toServer)
+    {
+        state.pending.push_back(datagram->session);
+    }
+
+    unsigned int i = batch.count++;
+    batch.socketFD = datagram->toServer ? session.upstreamFD : state.listenFD;
+    batch.datagrams[i] = datagram;
+    batch.vectors[i].iov_base = datagram->data;
+    batch.vectors[i].iov_len = datagram->length;
+    memset(&batch.messages[i], 0, sizeof(batch.messages[i]));
+    batch.messages[i].msg_hdr.msg_iov = &batch.vectors[i];
+    batch.messages[i].msg_hdr.msg_iovlen = 1;
+    if (!datagram->toServer)
+    {
+        batch.messages[i].msg_hdr.msg_name = &session.client;
+        batch.messages[i].msg_hdr.msg_namelen = session.clientLength;
+    }
+}
+
+/* Impair
+ * Runs a freshly recieved datagram through its direction's impairments: it is either dropped and its buffer freed,
+ * or scheduled on the wheel, possibly along with a copy.
+ */
+void Impair(RelayState& state, QueuedDatagram* datagram, uint64_t now)
+{
+    Impairment& direction = datagram->toServer ? state.toServer : state.toClient;
+    Session& session = state.sessions[datagram->session];
+    ImpairmentStream& stream = datagram->toServer ? session.toServer : session.toClient;
+    direction.stats.received++;
+    uint64_t departure = 0;
+    if (direction.Drop(stream) || (departure = direction.Departure(stream, now, datagram->length)) == 0)
+    {
+        state.wheel.Free(datagram);
+        return;
+    }
+    state.wheel.Schedule(datagram, departure);
+    session.queued++;
+
+    if (direction.Duplicate(stream))
+    {
+        QueuedDatagram* copy = state.wheel.Allocate();
+        if (copy == nullptr)
+        {
+            direction.stats.poolDrops++;
+            return;
+        }
+        memcpy(copy->data, datagram->data, datagram->length);
+        copy->length = datagram->length;
+        copy->session = datagram->session;
+        copy->toServer = datagram->toServer;
+        state.wheel.Schedule(copy, departure);
+        session.queued++;
+    }
+}
+
+/* RecieveBatches
+ * Drains a readable socket with recvmmsg straight into wheel buffers, and impairs what arrives. Once the pool runs
+ * dry the rest of the queue is still read, into a scratch buffer, and counted as dropped so the socket never backs up
+ * behind the relay. A datagram from a new client whose session cannot be opened, with the relay out of descriptors
+ * say, is counted as dropped too, and the error shown the first time.
+ * Parameters:
+ *   RelayState& state    -- The relay
+ *   uint32_t    tag      -- LISTENER_TAG for the client facing socket, otherwise the session whose reply socket it is
+ */
+void RecieveBatches(RelayState& state, uint32_t tag)
+{
+    const bool toServer = tag == LISTENER_TAG;
+    const int socketFD = toServer ? state.listenFD : state.sessions[tag].upstreamFD;
+    Impairment& direction = toServer ? state.toServer : state.toClient;
+
+    mmsghdr messages[RELAY_BATCH];
+    iovec vectors[RELAY_BATCH];
+    sockaddr_storage sources[RELAY_BATCH];
+    QueuedDatagram* datagrams[RELAY_BATCH];
+    static uint8_t scratch[MAX_RECIEVE_BUFFER];
+
+    for (unsigned int pass = 0; pass < MAX_RECIEVE_BATCHES; pass++)
+    {
+        unsigned int count = 0;
+        while (count < RELAY_BATCH && (datagrams[count] = state.wheel.Allocate()) != nullptr)
+        {
+            count++;
+        }
+        bool discard = count == 0;
+        unsigned int slots = discard ? 1 : count;
+
+        memset(messages, 0, sizeof(messages[0]) * slots);
+        for (unsigned int i = 0; i < slots; i++)
+        {
+            vectors[i].iov_base = discard ? scratch : datagrams[i]->data;
+            vectors[i].iov_len = discard ? sizeof(scratch) : state.wheel.BufferSize();
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            if (toServer)
+            {
+                messages[i].msg_hdr.msg_name = &sources[i];
+                messages[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+            }
+        }
+
+        int recieved = recvmmsg(socketFD, messages, slots, MSG_DONTWAIT, nullptr);
+        state.recvCalls++;
+        int used = recieved > 0 ? recieved : 0;
+        for (unsigned int i = used; i < count; i++)
+        {
+            state.wheel.Free(datagrams[i]);
+        }
+        if (recieved <= 0)
+        {
+            if (recieved == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("recvmmsg error");
+            }
+            return;
+        }
+        if (discard)
+        {
+            direction.stats.received++;
+            direction.stats.poolDrops++;
+            continue;
+        }
+
+        uint64_t now = NowNs();
+        for (int i = 0; i < recieved; i++)
+        {
+            QueuedDatagram* datagram = datagrams[i];
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                direction.stats.received++;
+                direction.stats.truncated++;
+                state.wheel.Free(datagram);
+                continue;
+            }
+
+            datagram->length = messages[i].msg_len;
+            datagram->toServer = toServer;
+            datagram->session = tag;
+            if (toServer)
+            {
+                const sockaddr* source = reinterpret_cast<const sockaddr*>(&sources[i]);
+                std::unordered_map<FlowKey, uint32_t, FlowKeyHash>::const_iterator known =
+                    state.sessionIndex.find(MakeFlowKey(source));
+                if (known != state.sessionIndex.end())
+                {
+                    datagram->session = known->second;
+                }
+                else
+                {
+                    try
+                    {
+                        datagram->session = OpenSession(state, source, messages[i].msg_hdr.msg_namelen);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        if (state.sessionFailures++ == 0)
+                        {
+                            std::cerr << e.what()
+                                      << ", dropping new clients' datagrams until a session can be opened\n";
+                        }
+                        direction.stats.received++;
+                        direction.stats.sessionDrops++;
+                        state.wheel.Free(datagram);
+                        continue;
+                    }
+                }
+            }
+            state.sessions[datagram->session].lastSeenNs = now;
+            Impair(state, datagram, now);
+        }
+
+        if (static_cast<unsigned int>(recieved) < slots)
+        {
+            return;
+        }
+    }
+}
+
+/* RunRelay
+ * Waits for datagrams on every socket and for the wheel's next due time, until SIGINT/SIGTERM. The wait uses
+ * epoll_pwait2 so its timeout has nanosecond resolution and can follow the wheel's ticks.
+ */
+void RunRelay(RelayState& state)
+{
+    epoll_event events[MAX_EVENTS];
+    while (!stopRequested.load())
+    {
+        uint64_t now = NowNs();
+        state.wheel.Expire(now, [&](QueuedDatagram* datagram) { QueueSend(state, datagram); });
+        for (uint32_t session : state.pending)
+        {
+            FlushBatch(state, *state.sessions[session].batch);
+        }
+        state.pending.clear();
+        FlushBatch(state, state.replies);
+
+        uint64_t next = state.wheel.NextDue();
+        if (state.idleTimeoutNs > 0)
+        {
+            if (now >= state.nextSweepNs)
+            {
+                CloseIdleSessions(state, now);
+                state.nextSweepNs = now + SESSION_SWEEP_NS;
+            }
+            if (state.sessionIndex.size() > 0 && state.nextSweepNs < next)
+            {
+                next = state.nextSweepNs;
+            }
+        }
+        timespec timeout;
+        timespec* wait = nullptr;
+        if (next != UINT64_MAX)
+        {
+            uint64_t remaining = next > now ? next - now : 0;
+            timeout.tv_sec = remaining / 1000000000;
+            timeout.tv_nsec = remaining % 1000000000;
+            wait = &timeout;
+        }
+
+        int ready = epoll_pwait2(state.epollFD, events, MAX_EVENTS, wait, nullptr);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::runtime_error ex(std::string("epoll_pwait2 error: ") + strerror(errno));
+            throw ex;
+        }
+        for (int i = 0; i < ready; i++)
+        {
+            RecieveBatches(state, events[i].data.u32);
+        }
+    }
+}
+
+/* PrintDirection
+ * Prints what happened to the datagrams of one direction.
+ */
+void PrintDirection(const std::string& label, const ImpairmentStats& stats)
+{
+    std::cout << label << ": " << stats.received << " recieved, " << stats.forwarded << " forwarded, "
+              << stats.lost << " lost, " << stats.burstLost << " lost in bursts, " << stats.queueDrops
+              << " tail dropped, " << stats.duplicated << " duplicated, " << stats.reordered << " held back\n";
+    if (stats.poolDrops > 0 || stats.truncated > 0 || stats.sendErrors > 0 || stats.sessionDrops > 0)
+    {
+        std::cout << "  dropped by the relay itself: " << stats.poolDrops << " with no buffer free, "
+                  << stats.truncated << " too long, " << stats.sendErrors << " failed sends, " << stats.sessionDrops
+                  << " with no session\n";
+    }
+}
+
+/* ParsePercent
+ * Reads a percentage from 0 to 100 and returns it as a fraction.
+ */
+double ParsePercent(const std::string& text, const std::string& what)
+{
+    double percent = std::stod(text);
+    if (percent < 0.0 || percent > 100.0)
+    {
+        throw std::out_of_range(what + " must be between 0 and 100%");
+    }
+    return percent / 100.0;
+}
+
+/* ParseMillis
+ * Reads a non-negative time in milliseconds, fractions allowed, and returns it in nanoseconds.
+ */
+uint64_t ParseMillis(const std::string& text, const std::string& what)
+{
+    double millis = std::stod(text);
+    if (millis < 0.0)
+    {
+        throw std::out_of_range(what + " cannot be negative");
+    }
+    return static_cast<uint64_t>(millis * 1e6);
+}
+
+/* ParsePort
+ * Reads a port number, checked before it is narrowed so a number past 65535 cannot wrap around to a valid one.
+ */
+uint16_t ParsePort(const std::string& text, const std::string& what, unsigned long lowest)
+{
+    unsigned long port = std::stoul(text);
+    if (port < lowest || port > 65535)
+    {
+        throw std::out_of_range(what + " must be between " + std::to_string(lowest) + " and 65535");
+    }
+    return static_cast<uint16_t>(port);
+}
+
+int main(int argc, char* argv[])
+{
+    int retval = 0;
+    uint16_t listenPort = PORT_NUMBER + 1;
+    std::string serverName = SERVER_IP;
+    uint16_t serverPort = PORT_NUMBER;
+    ImpairmentOptions impairment;
+    bool oneWay = false;
+    uint64_t seed = 1;
+    uint32_t queueDatagrams = DEFAULT_QUEUE_DATAGRAMS;
+    uint32_t bufferSize = DEFAULT_BUFFER_SIZE;
+    int socketBuffer = 0;
+    unsigned long idleSeconds = DEFAULT_IDLE_SECONDS;
+
+    try
+    {
+        char c;
+        while ((c = getopt(argc, argv, "1B:b:D:d:hi:j:L:l:m:n:P:p:Q:R:r:s:W:x:")) != -1)
+        {
+            switch (c)
+            {
+            case '1':
+                oneWay = true;
+                break;
+
+            case 'B':
+                impairment.bitsPerSecond = std::stod(optarg) * 1e6;
+                if (impairment.bitsPerSecond <= 0.0)
+                {
+                    throw std::out_of_range("Bandwidth cap must be above 0 Mbit/s");
+                }
+                break;
+
+            case 'b':
+                impairment.burstStartRate = ParsePercent(optarg, "Burst start rate");
+                break;
+
+            case 'D':
+                impairment.duplicateRate = ParsePercent(optarg, "Duplication rate");
+                break;
+
+            case 'd':
+                impairment.delayNs = ParseMillis(optarg, "Delay");
+                break;
+
+            case 'h':
+                std::cout << argv[0] << " (UDP Blaster Relay) options: \n"
+                          << "-1        Only impair datagrams to the server, pass replies straight back\n"
+                          << "-B [Mbit] Cap each direction at this many Mbit/s (default unlimited)\n"
+                          << "-b [pct]  Chance each datagram starts a loss burst (default 0)\n"
+                          << "-D [pct]  Chance each datagram is sent twice (default 0)\n"
+                          << "-d [ms]   Fixed one way delay (default 0)\n"
+                          << "-h        Display this help and exit\n"
+                          << "-i [s]    Close a client's session once it has been idle for s seconds, 0 to never "
+                          << "(default " << DEFAULT_IDLE_SECONDS << ")\n"
+                          << "-j [ms]   Add a uniformly random 0 to this much delay to each datagram (default 0)\n"
+                          << "-L [n]    Mean datagrams lost per burst (default 8)\n"
+                          << "-l [pct]  Chance each datagram is lost on its own (default 0)\n"
+                          << "-m [n]    Bytes per relay buffer, longer datagrams are dropped (default "
+                          << DEFAULT_BUFFER_SIZE << ")\n"
+                          << "-n [n]    Most datagrams the relay holds at once (default " << DEFAULT_QUEUE_DATAGRAMS
+                          << ")\n"
+                          << "-P [port] Server port to forward to (default " << PORT_NUMBER << ")\n"
+                          << "-p [port] Port clients send to (default " << PORT_NUMBER + 1
+                          << "), 0 for any free port\n"
+                          << "-Q [ms]   Longest backlog the -B bottleneck queues before dropping (default 50)\n"
+                          << "-R [ms]   How long -r holds a datagram back (default 1)\n"
+                          << "-r [pct]  Chance each datagram is held back so later ones overtake it (default 0)\n"
+                          << "-s [addr] Server address to forward to (default " << SERVER_IP << ")\n"
+                          << "-W [n]    Ask for n byte socket recieve and send buffers, and show what was granted\n"
+                          << "-x [n]    Seed for every random choice, the same seed gives the same fates (default 1)\n";
+                throw 0;
+
+            case 'i':
+                idleSeconds = std::stoul(optarg);
+                break;
+
+            case 'j':
+                impairment.jitterNs = ParseMillis(optarg, "Jitter");
+                break;
+
+            case 'L':
+                impairment.burstLength = std::stod(optarg);
+                if (impairment.burstLength < 1.0)
+                {
+                    throw std::out_of_range("Mean burst length must be at least 1 datagram");
+                }
+                break;
+
+            case 'l':
+                impairment.lossRate = ParsePercent(optarg, "Loss rate");
+                break;
+
+            case 'm':
+                bufferSize = std::stoul(optarg);
+                if (bufferSize < sizeof(ClientDatagram) || bufferSize > MAX_RECIEVE_BUFFER)
+                {
+                    throw std::out_of_range("Relay buffers must be between " + std::to_string(sizeof(ClientDatagram))
+                                            + " and " + std::to_string(MAX_RECIEVE_BUFFER) + " bytes");
+                }
+                break;
+
+            case 'n':
+                queueDatagrams = std::stoul(optarg);
+                if (queueDatagrams < RELAY_BATCH * 2)
+                {
+                    throw std::out_of_range("The relay needs room for at least " + std::to_string(RELAY_BATCH * 2)
+                                            + " datagrams");
+                }
+                break;
+
+            case 'P':
+                serverPort = ParsePort(optarg, "Server port", 1);
+                break;
+
+            case 'p':
+                listenPort = ParsePort(optarg, "Listening port", 0);
+                break;
+
+            case 'Q':
+                impairment.queueNs = ParseMillis(optarg, "Queue length");
+                break;
+
+            case 'R':
+                impairment.reorderDelayNs = ParseMillis(optarg, "Reorder hold back");
+                break;
+
+            case 'r':
+                impairment.reorderRate = ParsePercent(optarg, "Reorder rate");
+                break;
+
+            case 's':
+                serverName = optarg;
+                break;
+
+            case 'W':
+                socketBuffer = std::stoi(optarg);
+                if (socketBuffer <= 0)
+                {
+                    throw std::out_of_range("Socket buffer size must be at least 1 byte");
+                }
+                break;
+
+            case 'x':
+                seed = std::stoull(optarg);
+                break;
+
+            default:
+                std::cerr << "Unknown argument encountered.\n";
+                throw UNKNOWN_ARGUMENT;
+            }
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        return SETUP_ERROR;
+    }
+    catch(const int n)
+    {
+        return n;
+    }
+
+    // No SA_RESTART, so the wait returns EINTR and the loop gets to see the stop request
+    struct sigaction stopAction;
+    memset(&stopAction, 0, sizeof(stopAction));
+    stopAction.sa_handler = HandleStopSignal;
+    sigemptyset(&stopAction.sa_mask);
+    sigaction(SIGINT, &stopAction, nullptr);
+    sigaction(SIGTERM, &stopAction, nullptr);
+
+    ImpairmentOptions downstream = oneWay ? ImpairmentOptions() : impairment;
+    RelayState state(queueDatagrams, bufferSize, impairment, downstream, seed, NowNs());
+    state.tuning.bufferBytes = socketBuffer;
+    state.idleTimeoutNs = static_cast<uint64_t>(idleSeconds) * 1000000000;
+    try
+    {
+        rlim_t fileLimit = RaiseFileLimit();
+        ResolveServer(state, serverName, serverPort);
+        state.listenFD = OpenListener(listenPort);
+        TuneSocket(state.listenFD, state.tuning);
+        if (state.tuning.Active())
+        {
+            PrintSocketBuffers(std::cout, state.listenFD, state.tuning);
+        }
+        state.epollFD = epoll_create1(0);
+        if (state.epollFD == -1)
+        {
+            std::runtime_error ex(std::string("Unable to create epoll instance: ") + strerror(errno));
+            throw ex;
+        }
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = LISTENER_TAG;
+        if (epoll_ctl(state.epollFD, EPOLL_CTL_ADD, state.listenFD, &event) == -1)
+        {
+            std::runtime_error ex(std::string("Unable to watch the listening socket: ") + strerror(errno));
+            throw ex;
+        }
+
+        std::cout << "Listening on port " << BoundPort(state.listenFD) << std::endl;
+        std::cout << "Relaying to " << serverName << " port " << serverPort << ", seed " << seed
+                  << (impairment.Active() ? "" : ", no impairments") << std::endl;
+        std::cout << "Open file limit " << fileLimit << ", one descriptor per client" << std::endl;
+        RunRelay(state);
+
+        std::cout << "\n";
+        PrintDirection("Client to server", state.toServer.stats);
+        PrintDirection("Server to client", state.toClient.stats);
+        uint64_t kernelDrops = SocketDrops(state.listenFD) + state.closedKernelDrops;
+        for (const Session& session : state.sessions)
+        {
+            if (session.upstreamFD != -1)
+            {
+                kernelDrops += SocketDrops(session.upstreamFD);
+            }
+        }
+        std::cout << "Dropped by the kernel before the relay saw them (recieve queue full): " << kernelDrops << "\n"
+                  << "Clients: " << state.sessionsOpened << ", " << state.sessionsClosed << " closed when idle\n"
+                  << "Recieve syscalls: " << state.recvCalls << ", send syscalls: " << state.sendCalls << "\n";
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        retval = NETWORKING_ERROR;
+    }
+
+    for (const Session& session : state.sessions)
+    {
+        if (session.upstreamFD != -1)
+        {
+            close(session.upstreamFD);
+        }
+    }
+    if (state.epollFD >= 0)
+    {
+        close(state.epollFD);
+    }
+    if (state.listenFD >= 0)
+    {
+        close(state.listenFD);
+    }
+
+    return retval;
+}
@@ -0,0 +1,134 @@
+#pragma once
+/* UDP Blaster -- Sequence tracking
+ * Acked-bitmap keyed by sequence number, shared by the client's send/recieve loops.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+/* SequenceTracker
+ * Tracks which of a run of sequential sequence numbers, starting at base, have been sent and acknowledged. One bit
+ * per sequence number, sized once from the number of datagrams, so marking and testing are O(1) and never allocate.
+ * All state is atomic, so one thread may send while another acknowledges without a lock. Acks that arrive after a
+ * higher sequence number was already acknowledged are counted as reordered, by how far behind they were; this
+ * assumes one thread does all the acknowledging, as every loop in the client does.
+ */
+class SequenceTracker
+{
+public:
+    enum class AckResult
+    {
+        New,        // First ack for a sent sequence number
+        Duplicate,  // Sequence number was already acknowledged
+        Unknown     // Sequence number was never sent
+    };
+
+    // Reorder distances are kept in power of two buckets: 1, 2-3, 4-7 and so on
+    static const unsigned int REORDER_BUCKETS = 32;
+
+    explicit SequenceTracker(uint32_t capacity, uint32_t base = 0)
+        : capacity(capacity), base(base), wordCount((static_cast<size_t>(capacity) + 63) / 64),
+          acked(new std::atomic<uint64_t>[wordCount])
+    {
+        for (size_t i = 0; i < wordCount; i++)
+        {
+            acked[i].store(0, std::memory_order_relaxed);
+        }
+        for (unsigned int i = 0; i < REORDER_BUCKETS; i++)
+        {
+            reorders[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /* MarkSent
+     * Records that every sequence number up to and including this one has been (or is about to be) sent. Sequence
+     * numbers are expected to be sent in order.
+     */
+    void MarkSent(uint32_t sequence)
+    {
+        sent.store(sequence - base + 1, std::memory_order_release);
+    }
+
+    /* MarkAcked
+     * Sets the acked bit for a sequence number and reports whether the ack was new, a duplicate, or for something
+     * that was never sent.
+     */
+    AckResult MarkAcked(uint32_t sequence)
+    {
+        // Anything below base wraps around to a huge offset, so one comparison rejects both sides of the window
+        sequence -= base;
+        if (sequence >= sent.load(std::memory_order_acquire))
+        {
+            unknown.fetch_add(1, std::memory_order_relaxed);
+            return AckResult::Unknown;
+        }
+
+        const uint64_t bit = uint64_t(1) << (sequence % 64);
+        if (acked[sequence / 64].fetch_or(bit, std::memory_order_relaxed) & bit)
+        {
+            duplicates.fetch_add(1, std::memory_order_relaxed);
+            return AckResult::Duplicate;
+        }
+
+        // highestAcked is one past the highest acked offset, so 0 means nothing has been acked yet
+        uint32_t highest = highestAcked.load(std::memory_order_relaxed);
+        if (sequence >= highest)
+        {
+            highestAcked.store(sequence + 1, std::memory_order_relaxed);
+        }
+        else
+        {
+            reorders[31 - __builtin_clz(highest - 1 - sequence)].fetch_add(1, std::memory_order_relaxed);
+        }
+        return AckResult::New;
+    }
+
+    /* AckedWord
+     * Raw acked bits for sequence numbers base + 64 * index onwards, lowest bit first.
+     */
+    uint64_t AckedWord(size_t index) const { return acked[index].load(std::memory_order_relaxed); }
+    size_t WordCount() const { return wordCount; }
+
+    /* Reorders
+     * Number of acks that arrived late by a distance in [2^bucket, 2^(bucket + 1)).
+     */
+    uint32_t Reorders(unsigned int bucket) const { return reorders[bucket].load(std::memory_order_relaxed); }
+
+    bool IsAcked(uint32_t sequence) const
+    {
+        sequence -= base;
+        return (acked[sequence / 64].load(std::memory_order_relaxed) >> (sequence % 64)) & 1;
+    }
+
+    /* Acknowledged
+     * Counts the acked bits with one popcount per 64 sequence numbers.
+     */
+    uint32_t Acknowledged() const
+    {
+        uint32_t count = 0;
+        for (size_t i = 0; i < wordCount; i++)
+        {
+            count += __builtin_popcountll(acked[i].load(std::memory_order_relaxed));
+        }
+        return count;
+    }
+
+    uint32_t Unacknowledged() const { return Sent() - Acknowledged(); }
+    uint32_t Sent() const { return sent.load(std::memory_order_acquire); }
+    uint32_t Capacity() const { return capacity; }
+    uint32_t Base() const { return base; }
+    uint32_t Duplicates() const { return duplicates.load(std::memory_order_relaxed); }
+    uint32_t Unknown() const { return unknown.load(std::memory_order_relaxed); }
+
+private:
+    uint32_t capacity;
+    uint32_t base;
+    size_t wordCount;
+    std::unique_ptr<std::atomic<uint64_t>[]> acked;
+    std::atomic<uint32_t> sent{0};
+    std::atomic<uint32_t> duplicates{0};
+    std::atomic<uint32_t> unknown{0};
+    std::atomic<uint32_t> highestAcked{0};
+    std::atomic<uint32_t> reorders[REORDER_BUCKETS];
+};
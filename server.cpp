@@ -9,6 +9,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdexcept>
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <memory>
 
 // System libraries
 #ifdef	 __linux__
@@ -19,30 +25,496 @@
 #include <memory.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <assert.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <time.h>
 
 // Local includes
 #include "defaults.hpp"
 #include "structure.hpp"
+#include "payload.hpp"
+#include "uring_engine.hpp"
+#include "flow_table.hpp"
+#include "timestamping.hpp"
+#include "loop_policy.hpp"
+#include "perf_counters.hpp"
+#include "metrics.hpp"
+#include "socket_tuning.hpp"
+#include "transport.hpp"
+#include "capture.hpp"
+#include "options.hpp"
 
 // Constants for errors
 const int32_t UNKNOWN_ARGUMENT = 1;
 const int32_t SETUP_ERROR = 2;
 const int32_t NETWORKING_ERROR = 3; // to match with the client
 
+// The kernel caps recvmmsg/sendmmsg at this many messages per call (UIO_MAXIOV)
+const unsigned int MAX_BATCH_SIZE = 1024;
+// Batch the epoll loop drains with when -b is not given
+const unsigned int DEFAULT_EPOLL_BATCH = 64;
+// Size of the capture file -r preallocates when -R is not given
+const uint64_t DEFAULT_CAPTURE_MIB = 256;
+// Largest -R, small enough that its size in bytes still fits in an off_t for posix_fallocate and mmap
+const uint64_t MAX_CAPTURE_MIB = uint64_t(1) << 40;
+// Most -t workers, each of which gets its own socket and thread
+const unsigned int MAX_WORKERS = 1024;
+// Longest -A hold, a second
+const unsigned int MAX_ACK_HOLD_MICROS = 1000000;
+// Longest -i report interval and -x idle timeout, a week
+const unsigned int MAX_FLOW_SECONDS = 7 * 24 * 3600;
+
+// io_uring loop sizing: submission queue depth, provided buffers (a power of two) and their group ID
+const unsigned int URING_DEPTH = 256;
+const unsigned int URING_BUFFERS = 256;
+const uint16_t URING_BUFFER_GROUP = 0;
+// user_data of the multishot recieve, sends carry their buffer ID which is always below this
+const uint64_t URING_RECV_TAG = uint64_t(1) << 32;
+// Worker threads have the stop signals blocked and shutdown() does not end a multishot recieve, so waits are capped
+const int64_t URING_WAIT_NS = 100000000;
+
+// Kernel limit on datagrams per UDP_SEGMENT send, replies to a coalesced burst go out in runs of at most this many
+const unsigned int MAX_GSO_SEGMENTS = 64;
+
+// Set from the signal handler to ask the recieve loops to wind down
+std::atomic<bool> stopRequested(false);
+
+class AckAggregator;
+struct LoopConfig;
+
+/* ServerStats
+ * Counters kept by a recieve loop and printed when the server shuts down. Only the loop itself bumps them, but they
+ * are Counters so the metrics reporter can read them while it runs; the padding keeps the stats of workers that sit
+ * next to each other off each other's cache lines.
+ */
+struct ServerStats
+{
+    char leadingPad[64];
+    Counter received;   // Datagrams recieved
+    Counter replied;    // Replies handed to the kernel
+    Counter errors;     // Failed or malformed recieves/sends
+    Counter recvCalls;  // Syscalls made to recieve
+    Counter sendCalls;  // Syscalls made to reply
+    Counter truncated;  // Datagrams larger than the recieve buffer
+    Counter corrupt;    // Datagrams whose payload failed pattern verification
+    Counter bytes;      // Datagram bytes recieved, as sent (not as truncated)
+    Counter aggregated; // Acks carried by aggregated replies
+    Counter eagain;     // Recieves that timed out or found the socket empty
+    uint64_t kernelDrops = 0;   // Datagrams the kernel dropped with the socket's recieve queue full, read at the end
+    ErrnoCounts errnos; // Failed syscalls by errno, a subset of errors
+    uint64_t instructions = 0;   // User space instructions retired in the recieve loops (-I)
+    uint64_t cycles = 0;         // Cycles spent in them, or TSC ticks without hardware counters
+    bool cyclesFromTsc = false;
+    FlowTable* flows = nullptr;      // Per-client table for this loop, owned by whoever starts the loop (not merged)
+    AckAggregator* acks = nullptr;   // Ack coalescing for this loop, owned the same way
+    CaptureWriter* capture = nullptr;   // Trace every datagram is recorded to (-r), owned the same way
+    char trailingPad[64];
+
+    /* Failed
+     * Counts datagrams lost to a failed syscall under its errno.
+     */
+    void Failed(int error, uint64_t datagrams = 1)
+    {
+        errors += datagrams;
+        errnos.Record(error, datagrams);
+    }
+
+    void Merge(const ServerStats& other)
+    {
+        received += other.received;
+        replied += other.replied;
+        errors += other.errors;
+        recvCalls += other.recvCalls;
+        sendCalls += other.sendCalls;
+        truncated += other.truncated;
+        corrupt += other.corrupt;
+        bytes += other.bytes;
+        aggregated += other.aggregated;
+        eagain += other.eagain;
+        kernelDrops += other.kernelDrops;
+        for (int i = 0; i < ErrnoCounts::SLOTS; i++)
+        {
+            errnos.counts[i] += other.errnos.counts[i];
+        }
+        instructions += other.instructions;
+        cycles += other.cycles;
+        cyclesFromTsc = cyclesFromTsc || other.cyclesFromTsc;
+    }
+};
+
+/* PlainLoop
+ * One specialization of RecieveAndRespond, picked once in main.
+ */
+using PlainLoop = void (*)(int, const LoopConfig&, ServerStats&);
+
+/* LoopConfig
+ * Settings shared by every recieve loop.
+ */
+struct LoopConfig
+{
+    unsigned int batchSize = 0;               // Datagrams per recvmmsg/sendmmsg call, 0 for the unbatched loop
+    size_t bufferSize = MAX_RECIEVE_BUFFER;   // Recieve buffer per datagram, anything longer is truncated
+    bool verifyPayload = false;               // Check payloads against the client's fill pattern
+    bool useUring = false;                    // Use the io_uring loop, falling back to the others if unavailable
+    bool useGro = false;                      // Let the kernel coalesce bursts from a client (UDP_GRO)
+    bool timestamps = false;                  // Stamp recieves in the kernel and report turnaround in each reply
+    bool countInstructions = false;           // Count instructions and cycles spent in the recieve loops
+    PlainLoop plainLoop = nullptr;            // Build of the plain loop to run, set in main
+    size_t flowCapacity = 0;                  // Slots in each loop's per-client flow table, 0 for no table
+    unsigned int flowIdleSeconds = 30;        // Forget clients that have been quiet this long, 0 to never
+    unsigned int flowReportSeconds = 0;       // Print the busiest clients this often, 0 for only on exit
+    size_t flowTopCount = 10;                 // Clients shown per flow report
+    unsigned int ackBatch = 0;                // Most acks per aggregated reply, 0 for one reply per datagram
+    unsigned int ackHoldMicros = 1000;        // Longest an ack waits to be aggregated
+    MetricsOptions metrics;                   // Live counter reports while the loops run (-c/-o)
+    SocketTuning tuning;                      // Busy polling, socket buffers and CPU pinning (-Z/-W/-C)
+};
+
+/* InspectDatagram
+ * Accounts for the size of a recieved datagram against the totals and the client's flow table entry, records it to
+ * the capture trace if there is one, flags truncation, and optionally checks its payload against the fill pattern the
+ * client uses for sized payloads.
+ * Parameters:
+ *   const sockaddr*   client    -- Address the datagram came from
+ *   const uint8_t*    datagram  -- Start of the recieved datagram
+ *   size_t            length    -- Real length of the datagram as sent
+ *   bool              truncated -- The datagram did not fit in the recieve buffer
+ *   const LoopConfig& config    -- Loop settings
+ *   ServerStats&      stats     -- Counters to update
+ * Returns:
+ *   Nothing.
+ */
+void InspectDatagram(const sockaddr* client, const uint8_t* datagram, size_t length, bool truncated,
+                     const LoopConfig& config, ServerStats& stats)
+{
+    stats.bytes += length;
+    if (stats.flows != nullptr && length >= sizeof(ClientDatagram))
+    {
+        const ClientDatagram* header = reinterpret_cast<const ClientDatagram*>(datagram);
+        stats.flows->Record(client, ntohl(header->sequence_number), length, FlowTable::CoarseNowNs());
+    }
+    if (stats.capture != nullptr)
+    {
+        stats.capture->Record(client, datagram, length, std::min(length, config.bufferSize));
+    }
+
+    if (truncated)
+    {
+        stats.truncated++;
+        return;
+    }
+
+    if (config.verifyPayload && length >= sizeof(ClientDatagram))
+    {
+        const ClientDatagram* header = reinterpret_cast<const ClientDatagram*>(datagram);
+        size_t payloadLength = length - sizeof(ClientDatagram);
+        if (ntohs(header->payload_length) != payloadLength ||
+            !CheckPattern(datagram + sizeof(ClientDatagram), payloadLength))
+        {
+            stats.corrupt++;
+        }
+    }
+}
+
+/* NowNs
+ * Monotonic timestamp in nanoseconds, used to age pending aggregated acks.
+ */
+inline uint64_t NowNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/* AckAggregator
+ * Coalesces acks per client into AggregateAck replies. Pending acks live in a fixed, direct-mapped table indexed by
+ * the client's address hash. A client's pending reply goes out when:
+ *   - its window fills up,
+ *   - it holds maxCount acks,
+ *   - a datagram falls outside its window or has a different length,
+ *   - another client maps to the same slot, or
+ *   - it has waited longer than the hold time.
+ * Everything is allocated up front, so recording an ack never allocates.
+ */
+class AckAggregator
+{
+public:
+    static const size_t SLOTS = 1024;
+
+    /* Parameters:
+     *   unsigned int maxCount -- Most acks to hold for one client before replying, up to AGGREGATE_ACK_WINDOW
+     *   uint64_t     holdNs   -- Longest an ack may wait for company
+     */
+    AckAggregator(unsigned int maxCount, uint64_t holdNs)
+        : maxCount(maxCount), holdNs(holdNs), slots(SLOTS)
+    {
+        active.reserve(SLOTS);
+    }
+
+    /* Add
+     * Records the ack for one datagram, replying first if the client's pending ack cannot take it.
+     */
+    void Add(int socketFD, const sockaddr* client, socklen_t clientLength, uint32_t sequence, uint16_t datagramLength,
+             uint64_t now, ServerStats& stats)
+    {
+        FlowKey key = MakeFlowKey(client);
+        size_t index = HashFlowKey(key) & (SLOTS - 1);
+        Pending& slot = slots[index];
+
+        if (slot.count > 0)
+        {
+            uint32_t offset = sequence - slot.base;
+            if (!(slot.key == key) || slot.socketFD != socketFD || offset >= AGGREGATE_ACK_WINDOW ||
+                datagramLength != slot.datagramLength)
+            {
+                Flush(index, stats);
+            }
+        }
+
+        if (slot.count == 0)
+        {
+            slot.key = key;
+            memcpy(&slot.client, client, clientLength);
+            slot.clientLength = clientLength;
+            slot.socketFD = socketFD;
+            slot.base = sequence;
+            slot.datagramLength = datagramLength;
+            slot.started = now;
+            memset(slot.bitmap, 0, sizeof(slot.bitmap));
+            slot.activeIndex = active.size();
+            active.push_back(index);
+        }
+
+        uint32_t offset = sequence - slot.base;
+        uint8_t bit = 1 << (offset % 8);
+        if (!(slot.bitmap[offset / 8] & bit))
+        {
+            slot.bitmap[offset / 8] |= bit;
+            slot.count++;
+        }
+        if (slot.count >= maxCount)
+        {
+            Flush(index, stats);
+        }
+    }
+
+    /* FlushExpired
+     * Replies for every client whose oldest pending ack has waited at least the hold time.
+     */
+    void FlushExpired(uint64_t now, ServerStats& stats)
+    {
+        for (size_t i = 0; i < active.size();)
+        {
+            // Flushing swaps the last active slot into position i, so only move on when nothing was removed
+            if (now - slots[active[i]].started >= holdNs)
+            {
+                Flush(active[i], stats);
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    /* FlushAll
+     * Replies for every client with acks pending, used when the loop stops.
+     */
+    void FlushAll(ServerStats& stats)
+    {
+        while (!active.empty())
+        {
+            Flush(active.back(), stats);
+        }
+    }
+
+private:
+    struct Pending
+    {
+        FlowKey key;
+        sockaddr_storage client;
+        socklen_t clientLength = 0;
+        int socketFD = -1;
+        uint32_t base = 0;
+        uint16_t datagramLength = 0;
+        uint32_t count = 0;
+        uint64_t started = 0;
+        size_t activeIndex = 0;  // Position in the active list
+        uint8_t bitmap[AGGREGATE_ACK_WINDOW / 8];
+    };
+
+    void Flush(size_t index, ServerStats& stats)
+    {
+        Pending& slot = slots[index];
+
+        AggregateAck reply;
+        reply.base_sequence = htonl(slot.base);
+        reply.datagram_length = htons(slot.datagramLength);
+        reply.ack_count = htons(slot.count);
+        memcpy(reply.bitmap, slot.bitmap, sizeof(reply.bitmap));
+
+        stats.sendCalls++;
+        if (sendto(slot.socketFD, &reply, sizeof(reply), 0, reinterpret_cast<sockaddr*>(&slot.client),
+                   slot.clientLength) == -1)
+        {
+            stats.Failed(errno);
+        }
+        else
+        {
+            stats.replied++;
+            stats.aggregated += slot.count;
+        }
+        slot.count = 0;
+
+        // Swap the last active slot into this one's place in the list
+        size_t moved = active.back();
+        active[slot.activeIndex] = moved;
+        slots[moved].activeIndex = slot.activeIndex;
+        active.pop_back();
+    }
+
+    unsigned int maxCount;
+    uint64_t holdNs;
+    std::vector<Pending> slots;
+    std::vector<size_t> active;  // Slots with acks pending, in no particular order
+};
+
+/* HandleStopSignal
+ * SIGINT/SIGTERM handler. Only flags the request, the loops notice it once their recieve call is interrupted.
+ */
+void HandleStopSignal(int)
+{
+    stopRequested.store(true);
+}
+
+/* OpenBoundSocket
+ * Creates a socket for one resolved address and binds it.
+ * Parameters:
+ *   const addrinfo* address   -- Address to bind to
+ *   bool            reusePort -- Set SO_REUSEPORT so several sockets can share the port
+ *   bool            v6Only    -- Keep an IPv6 socket off IPv4, so an IPv4 socket can bind the same port alongside it
+ *   bool            debug     -- Enable debug messages
+ * Returns:
+ *   The bound socket, or -1 if any step failed.
+ */
+int OpenBoundSocket(const addrinfo* address, bool reusePort, bool v6Only, bool debug)
+{
+    // Attempt to create socket
+    int socketFD = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (socketFD == -1)
+    {
+        // Explain why the socket creation failed (if debugging is enabled)
+        if (debug)
+        {
+            perror("Error creating socket");
+        }
+        return -1;
+    }
+
+    // SO_REUSEPORT has to be in place before bind for the kernel to spread flows across the sockets
+    int enable = 1;
+    if (reusePort && setsockopt(socketFD, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
+    {
+        if (debug)
+        {
+            perror("Error setting SO_REUSEPORT");
+        }
+        close(socketFD);
+        return -1;
+    }
+
+    if (v6Only && address->ai_family == AF_INET6 &&
+        setsockopt(socketFD, IPPROTO_IPV6, IPV6_V6ONLY, &enable, sizeof(enable)) == -1)
+    {
+        if (debug)
+        {
+            perror("Error setting IPV6_V6ONLY");
+        }
+        close(socketFD);
+        return -1;
+    }
+
+    // Attempt to bind to to the socket
+    if (bind(socketFD, address->ai_addr, address->ai_addrlen) == -1)
+    {
+        // Explain why the bind attempt failed (if debugging is enabled)
+        if (debug)
+        {
+            perror("Error binding");
+        }
+        close(socketFD);
+        return -1;
+    }
+
+    return socketFD;
+}
+
+/* DescribeAddress
+ * Formats a socket's local address as host:port for display.
+ * Parameters:
+ *   int socketFD -- Bound socket
+ * Returns:
+ *   The formatted address, or "unknown" if it cannot be read.
+ */
+std::string DescribeAddress(int socketFD)
+{
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    char host[NI_MAXHOST];
+    char service[NI_MAXSERV];
+    if (getsockname(socketFD, reinterpret_cast<sockaddr*>(&address), &length) == -1 ||
+        getnameinfo(reinterpret_cast<sockaddr*>(&address), length, host, sizeof(host), service, sizeof(service),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+    {
+        return "unknown";
+    }
+
+    if (address.ss_family == AF_INET6)
+    {
+        return std::string("[") + host + "]:" + service;
+    }
+    return std::string(host) + ":" + service;
+}
+
+/* BoundPort
+ * Reads back the port a socket is bound to, which is how the port the kernel picked for port 0 is found.
+ * Parameters:
+ *   int socketFD -- Bound socket
+ * Returns:
+ *   The port, or 0 if it cannot be read.
+ */
+uint16_t BoundPort(int socketFD)
+{
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (getsockname(socketFD, reinterpret_cast<sockaddr*>(&address), &length) == -1)
+    {
+        return 0;
+    }
+    return ntohs(address.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&address)->sin6_port
+                                               : reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+}
+
 /* EstablishConnection
  * Responsible for opening the server the socket will be bound to.
  * Parameters:
- *   uint16_t port  -- Port to bind to
- *   bool     debug -- Enable debug messages
+ *   uint16_t port      -- Port to bind to
+ *   bool     reusePort -- Set SO_REUSEPORT so several sockets can share the port
+ *   bool     debug     -- Enable debug messages
  * Returns:
  *   An integer for the opened socket file descriptor.
  * Exceptions:
  *   Will throw an exception if there is an issue opening the socket and binding to it.
  */
-int EstablishConnection(uint16_t port, bool debug)
+int EstablishConnection(uint16_t port, bool reusePort, bool debug)
 {
     if (debug)
     {
@@ -83,30 +555,9 @@ int EstablishConnection(uint16_t port, bool debug)
     int socketFD = -1;
     for (addrinfo* currentAddress = serverInfo; currentAddress != nullptr; currentAddress = currentAddress->ai_next)
     {
-        // Attempt to create socket
-        if ((socketFD = socket(currentAddress->ai_family, currentAddress->ai_socktype, currentAddress->ai_protocol)) == -1)
-        {
-            /* Explain why the socket creation failed (if debugging is enabled).
-             * This is not fatal since we have multiple addrinfo's to go through
-             */
-            if (debug)
-            {
-                perror("Error creating socket");
-            }
-            continue;
-        }
-
-        // Attempt to bind to to the socket
-        if (bind(socketFD, currentAddress->ai_addr, currentAddress->ai_addrlen) == -1)
+        // Failing on one address is not fatal since we have multiple addrinfo's to go through
+        if ((socketFD = OpenBoundSocket(currentAddress, reusePort, false, debug)) == -1)
         {
-            /* Explain why the connection attempt failed (if debuggign is enabled).
-             * This is not fatal since we have multiple addrinfo's to go through
-             */
-            if (debug)
-            {
-                perror("Error connecting");
-            }
-            close(socketFD);
             continue;
         }
 
@@ -130,7 +581,7 @@ int EstablishConnection(uint16_t port, bool debug)
     freeaddrinfo(serverInfo);
 
     // Check to see if our socket is actually open
-    if (socketFD == 0)
+    if (socketFD == -1)
     {
         std::runtime_error ex("Unable to open socket");
         throw ex;
@@ -144,106 +595,1606 @@ int EstablishConnection(uint16_t port, bool debug)
     return socketFD;
 }
 
+/* EstablishListeners
+ * Opens a nonblocking socket for every address getaddrinfo returns on every requested port, so one process can
+ * serve IPv4 and IPv6 and several ports at once. IPv6 sockets are kept IPv6-only so their IPv4 twins can bind.
+ * Parameters:
+ *   const std::vector<uint16_t>& ports -- Ports to bind
+ *   bool                         debug -- Enable debug messages
+ * Returns:
+ *   The opened sockets.
+ * Exceptions:
+ *   Will throw an exception if an address lookup fails or if no socket at all could be bound.
+ */
+std::vector<int> EstablishListeners(const std::vector<uint16_t>& ports, bool debug)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    std::vector<int> sockets;
+    for (uint16_t port : ports)
+    {
+        addrinfo* serverInfo;
+        int rv = getaddrinfo(0, std::to_string(port).c_str(), &hints, &serverInfo);
+        if (rv != 0)
+        {
+            for (int socketFD : sockets)
+            {
+                close(socketFD);
+            }
+            std::runtime_error ex(gai_strerror(rv));
+            throw ex;
+        }
+
+        for (addrinfo* currentAddress = serverInfo; currentAddress != nullptr; currentAddress = currentAddress->ai_next)
+        {
+            int socketFD = OpenBoundSocket(currentAddress, false, true, debug);
+            if (socketFD == -1)
+            {
+                continue;
+            }
+
+            if (fcntl(socketFD, F_SETFL, O_NONBLOCK) == -1)
+            {
+                if (debug)
+                {
+                    perror("Error setting nonblocking IO");
+                }
+                close(socketFD);
+                continue;
+            }
+
+            std::cout << "Listening on " << DescribeAddress(socketFD) << "\n";
+            sockets.push_back(socketFD);
+        }
+
+        freeaddrinfo(serverInfo);
+    }
+
+    if (sockets.empty())
+    {
+        std::runtime_error ex("Unable to open any socket");
+        throw ex;
+    }
+
+    return sockets;
+}
+
+/* ReportRecieveError
+ * Explains a failed recieve, or a zero-byte one. Kept out of line and marked cold, so none of the plain loop's
+ * specializations carries formatting code for it.
+ */
+__attribute__((noinline, cold)) void ReportRecieveError(int recvBytes)
+{
+    if (recvBytes == -1)
+    {
+        perror("recvfrom error");
+        return;
+    }
+    std::cerr << "Server either recieved a zero-byte datagram or the remote connection is \"closed\"\n";
+}
+
 /* RecieveAndRespond
- * Main loop which recieves a packet from a client and responds to it.
+ * Main loop which recieves a packet from a client and responds to it. Specialized on a loop policy
+ * (loop_policy.hpp): the quiet policy skips inspecting datagrams and stamping recieves, and only the debug policy
+ * has any logging compiled in.
  * Parameters:
- *   int socketFD -- Socket to recieve and send on
- *   bool debug   -- Enable debug messages
+ *   int               socketFD -- Socket to recieve and send on
+ *   const LoopConfig& config   -- Loop settings
+ *   ServerStats&      stats    -- Counters to update
  * Returns:
- *   Nothing. During normal operation, this function should be an infinite loop.
+ *   Nothing. During normal operation, this function loops until SIGINT/SIGTERM is recieved.
  * Exceptions:
  *   Will thow an exception from any standard library functions.
  */
-void RecieveAndRespond(int socketFD, bool debug)
+template <typename Policy>
+void RecieveAndRespond(int socketFD, const LoopConfig& config, ServerStats& stats)
 {
-    if (debug)
+    if (Policy::LOG)
     {
         std::cout << "Entering RecieveAndRespond loop...\n";
     }
 
-    constexpr size_t BUFFER_SIZE = 1024;
-    int8_t buffer[BUFFER_SIZE];
+    // Sized for the largest UDP datagram, so it lives on the heap rather than the stack
+    std::vector<uint8_t> buffer(std::max(config.bufferSize, sizeof(ClientDatagram)));
     sockaddr_storage clientAddr;
     socklen_t l = sizeof(sockaddr_storage);
     ServerDatagram response;
+    TimedServerDatagram timedResponse;
+    KernelTimestamps recvStamps;
+    const bool timestamps = Policy::STATS && config.timestamps;
+    if (timestamps)
+    {
+        EnableTimestamping(socketFD, false);
+    }
 
-    while (true)
+    while (!stopRequested.load())
     {
-        memset(&buffer, 0, BUFFER_SIZE);
+        // Only the header needs clearing, so a short datagram still reads as zeros. The payload is never trusted
+        // past the recieved length.
+        memset(buffer.data(), 0, sizeof(ClientDatagram));
         memset(&clientAddr, 0, sizeof(sockaddr_storage));
         memset(&response, 0, sizeof(ServerDatagram));
 
-        int recvBytes = recvfrom(socketFD, buffer, BUFFER_SIZE, 0, reinterpret_cast<sockaddr*>(&clientAddr), &l);
+        // MSG_TRUNC makes recvfrom return the real length even when the datagram did not fit
+        int recvBytes;
+        if (timestamps)
+        {
+            l = sizeof(sockaddr_storage);
+            recvBytes = RecieveTimestamped(socketFD, buffer.data(), buffer.size(), MSG_TRUNC,
+                                           reinterpret_cast<sockaddr*>(&clientAddr), &l, recvStamps);
+        }
+        else
+        {
+            recvBytes = recvfrom(socketFD, buffer.data(), buffer.size(), MSG_TRUNC,
+                                 reinterpret_cast<sockaddr*>(&clientAddr), &l);
+        }
+        stats.recvCalls++;
+        if (stats.acks != nullptr)
+        {
+            stats.acks->FlushExpired(NowNs(), stats);
+        }
         if (recvBytes == -1)
         {
-            perror("recvfrom error");
+            // EAGAIN is the recieve timeout set so aggregated acks are not held forever
+            if (errno == EAGAIN)
+            {
+                stats.eagain++;
+            }
+            else if (errno != EINTR)
+            {
+                ReportRecieveError(recvBytes);
+                stats.Failed(errno);
+            }
             continue;
         }
         else if (recvBytes == 0)
         {
-            std::cerr << "Server either recieved a zero-byte datagram or the remote connection is \"closed\"\n";
+            // A socket shut down to stop its worker also reads as zero bytes
+            if (stopRequested.load())
+            {
+                continue;
+            }
+            ReportRecieveError(recvBytes);
+            stats.errors++;
             continue;
         }
+        stats.received++;
+        if (Policy::STATS)
+        {
+            InspectDatagram(reinterpret_cast<sockaddr*>(&clientAddr), buffer.data(), recvBytes,
+                            static_cast<size_t>(recvBytes) > buffer.size(), config, stats);
+        }
 
-        ClientDatagram* data = reinterpret_cast<ClientDatagram*>(&buffer);
+        ClientDatagram* data = reinterpret_cast<ClientDatagram*>(buffer.data());
         data->sequence_number = ntohl(data->sequence_number);
         data->payload_length = ntohs(data->payload_length);
 
-        if (debug)
+        if (Policy::LOG)
         {
+            const char* payload = reinterpret_cast<const char*>(buffer.data() + sizeof(ClientDatagram));
+            size_t payloadBytes = std::min<size_t>(recvBytes, buffer.size()) - std::min<size_t>(recvBytes, sizeof(ClientDatagram));
             std::cout << "Recieved packet with sequence number " << data->sequence_number << ", payload length "
-                      << data->payload_length << ", payload: " << (&buffer + sizeof(ClientDatagram))
+                      << data->payload_length << ", payload: " << std::string(payload, strnlen(payload, payloadBytes))
                       << "\n";
         }
 
+        if (stats.acks != nullptr)
+        {
+            stats.acks->Add(socketFD, reinterpret_cast<sockaddr*>(&clientAddr), l, data->sequence_number, recvBytes,
+                            NowNs(), stats);
+            continue;
+        }
+
         response.sequence_number = htonl(data->sequence_number);
         response.datagram_length = htons(recvBytes);
 
-        if (debug)
+        if (Policy::LOG)
         {
             std::cout << "Ready to reply with sequence number " << response.sequence_number << " and recieved length "
                       << response.datagram_length << "\n";
         }
 
-        sendto(socketFD, reinterpret_cast<void*>(&response), sizeof(response), 0, reinterpret_cast<sockaddr*>(&clientAddr), l);
+        void* reply = &response;
+        size_t replyLength = sizeof(response);
+        if (timestamps)
+        {
+            // Software stamps share CLOCK_REALTIME with user space, so the time spent in the server is a subtraction
+            timedResponse.sequence_number = response.sequence_number;
+            timedResponse.datagram_length = response.datagram_length;
+            timedResponse.reserved = 0;
+            uint64_t now = RealtimeNs();
+            uint64_t turnaround = recvStamps.software > 0 && now > recvStamps.software ? now - recvStamps.software : 0;
+            timedResponse.turnaround_ns = htonl(static_cast<uint32_t>(std::min<uint64_t>(turnaround, UINT32_MAX)));
+            reply = &timedResponse;
+            replyLength = sizeof(timedResponse);
+        }
 
+        stats.sendCalls++;
+        if (sendto(socketFD, reply, replyLength, 0, reinterpret_cast<sockaddr*>(&clientAddr), l) == -1)
+        {
+            stats.Failed(errno);
+        }
+        else
+        {
+            stats.replied++;
+        }
     }
 
-    if (debug)
+    if (Policy::LOG)
     {
-        std::cerr << "How'd you exit the recieve and reply loop?\n";
+        std::cout << "Stop requested, leaving the recieve and reply loop\n";
     }
-
-
 }
 
-int main(int argc, char* argv[])
+/* DatagramBatch
+ * Preallocated buffers, address slots and reply structs for handling up to batchSize datagrams with one recvmmsg
+ * and one sendmmsg call. Everything is allocated in the constructor; recieving and replying never touch the heap.
+ */
+class DatagramBatch
 {
-    int retval = 0;
-    uint16_t port = PORT_NUMBER;
-    bool debug = false;
-    bool earlyStop = false;
-
-    try
+public:
+    DatagramBatch(unsigned int batchSize, size_t bufferSize)
+        : batchSize(batchSize), buffers(batchSize * bufferSize), clientAddrs(batchSize), recvIOVs(batchSize),
+          recvMsgs(batchSize), responses(batchSize), sendIOVs(batchSize), sendMsgs(batchSize)
     {
-        char c;
-        while ((c = getopt(argc, argv, "dhp:")) != -1)
+        memset(recvMsgs.data(), 0, batchSize * sizeof(mmsghdr));
+        memset(sendMsgs.data(), 0, batchSize * sizeof(mmsghdr));
+        memset(responses.data(), 0, batchSize * sizeof(ServerDatagram));
+        for (unsigned int i = 0; i < batchSize; i++)
         {
-            switch (c)
-            {
-            case 'd':
-                debug = true;
-                break;
+            recvIOVs[i].iov_base = &buffers[i * bufferSize];
+            recvIOVs[i].iov_len = bufferSize;
+            recvMsgs[i].msg_hdr.msg_name = &clientAddrs[i];
+            recvMsgs[i].msg_hdr.msg_iov = &recvIOVs[i];
+            recvMsgs[i].msg_hdr.msg_iovlen = 1;
 
-            case 'h':
-                std::cout << argv[0] << " (UDP Blaster Server) options: \n"
-                          << "-d        Enable debug messages\n"
-                          << "-h        Display this help and exit\n"
-                          << "-p [port] Bind to the provided port (default 39390)\n";
+            sendIOVs[i].iov_base = &responses[i];
+            sendIOVs[i].iov_len = sizeof(ServerDatagram);
+            sendMsgs[i].msg_hdr.msg_iov = &sendIOVs[i];
+            sendMsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    /* Recieve
+     * Fills the batch with one recvmmsg call. MSG_TRUNC is always added so each datagram's real length is reported
+     * even if it did not fit its slot.
+     * Returns:
+     *   The number of datagrams recieved, or -1 with errno set.
+     */
+    int Recieve(int socketFD, int flags, ServerStats& stats)
+    {
+        // The kernel overwrites the address lengths, so they need to be reset before every call
+        for (unsigned int i = 0; i < batchSize; i++)
+        {
+            recvMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        }
+
+        int count = recvmmsg(socketFD, recvMsgs.data(), batchSize, flags | MSG_TRUNC, nullptr);
+        stats.recvCalls++;
+        if (count > 0)
+        {
+            stats.received += count;
+        }
+        return count;
+    }
+
+    /* Respond
+     * Builds a reply in place for each of the first count datagrams and flushes them with sendmmsg. Sequence numbers
+     * are echoed without a round trip through host order. With ack aggregation on, the acks go to the aggregator
+     * instead.
+     */
+    void Respond(int socketFD, int count, const LoopConfig& config, ServerStats& stats, bool debug)
+    {
+        const uint64_t now = stats.acks != nullptr ? NowNs() : 0;
+        unsigned int replies = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (recvMsgs[i].msg_len < sizeof(ClientDatagram))
+            {
+                std::cerr << "Server recieved a datagram too short to hold a header (" << recvMsgs[i].msg_len
+                          << " bytes)\n";
+                stats.errors++;
+                continue;
+            }
+
+            const uint8_t* datagram = static_cast<const uint8_t*>(recvIOVs[i].iov_base);
+            InspectDatagram(reinterpret_cast<sockaddr*>(&clientAddrs[i]), datagram, recvMsgs[i].msg_len,
+                            recvMsgs[i].msg_hdr.msg_flags & MSG_TRUNC, config, stats);
+            const ClientDatagram* data = reinterpret_cast<const ClientDatagram*>(datagram);
+
+            if (debug)
+            {
+                std::cout << "Recieved packet with sequence number " << ntohl(data->sequence_number)
+                          << ", payload length " << ntohs(data->payload_length) << " in batch slot " << i << "\n";
+            }
+
+            if (stats.acks != nullptr)
+            {
+                stats.acks->Add(socketFD, reinterpret_cast<sockaddr*>(&clientAddrs[i]),
+                                recvMsgs[i].msg_hdr.msg_namelen, ntohl(data->sequence_number), recvMsgs[i].msg_len,
+                                now, stats);
+                continue;
+            }
+
+            responses[replies].sequence_number = data->sequence_number;
+            responses[replies].datagram_length = htons(recvMsgs[i].msg_len);
+            sendMsgs[replies].msg_hdr.msg_name = &clientAddrs[i];
+            sendMsgs[replies].msg_hdr.msg_namelen = recvMsgs[i].msg_hdr.msg_namelen;
+            replies++;
+        }
+
+        // sendmmsg may stop short, so keep flushing until the whole batch is out
+        unsigned int flushed = 0;
+        while (flushed < replies)
+        {
+            int sent = sendmmsg(socketFD, &sendMsgs[flushed], replies - flushed, 0);
+            stats.sendCalls++;
+            if (sent == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                stats.Failed(errno, replies - flushed);
+                perror("sendmmsg error");
+                break;
+            }
+            flushed += sent;
+        }
+        stats.replied += flushed;
+
+        if (debug)
+        {
+            std::cout << "Batch done: recieved " << count << ", replied to " << flushed << "\n";
+        }
+    }
+
+private:
+    unsigned int batchSize;
+    std::vector<uint8_t> buffers;
+    std::vector<sockaddr_storage> clientAddrs;
+    std::vector<iovec> recvIOVs;
+    std::vector<mmsghdr> recvMsgs;
+    std::vector<ServerDatagram> responses;
+    std::vector<iovec> sendIOVs;
+    std::vector<mmsghdr> sendMsgs;
+};
+
+/* RecieveAndRespondBatched
+ * Batched version of RecieveAndRespond. Pulls up to batchSize datagrams per recvmmsg call into preallocated buffers
+ * and address slots, builds every reply in place and flushes them all with one sendmmsg call.
+ * Parameters:
+ *   int               socketFD -- Socket to recieve and send on
+ *   const LoopConfig& config   -- Loop settings, batchSize is the most datagrams to handle per syscall
+ *   ServerStats&      stats    -- Counters to update
+ *   bool              debug    -- Enable debug messages
+ * Returns:
+ *   Nothing. During normal operation, this function loops until SIGINT/SIGTERM is recieved.
+ * Exceptions:
+ *   Will throw an exception if the batch buffers cannot be allocated.
+ */
+void RecieveAndRespondBatched(int socketFD, const LoopConfig& config, ServerStats& stats, bool debug)
+{
+    if (debug)
+    {
+        std::cout << "Entering RecieveAndRespondBatched loop with a batch size of " << config.batchSize << "...\n";
+    }
+
+    DatagramBatch batch(config.batchSize, config.bufferSize);
+    while (!stopRequested.load())
+    {
+        // MSG_WAITFORONE blocks for the first datagram only, then takes whatever else is already queued
+        int count = batch.Recieve(socketFD, MSG_WAITFORONE, stats);
+        if (stats.acks != nullptr)
+        {
+            stats.acks->FlushExpired(NowNs(), stats);
+        }
+        if (count == -1)
+        {
+            if (errno == EAGAIN)
+            {
+                stats.eagain++;
+            }
+            else if (errno != EINTR)
+            {
+                stats.Failed(errno);
+                perror("recvmmsg error");
+            }
+            continue;
+        }
+        else if (stopRequested.load())
+        {
+            break;
+        }
+
+        batch.Respond(socketFD, count, config, stats, debug);
+    }
+
+    if (debug)
+    {
+        std::cout << "Stop requested, leaving the batched recieve and reply loop\n";
+    }
+}
+
+/* RecieveAndRespondEpoll
+ * Serves any number of sockets (address families, ports) from one thread with an edge-triggered epoll loop. Each
+ * time a socket becomes readable it is drained completely in batches, since an edge-triggered socket will not be
+ * reported again until more data arrives.
+ * Parameters:
+ *   const std::vector<int>& sockets -- Nonblocking sockets to serve
+ *   const LoopConfig&       config  -- Loop settings, batchSize is the most datagrams per recvmmsg call
+ *   ServerStats&            stats   -- Counters to update
+ *   bool                    debug   -- Enable debug messages
+ * Returns:
+ *   Nothing. During normal operation, this function loops until SIGINT/SIGTERM is recieved.
+ * Exceptions:
+ *   Will throw an exception if the epoll instance cannot be set up or the batch buffers cannot be allocated.
+ */
+void RecieveAndRespondEpoll(const std::vector<int>& sockets, const LoopConfig& config, ServerStats& stats, bool debug)
+{
+    if (debug)
+    {
+        std::cout << "Entering RecieveAndRespondEpoll loop over " << sockets.size() << " sockets...\n";
+    }
+
+    int epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFD == -1)
+    {
+        std::runtime_error ex(std::string("epoll_create1: ") + strerror(errno));
+        throw ex;
+    }
+
+    for (int socketFD : sockets)
+    {
+        epoll_event interest;
+        memset(&interest, 0, sizeof(interest));
+        interest.events = EPOLLIN | EPOLLET;
+        interest.data.fd = socketFD;
+        if (epoll_ctl(epollFD, EPOLL_CTL_ADD, socketFD, &interest) == -1)
+        {
+            close(epollFD);
+            std::runtime_error ex(std::string("epoll_ctl: ") + strerror(errno));
+            throw ex;
+        }
+    }
+
+    // One batch is enough, sockets are drained one after another
+    DatagramBatch batch(config.batchSize, config.bufferSize);
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+
+    // Aggregated acks must not wait on traffic that may never come, so the wait is bounded by their hold time
+    const int waitMs = config.ackBatch > 0 ? std::max(1u, config.ackHoldMicros / 1000) : -1;
+
+    while (!stopRequested.load())
+    {
+        int ready = epoll_wait(epollFD, events, MAX_EVENTS, waitMs);
+        if (stats.acks != nullptr)
+        {
+            stats.acks->FlushExpired(NowNs(), stats);
+        }
+        if (ready == -1)
+        {
+            if (errno != EINTR)
+            {
+                stats.Failed(errno);
+                perror("epoll_wait error");
+            }
+            continue;
+        }
+
+        for (int e = 0; e < ready; e++)
+        {
+            int socketFD = events[e].data.fd;
+
+            // Drain until the socket runs dry. A short batch means the queue was empty when it was read.
+            int count;
+            do
+            {
+                count = batch.Recieve(socketFD, MSG_DONTWAIT, stats);
+                if (count > 0)
+                {
+                    batch.Respond(socketFD, count, config, stats, debug);
+                }
+            } while (count == static_cast<int>(config.batchSize) && !stopRequested.load());
+
+            if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                stats.eagain++;
+            }
+            else if (count == -1 && errno != EINTR)
+            {
+                stats.Failed(errno);
+                perror("recvmmsg error");
+            }
+        }
+    }
+
+    close(epollFD);
+
+    if (debug)
+    {
+        std::cout << "Stop requested, leaving the epoll recieve and reply loop\n";
+    }
+}
+
+/* RecieveAndRespondUring
+ * io_uring version of RecieveAndRespond. One multishot recvmsg keeps recieving into a ring of provided buffers with
+ * no further submissions, and each datagram's reply is built in place in its own buffer and sent straight from it.
+ * The replies gathered in one pass over the completion queue go out as a chain of hard linked sends, so they leave
+ * in arrival order and one failed send does not cancel the rest. A buffer goes back to the kernel once its reply has
+ * been sent. One io_uring_enter both submits the replies and waits for more datagrams. If the submission queue fills
+ * and cannot be flushed, the rest of that pass's datagrams go unanswered and their buffers straight back to the kernel.
+ * Parameters:
+ *   int               socketFD -- Socket to recieve and send on
+ *   const LoopConfig& config   -- Loop settings
+ *   ServerStats&      stats    -- Counters to update, recvCalls counts the io_uring_enter calls that wait for datagrams
+ *   bool              debug    -- Enable debug messages
+ * Returns:
+ *   Nothing. During normal operation, this function loops until SIGINT/SIGTERM is recieved.
+ * Exceptions:
+ *   Will throw an exception if the ring or its buffers cannot be set up, leaving the socket untouched.
+ */
+void RecieveAndRespondUring(int socketFD, const LoopConfig& config, ServerStats& stats, bool debug)
+{
+    if (debug)
+    {
+        std::cout << "Entering RecieveAndRespondUring loop with " << URING_BUFFERS << " provided buffers...\n";
+    }
+
+    // Each provided buffer holds the recvmsg header the kernel writes, then the client address, then the datagram
+    UringEngine ring(URING_DEPTH);
+    const size_t nameSpace = sizeof(sockaddr_storage);
+    ring.RegisterBufferRing(URING_BUFFER_GROUP, URING_BUFFERS,
+                            sizeof(io_uring_recvmsg_out) + nameSpace + config.bufferSize);
+
+    msghdr recvTemplate;
+    memset(&recvTemplate, 0, sizeof(recvTemplate));
+    recvTemplate.msg_namelen = nameSpace;
+
+    // One reply header per buffer, in use for as long as that buffer's send is in flight
+    std::vector<msghdr> sendMsgs(URING_BUFFERS);
+    std::vector<iovec> sendIOVs(URING_BUFFERS);
+
+    io_uring_sqe* lastSend = nullptr;
+    int sqeError = 0;   // Why nextSqe last came back empty handed
+    auto nextSqe = [&]() -> io_uring_sqe*
+    {
+        io_uring_sqe* sqe = ring.NextSqe();
+        if (sqe == nullptr)
+        {
+            // Queue full, close off the chain so far and hand it over before carrying on
+            if (lastSend != nullptr)
+            {
+                lastSend->flags &= ~IOSQE_IO_HARDLINK;
+                lastSend = nullptr;
+            }
+            if (ring.Submit(0) == -1)
+            {
+                // EBUSY with the completion queue backed up, say: the entries stay queued for the next submit
+                sqeError = errno;
+                return nullptr;
+            }
+            sqe = ring.NextSqe();
+            sqeError = EBUSY;
+        }
+        return sqe;
+    };
+
+    // Returns false if there was no room to arm it, in which case it is tried again on the next pass
+    auto armRecieve = [&]() -> bool
+    {
+        io_uring_sqe* sqe = nextSqe();
+        if (sqe == nullptr)
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = socketFD;
+        sqe->addr = reinterpret_cast<uint64_t>(&recvTemplate);
+        sqe->msg_flags = MSG_TRUNC;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = URING_RECV_TAG;
+        return true;
+    };
+
+    bool rearm = true;
+    while (!stopRequested.load())
+    {
+        if (rearm)
+        {
+            rearm = !armRecieve();
+        }
+        if (ring.Submit(1, URING_WAIT_NS) == -1)
+        {
+            if (errno != EINTR && errno != ETIME)
+            {
+                stats.Failed(errno);
+                perror("io_uring_enter error");
+            }
+            continue;
+        }
+        stats.recvCalls++;
+
+        bool recycled = false;
+        bool sendsHeld = false;   // No room left for sends this pass
+        io_uring_cqe* cqe;
+        while ((cqe = ring.PeekCqe()) != nullptr)
+        {
+            if (cqe->user_data != URING_RECV_TAG)
+            {
+                // A send finished, its buffer can take another datagram
+                if (cqe->res < 0)
+                {
+                    std::cerr << "io_uring send error: " << strerror(-cqe->res) << "\n";
+                    stats.Failed(-cqe->res);
+                }
+                else
+                {
+                    stats.replied++;
+                }
+                ring.RecycleBuffer(static_cast<uint16_t>(cqe->user_data));
+                recycled = true;
+                ring.SeenCqe();
+                continue;
+            }
+
+            // The multishot recieve stops (no F_MORE) when it runs out of buffers or fails, and has to be re-armed
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+            {
+                rearm = true;
+            }
+            if (cqe->res < 0)
+            {
+                if (cqe->res != -ENOBUFS && cqe->res != -EINTR)
+                {
+                    std::cerr << "io_uring recieve error: " << strerror(-cqe->res) << "\n";
+                    stats.Failed(-cqe->res);
+                }
+                ring.SeenCqe();
+                continue;
+            }
+
+            uint16_t bufferID = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uint8_t* buffer = ring.Buffer(bufferID);
+            const io_uring_recvmsg_out* header = reinterpret_cast<const io_uring_recvmsg_out*>(buffer);
+            uint8_t* datagram = buffer + sizeof(io_uring_recvmsg_out) + nameSpace;
+            stats.received++;
+            ring.SeenCqe();
+
+            if (header->payloadlen < sizeof(ClientDatagram))
+            {
+                std::cerr << "Server recieved a datagram too short to hold a header (" << header->payloadlen
+                          << " bytes)\n";
+                stats.errors++;
+                ring.RecycleBuffer(bufferID);
+                recycled = true;
+                continue;
+            }
+
+            InspectDatagram(reinterpret_cast<sockaddr*>(buffer + sizeof(io_uring_recvmsg_out)), datagram,
+                            header->payloadlen, header->flags & MSG_TRUNC, config, stats);
+            ClientDatagram* data = reinterpret_cast<ClientDatagram*>(datagram);
+            if (debug)
+            {
+                std::cout << "Recieved packet with sequence number " << ntohl(data->sequence_number)
+                          << ", payload length " << ntohs(data->payload_length) << " in buffer " << bufferID << "\n";
+            }
+
+            // The sequence number already sits where the reply wants it, only the length needs to be written
+            ServerDatagram* reply = reinterpret_cast<ServerDatagram*>(datagram);
+            reply->datagram_length = htons(header->payloadlen);
+            sendIOVs[bufferID].iov_base = reply;
+            sendIOVs[bufferID].iov_len = sizeof(ServerDatagram);
+            memset(&sendMsgs[bufferID], 0, sizeof(msghdr));
+            sendMsgs[bufferID].msg_name = buffer + sizeof(io_uring_recvmsg_out);
+            sendMsgs[bufferID].msg_namelen = std::min<socklen_t>(header->namelen, nameSpace);
+            sendMsgs[bufferID].msg_iov = &sendIOVs[bufferID];
+            sendMsgs[bufferID].msg_iovlen = 1;
+
+            io_uring_sqe* sqe = sendsHeld ? nullptr : nextSqe();
+            if (sqe == nullptr)
+            {
+                sendsHeld = true;
+                stats.Failed(sqeError);
+                ring.RecycleBuffer(bufferID);
+                recycled = true;
+                continue;
+            }
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = socketFD;
+            sqe->addr = reinterpret_cast<uint64_t>(&sendMsgs[bufferID]);
+            sqe->flags = IOSQE_IO_HARDLINK;
+            sqe->user_data = bufferID;
+            lastSend = sqe;
+        }
+
+        if (lastSend != nullptr)
+        {
+            lastSend->flags &= ~IOSQE_IO_HARDLINK;
+            lastSend = nullptr;
+        }
+        if (recycled)
+        {
+            ring.PublishBuffers();
+        }
+    }
+
+    if (debug)
+    {
+        std::cout << "Stop requested, leaving the io_uring recieve and reply loop\n";
+    }
+}
+
+/* RecieveAndRespondGRO
+ * Recieve loop with UDP generic recieve offload. The kernel may hand over a burst of same-sized datagrams from one
+ * client as a single coalesced buffer, with the segment size in a UDP_GRO control message. The buffer is split back
+ * into datagrams here, and since every reply in a burst goes to the same client they leave together as one
+ * UDP_SEGMENT send.
+ * Parameters:
+ *   int               socketFD -- Socket to recieve and send on
+ *   const LoopConfig& config   -- Loop settings
+ *   ServerStats&      stats    -- Counters to update
+ *   bool              debug    -- Enable debug messages
+ * Returns:
+ *   Nothing. During normal operation, this function loops until SIGINT/SIGTERM is recieved.
+ * Exceptions:
+ *   Will throw an exception if the kernel does not support UDP_GRO.
+ */
+void RecieveAndRespondGRO(int socketFD, const LoopConfig& config, ServerStats& stats, bool debug)
+{
+    if (debug)
+    {
+        std::cout << "Entering RecieveAndRespondGRO loop...\n";
+    }
+
+    int enable = 1;
+    if (setsockopt(socketFD, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == -1)
+    {
+        std::runtime_error ex(std::string("Unable to enable UDP_GRO: ") + strerror(errno));
+        throw ex;
+    }
+
+    // A coalesced burst is at most one maximum sized UDP datagram, so the full recieve buffer always fits it
+    std::vector<uint8_t> buffer(MAX_RECIEVE_BUFFER);
+    std::vector<ServerDatagram> responses(MAX_GSO_SEGMENTS);
+    sockaddr_storage clientAddr;
+    iovec recvIOV = {buffer.data(), buffer.size()};
+    char recvControl[CMSG_SPACE(sizeof(int))];
+    char sendControl[CMSG_SPACE(sizeof(uint16_t))];
+    msghdr message;
+
+    while (!stopRequested.load())
+    {
+        memset(&message, 0, sizeof(message));
+        message.msg_name = &clientAddr;
+        message.msg_namelen = sizeof(clientAddr);
+        message.msg_iov = &recvIOV;
+        message.msg_iovlen = 1;
+        message.msg_control = recvControl;
+        message.msg_controllen = sizeof(recvControl);
+
+        ssize_t recvBytes = recvmsg(socketFD, &message, 0);
+        stats.recvCalls++;
+        if (stats.acks != nullptr)
+        {
+            stats.acks->FlushExpired(NowNs(), stats);
+        }
+        if (recvBytes == -1)
+        {
+            // EAGAIN is the recieve timeout set so aggregated acks are not held forever
+            if (errno == EAGAIN)
+            {
+                stats.eagain++;
+            }
+            else if (errno != EINTR)
+            {
+                stats.Failed(errno);
+                perror("recvmsg error");
+            }
+            continue;
+        }
+        else if (recvBytes == 0)
+        {
+            // A socket shut down to stop its worker also reads as zero bytes
+            if (stopRequested.load())
+            {
+                continue;
+            }
+            std::cerr << "Server either recieved a zero-byte datagram or the remote connection is \"closed\"\n";
+            stats.errors++;
+            continue;
+        }
+
+        // Without the control message the kernel did not coalesce anything and this is a single datagram
+        size_t segmentSize = recvBytes;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+                int size;
+                memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                segmentSize = size > 0 ? size : recvBytes;
+            }
+        }
+
+        const sockaddr* client = reinterpret_cast<sockaddr*>(&clientAddr);
+        unsigned int pending = 0;
+        for (size_t offset = 0; offset < static_cast<size_t>(recvBytes); offset += segmentSize)
+        {
+            // Every segment is full sized except possibly the last
+            const uint8_t* datagram = buffer.data() + offset;
+            size_t length = std::min(segmentSize, recvBytes - offset);
+            stats.received++;
+            InspectDatagram(client, datagram, length, false, config, stats);
+            if (length < sizeof(ClientDatagram))
+            {
+                stats.errors++;
+                continue;
+            }
+
+            uint32_t sequence = ntohl(reinterpret_cast<const ClientDatagram*>(datagram)->sequence_number);
+            if (debug)
+            {
+                std::cout << "Recieved packet with sequence number " << sequence << ", length " << length << " ("
+                          << recvBytes << " bytes coalesced)\n";
+            }
+
+            if (stats.acks != nullptr)
+            {
+                stats.acks->Add(socketFD, client, message.msg_namelen, sequence, length, NowNs(), stats);
+                continue;
+            }
+
+            responses[pending].sequence_number = htonl(sequence);
+            responses[pending].datagram_length = htons(length);
+            pending++;
+
+            // Flush when the batch is full or this was the last segment in the burst
+            if (pending < MAX_GSO_SEGMENTS && offset + segmentSize < static_cast<size_t>(recvBytes))
+            {
+                continue;
+            }
+
+            iovec sendIOV = {responses.data(), pending * sizeof(ServerDatagram)};
+            msghdr reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.msg_name = &clientAddr;
+            reply.msg_namelen = message.msg_namelen;
+            reply.msg_iov = &sendIOV;
+            reply.msg_iovlen = 1;
+            if (pending > 1)
+            {
+                reply.msg_control = sendControl;
+                reply.msg_controllen = sizeof(sendControl);
+                cmsghdr* cmsg = CMSG_FIRSTHDR(&reply);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t replySize = sizeof(ServerDatagram);
+                memcpy(CMSG_DATA(cmsg), &replySize, sizeof(replySize));
+            }
+
+            stats.sendCalls++;
+            if (sendmsg(socketFD, &reply, 0) == -1)
+            {
+                stats.Failed(errno, pending);
+            }
+            else
+            {
+                stats.replied += pending;
+            }
+            pending = 0;
+        }
+    }
+
+    if (debug)
+    {
+        std::cout << "Stop requested, leaving the GRO recieve and reply loop\n";
+    }
+}
+
+/* RecieveAndRespondTransport
+ * Recieve and reply loop over a Transport (transport.hpp) rather than a socket, so the kernel UDP path and the shared
+ * memory rings answer with the same code and their round trips can be compared. It does what the plain loop does
+ * with no inspection options: counts each datagram and sends one ServerDatagram back.
+ * Parameters:
+ *   Transport&        transport -- Where datagrams come from and replies go
+ *   const LoopConfig& config    -- Loop settings, only the buffer size is used
+ *   ServerStats&      stats     -- Counters to update
+ *   bool              debug     -- Enable debug messages
+ * Returns:
+ *   Nothing. During normal operation, this function loops until SIGINT/SIGTERM is recieved.
+ */
+void RecieveAndRespondTransport(Transport& transport, const LoopConfig& config, ServerStats& stats, bool debug)
+{
+    // Recieves give up now and then so the loop notices a stop request even if the signal missed the wait
+    const int WAIT_MS = 100;
+
+    if (debug)
+    {
+        std::cout << "Entering the transport loop over " << transport.Describe() << "...\n";
+    }
+
+    std::vector<uint8_t> buffer(std::max(config.bufferSize, sizeof(ClientDatagram)));
+    ServerDatagram response;
+    while (!stopRequested.load())
+    {
+        memset(buffer.data(), 0, sizeof(ClientDatagram));
+        ssize_t recvBytes = transport.Recieve(buffer.data(), buffer.size(), WAIT_MS);
+        stats.recvCalls++;
+        if (recvBytes == -1)
+        {
+            if (errno == EAGAIN)
+            {
+                stats.eagain++;
+            }
+            else if (errno != EINTR)
+            {
+                ReportRecieveError(recvBytes);
+                stats.Failed(errno);
+            }
+            continue;
+        }
+        else if (recvBytes == 0)
+        {
+            ReportRecieveError(recvBytes);
+            stats.errors++;
+            continue;
+        }
+        stats.received++;
+        stats.bytes += recvBytes;
+        if (static_cast<size_t>(recvBytes) > buffer.size())
+        {
+            stats.truncated++;
+        }
+
+        const ClientDatagram* data = reinterpret_cast<const ClientDatagram*>(buffer.data());
+        if (debug)
+        {
+            std::cout << "Recieved packet with sequence number " << ntohl(data->sequence_number) << ", "
+                      << recvBytes << " bytes\n";
+        }
+
+        // The sequence number goes straight back in network order
+        response.sequence_number = data->sequence_number;
+        response.datagram_length = htons(recvBytes);
+        stats.sendCalls++;
+        if (transport.Send(&response, sizeof(response)) == -1)
+        {
+            stats.Failed(errno);
+        }
+        else
+        {
+            stats.replied++;
+        }
+    }
+
+    if (debug)
+    {
+        std::cout << "Stop requested, leaving the transport loop\n";
+    }
+}
+
+/* RunLoop
+ * Runs whichever recieve loop the configuration asks for on one socket.
+ * Parameters:
+ *   int               socketFD -- Socket to recieve and send on
+ *   const LoopConfig& config   -- Loop settings
+ *   ServerStats&      stats    -- Counters to update
+ *   bool              debug    -- Enable debug messages
+ * Returns:
+ *   Nothing, once a stop has been requested.
+ */
+void RunLoop(int socketFD, const LoopConfig& config, ServerStats& stats, bool debug)
+{
+    // The blocking loops need to wake up now and then to send aggregated acks that are due
+    if (config.ackBatch > 0)
+    {
+        timeval timeout;
+        timeout.tv_sec = config.ackHoldMicros / 1000000;
+        timeout.tv_usec = std::max(1u, config.ackHoldMicros % 1000000);
+        setsockopt(socketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    if (config.useUring)
+    {
+        try
+        {
+            RecieveAndRespondUring(socketFD, config, stats, debug);
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "io_uring unavailable (" << e.what() << "), falling back to the blocking loop\n";
+        }
+    }
+
+    if (config.useGro)
+    {
+        try
+        {
+            RecieveAndRespondGRO(socketFD, config, stats, debug);
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << ", falling back to the blocking loop\n";
+        }
+    }
+
+    if (config.batchSize > 0)
+    {
+        RecieveAndRespondBatched(socketFD, config, stats, debug);
+    }
+    else
+    {
+        config.plainLoop(socketFD, config, stats);
+    }
+}
+
+/* CountedRun
+ * Runs a recieve loop, adding the user space instructions and cycles it spent to the stats when the configuration
+ * asks for them. The counters follow the calling thread, so every worker counts its own loop.
+ * Parameters:
+ *   const LoopConfig& config -- Loop settings
+ *   ServerStats&      stats  -- Counters to add to
+ *   Loop              loop   -- Callable that runs the loop
+ * Returns:
+ *   Nothing.
+ */
+template <typename Loop>
+void CountedRun(const LoopConfig& config, ServerStats& stats, Loop loop)
+{
+    if (!config.countInstructions)
+    {
+        loop();
+        return;
+    }
+
+    PerfCounters counters;
+    counters.Start();
+    loop();
+    counters.Stop();
+    stats.instructions += counters.Instructions();
+    stats.cycles += counters.Cycles();
+    stats.cyclesFromTsc = stats.cyclesFromTsc || counters.CyclesFromTsc();
+}
+
+/* MakeFlowTable
+ * Creates the per-client flow table a recieve loop records into, if the configuration asks for one.
+ * Parameters:
+ *   const LoopConfig&  config -- Loop settings
+ *   const std::string& label  -- Heading for the table's reports
+ * Returns:
+ *   The table, or an empty pointer if flow tracking is off.
+ */
+std::unique_ptr<FlowTable> MakeFlowTable(const LoopConfig& config, const std::string& label)
+{
+    if (config.flowCapacity == 0)
+    {
+        return std::unique_ptr<FlowTable>();
+    }
+    const uint64_t NS_PER_SECOND = 1000000000;
+    return std::unique_ptr<FlowTable>(new FlowTable(config.flowCapacity, config.flowIdleSeconds * NS_PER_SECOND,
+                                                    config.flowReportSeconds * NS_PER_SECOND, config.flowTopCount,
+                                                    label));
+}
+
+/* MakeAckAggregator
+ * Creates the ack aggregator a recieve loop replies through, if the configuration asks for one.
+ * Parameters:
+ *   const LoopConfig& config -- Loop settings
+ * Returns:
+ *   The aggregator, or an empty pointer if every datagram gets its own reply.
+ */
+std::unique_ptr<AckAggregator> MakeAckAggregator(const LoopConfig& config)
+{
+    if (config.ackBatch == 0)
+    {
+        return std::unique_ptr<AckAggregator>();
+    }
+    return std::unique_ptr<AckAggregator>(new AckAggregator(config.ackBatch, config.ackHoldMicros * 1000ULL));
+}
+
+/* StartMetrics
+ * Starts the live reporter over the stats of every running loop, if the configuration asks for one. The reporter
+ * only reads the loops' Counters, so it can sample them while they run.
+ * Parameters:
+ *   const LoopConfig&  config -- Loop settings
+ *   const ServerStats* stats  -- Stats of each loop, which must outlive the reporter
+ *   size_t             count  -- Number of loops
+ * Returns:
+ *   The reporter, or an empty pointer if live reporting is off.
+ */
+std::unique_ptr<MetricsReporter> StartMetrics(const LoopConfig& config, const ServerStats* stats, size_t count)
+{
+    if (config.metrics.interval.count() == 0)
+    {
+        return std::unique_ptr<MetricsReporter>();
+    }
+
+    MetricsReporter::Sampler sampler = [stats, count](MetricsSnapshot& snapshot)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            snapshot.received += stats[i].received;
+            snapshot.sent += stats[i].replied;
+            snapshot.bytes += stats[i].bytes;
+            snapshot.errors += stats[i].errors;
+            snapshot.eagain += stats[i].eagain;
+            snapshot.Add(stats[i].errnos);
+        }
+    };
+    return std::unique_ptr<MetricsReporter>(new MetricsReporter(sampler, config.metrics, "server"));
+}
+
+/* PrintServerStats
+ * Displays the counters gathered by a recieve loop, including how many datagrams each syscall handled.
+ * Parameters:
+ *   const ServerStats& stats -- Counters to display
+ * Returns:
+ *   Nothing.
+ */
+void PrintServerStats(const ServerStats& stats)
+{
+    std::cout << "\nDatagrams recieved: " << stats.received << "\n"
+              << "Replies sent: " << stats.replied << "\n"
+              << "Errors: " << stats.errors << "\n"
+              << "Bytes recieved: " << stats.bytes << "\n"
+              << "Dropped by the kernel (recieve queue full): " << stats.kernelDrops << "\n";
+    if (stats.truncated > 0)
+    {
+        std::cout << "Truncated datagrams: " << stats.truncated << " (larger than the recieve buffer)\n";
+    }
+    if (stats.corrupt > 0)
+    {
+        std::cout << "Payloads failing pattern verification: " << stats.corrupt << "\n";
+    }
+
+    if (stats.recvCalls > 0)
+    {
+        std::cout << "Datagrams per recieve syscall: "
+                  << static_cast<double>(stats.received) / stats.recvCalls << " (" << stats.recvCalls << " calls)\n";
+    }
+    if (stats.aggregated > 0)
+    {
+        std::cout << "Acks per aggregated reply: " << static_cast<double>(stats.aggregated) / stats.replied << "\n";
+    }
+    if (stats.sendCalls > 0)
+    {
+        std::cout << "Replies per send syscall: "
+                  << static_cast<double>(stats.replied) / stats.sendCalls << " (" << stats.sendCalls << " calls)\n";
+    }
+    if (stats.cycles > 0 && stats.received > 0)
+    {
+        std::cout << "User space instructions per datagram: ";
+        if (stats.instructions > 0)
+        {
+            std::cout << static_cast<double>(stats.instructions) / stats.received << "\n";
+        }
+        else
+        {
+            std::cout << "n/a (no hardware counters)\n";
+        }
+        std::cout << "Cycles per datagram: " << static_cast<double>(stats.cycles) / stats.received
+                  << (stats.cyclesFromTsc ? std::string(" (") + PerfCounters::FallbackUnit()
+                                            + ", including time in the kernel and waiting)\n" : "\n");
+    }
+}
+
+/* PinToCore
+ * Restricts a thread to a single core so a loop keeps its caches and its socket's softirq work local.
+ * Parameters:
+ *   pthread_t    thread -- Thread to pin
+ *   int          core   -- Core to pin to, negative to leave the thread alone
+ *   bool         report -- Explain a failure to pin
+ * Returns:
+ *   Nothing. Failing to pin is not fatal, the thread just floats.
+ */
+void PinToCore(pthread_t thread, int core, bool report)
+{
+    int rv = PinThread(thread, core);
+    if (rv != 0 && report)
+    {
+        std::cerr << "Unable to pin to core " << core << ": " << strerror(rv) << "\n";
+    }
+}
+
+/* TuneSockets
+ * Applies the low-latency settings to every socket a loop will use and shows what the kernel granted the first.
+ * Parameters:
+ *   const std::vector<int>& sockets -- Sockets to tune
+ *   const SocketTuning&     tuning  -- Settings to apply
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if the kernel refuses a setting.
+ */
+void TuneSockets(const std::vector<int>& sockets, const SocketTuning& tuning)
+{
+    if (!tuning.Active() || sockets.empty())
+    {
+        return;
+    }
+    for (int socketFD : sockets)
+    {
+        TuneSocket(socketFD, tuning);
+    }
+    PrintSocketBuffers(std::cout, sockets[0], tuning);
+}
+
+/* RunWorkers
+ * Opens one SO_REUSEPORT socket per worker and runs a recieve loop on each in its own pinned thread, letting the
+ * kernel hash flows across them. The calling thread waits for SIGINT/SIGTERM, then shuts the sockets down to wake
+ * the workers and merges their counters.
+ * Parameters:
+ *   uint16_t          port        -- Port every worker binds to
+ *   unsigned int      threadCount -- Number of workers
+ *   const LoopConfig& config      -- Settings for the workers' loops
+ *   bool              debug       -- Enable debug messages
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if any of the sockets could not be opened.
+ */
+void RunWorkers(uint16_t port, unsigned int threadCount, const LoopConfig& config, bool debug)
+{
+    // Block the stop signals before any worker exists so only this thread ever sees them
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    std::vector<int> sockets;
+    try
+    {
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            sockets.push_back(EstablishConnection(port, true, debug));
+
+            // Port 0 lets the kernel pick for the first worker, the others have to join that same port
+            if (port == 0)
+            {
+                port = BoundPort(sockets[0]);
+                std::cout << "Listening on port " << port << std::endl;
+            }
+        }
+    }
+    catch (...)
+    {
+        for (int socketFD : sockets)
+        {
+            close(socketFD);
+        }
+        throw;
+    }
+
+    TuneSockets(sockets, config.tuning);
+
+    // Workers count straight into their slots, padded apart, so the metrics reporter can follow them live
+    std::vector<ServerStats> workerStats(threadCount);
+    std::vector<std::unique_ptr<FlowTable>> flowTables;
+    for (unsigned int i = 0; i < threadCount; i++)
+    {
+        flowTables.push_back(MakeFlowTable(config, "Worker " + std::to_string(i) + " flow table"));
+    }
+    std::vector<std::thread> workers;
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int i = 0; i < threadCount; i++)
+    {
+        workers.emplace_back([&, i]()
+        {
+            ServerStats& stats = workerStats[i];
+            stats.flows = flowTables[i].get();
+            try
+            {
+                std::unique_ptr<AckAggregator> acks = MakeAckAggregator(config);
+                stats.acks = acks.get();
+                CountedRun(config, stats, [&]() { RunLoop(sockets[i], config, stats, debug); });
+                if (acks)
+                {
+                    acks->FlushAll(stats);
+                }
+                stats.acks = nullptr;
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Worker " << i << ": " << e.what() << '\n';
+                stats.errors++;
+            }
+        });
+        if (config.tuning.cpus.empty())
+        {
+            PinToCore(workers.back().native_handle(), i % cores, debug);
+        }
+        else
+        {
+            PinToCore(workers.back().native_handle(), config.tuning.Cpu(i), true);
+        }
+    }
+
+    std::unique_ptr<MetricsReporter> metrics = StartMetrics(config, workerStats.data(), threadCount);
+
+    if (debug)
+    {
+        std::cout << "Started " << threadCount << " workers on port " << port << "\n";
+    }
+
+    int signal = 0;
+    sigwait(&stopSignals, &signal);
+    stopRequested.store(true);
+
+    /* Shutting down an unconnected UDP socket still wakes anyone blocked on it, the call itself reports ENOTCONN.
+     * Only the read side is shut so workers can still send the aggregated acks they hold.
+     */
+    for (int socketFD : sockets)
+    {
+        shutdown(socketFD, SHUT_RD);
+    }
+
+    ServerStats total;
+    for (unsigned int i = 0; i < threadCount; i++)
+    {
+        workers[i].join();
+        workerStats[i].kernelDrops = SocketDrops(sockets[i]);
+        close(sockets[i]);
+        std::cout << "Worker " << i << ": recieved " << workerStats[i].received << ", replied "
+                  << workerStats[i].replied << ", errors " << workerStats[i].errors << "\n";
+        total.Merge(workerStats[i]);
+    }
+    if (metrics)
+    {
+        metrics->Stop();
+    }
+
+    PrintServerStats(total);
+
+    // SO_REUSEPORT keeps each client on one worker, so merging the tables only gathers them for one ranking
+    if (config.flowCapacity > 0)
+    {
+        FlowTable allFlows(config.flowCapacity * threadCount, 0, 0, config.flowTopCount, "Flow table");
+        for (const std::unique_ptr<FlowTable>& table : flowTables)
+        {
+            allFlows.Merge(*table);
+        }
+        allFlows.PrintTop(std::cout);
+    }
+}
+
+/* ParsePortList
+ * Reads a comma separated list of ports, such as 39390,39391.
+ * Parameters:
+ *   const std::string& text -- List to parse
+ * Returns:
+ *   The ports, in the order given.
+ * Exceptions:
+ *   Will throw an exception if any port is not a number or is out of range.
+ */
+std::vector<uint16_t> ParsePortList(const std::string& text)
+{
+    std::vector<uint16_t> ports;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        unsigned long port = std::stoul(item);
+        if (port > 65535)
+        {
+            throw std::out_of_range("Port " + item + " is out of range");
+        }
+        ports.push_back(static_cast<uint16_t>(port));
+    }
+    if (ports.empty())
+    {
+        throw std::invalid_argument("No port given");
+    }
+    return ports;
+}
+
+int main(int argc, char* argv[])
+{
+    int retval = 0;
+    std::vector<uint16_t> ports(1, PORT_NUMBER);
+    LoopConfig config;
+    TransportOptions transportOptions;
+    std::string capturePath;
+    uint64_t captureMiB = DEFAULT_CAPTURE_MIB;
+    unsigned int threadCount = 0;
+    bool useEpoll = false;
+    bool quiet = false;
+    bool debug = false;
+    bool earlyStop = false;
+
+    try
+    {
+        char c;
+        while ((c = getopt(argc, argv, "a:A:b:C:c:def:ghIi:Kk:m:o:p:qr:R:t:uvW:x:X:Z:")) != -1)
+        {
+            switch (c)
+            {
+            case 'a':
+                config.ackBatch = ParseBounded(optarg, 2, AGGREGATE_ACK_WINDOW,
+                                               "Acks per aggregated reply must be between 2 and "
+                                               + std::to_string(AGGREGATE_ACK_WINDOW));
+                break;
+
+            case 'A':
+                config.ackHoldMicros = ParseBounded(optarg, 1, MAX_ACK_HOLD_MICROS,
+                                                    "Ack hold time must be between 1 and "
+                                                    + std::to_string(MAX_ACK_HOLD_MICROS) + " microseconds");
+                break;
+
+            case 'b':
+                config.batchSize = ParseBounded(optarg, 1, MAX_BATCH_SIZE,
+                                                "Batch size must be between 1 and " + std::to_string(MAX_BATCH_SIZE));
+                break;
+
+            case 'C':
+                config.tuning.cpus = ParseCpuList(optarg);
+                break;
+
+            case 'c':
+                config.metrics.interval = std::chrono::milliseconds(static_cast<long>(std::stod(optarg) * 1000));
+                if (config.metrics.interval.count() <= 0)
+                {
+                    throw std::out_of_range("Report interval must be at least 1 millisecond");
+                }
+                break;
+
+            case 'd':
+                debug = true;
+                break;
+
+            case 'e':
+                useEpoll = true;
+                break;
+
+            case 'f':
+                config.flowCapacity = std::stoul(optarg);
+                break;
+
+            case 'g':
+                config.useGro = true;
+                break;
+
+            case 'h':
+                std::cout << argv[0] << " (UDP Blaster Server) options: \n"
+                          << "-a [n]    Aggregate up to n acks per client into one reply, 2 to " << AGGREGATE_ACK_WINDOW
+                          << " (default off, one reply per datagram)\n"
+                          << "-A [us]   Longest an ack is held back for aggregation (default 1000)\n"
+                          << "-b [n]    Batch up to n datagrams per recvmmsg/sendmmsg call (default off)\n"
+                          << "-C [cpus] Pin the recieve loop, or each -t worker in turn, to these CPUs, e.g. 0,2-3\n"
+                          << "-c [s]    Report live counters every s seconds (default off, 1s with -o)\n"
+                          << "-d        Enable debug messages\n"
+                          << "-e        Serve every IPv4/IPv6 address on every port from one edge-triggered epoll loop\n"
+                          << "-f [n]    Track per-client statistics in a flow table of n slots (default off)\n"
+                          << "-g        Recieve with UDP GRO, answering each coalesced burst with one GSO send\n"
+                          << "-h        Display this help and exit\n"
+                          << "-I        Count user space instructions and cycles per datagram in the recieve loop\n"
+                          << "-i [s]    Print the busiest clients every s seconds while running (default only on exit)\n"
+                          << "-K        Stamp recieves in the kernel and report the server's turnaround in each reply\n"
+                          << "-k [n]    Show the n busiest clients in flow reports (default 10)\n"
+                          << "-m [n]    Recieve buffer per datagram in bytes, longer datagrams are truncated (default "
+                          << MAX_RECIEVE_BUFFER << ")\n"
+                          << "-o [fmt]  Live report format: text, json[:path] (JSON lines) or prom:path (Prometheus "
+                          << "textfile) (default text)\n"
+                          << "-p [port] Bind to the provided port, or a comma separated list with -e (default 39390),\n"
+                          << "          0 for any free port, which is then printed\n"
+                          << "-q        Quiet plain loop: count datagrams but skip inspecting them (no byte counts)\n"
+                          << "-r [file] Record every datagram (time, source, sequence number, length, payload) to a\n"
+                          << "          binary trace the client can replay with -Y\n"
+                          << "-R [MiB]  Size to preallocate for the -r trace, datagrams past it are only counted\n"
+                          << "          (default " << DEFAULT_CAPTURE_MIB << ")\n"
+                          << "-t [n]    Run n pinned worker threads, each on its own SO_REUSEPORT socket (default off)\n"
+                          << "-u        Use the io_uring loop, falls back to the -b/plain loop if io_uring is unavailable\n"
+                          << "-v        Verify payloads against the client's -l fill pattern\n"
+                          << "-W [n]    Ask for n byte socket recieve and send buffers, and show what was granted\n"
+                          << "-x [s]    Forget clients idle for s seconds, 0 to never (default 30)\n"
+                          << "-X [t]    Answer through a transport: udp (the plain socket) or shm:name (shared memory\n"
+                          << "          rings for a client on this host with the same -X, no network stack at all)\n"
+                          << "-Z [us]   Busy poll blocking recieves for up to us microseconds (SO_BUSY_POLL)\n";
                 throw 0;
 
+            case 'I':
+                config.countInstructions = true;
+                break;
+
+            case 'i':
+                config.flowReportSeconds = ParseBounded(optarg, 0, MAX_FLOW_SECONDS,
+                                                        "Flow report interval must be between 0 and "
+                                                        + std::to_string(MAX_FLOW_SECONDS) + " seconds");
+                break;
+
+            case 'K':
+                config.timestamps = true;
+                break;
+
+            case 'k':
+                config.flowTopCount = std::stoul(optarg);
+                break;
+
+            case 'm':
+                config.bufferSize = std::stoul(optarg);
+                if (config.bufferSize < sizeof(ClientDatagram) || config.bufferSize > MAX_RECIEVE_BUFFER)
+                {
+                    throw std::out_of_range("Recieve buffer must be between " + std::to_string(sizeof(ClientDatagram))
+                                            + " and " + std::to_string(MAX_RECIEVE_BUFFER) + " bytes");
+                }
+                break;
+
+            case 'o':
+                config.metrics.ParseFormat(optarg);
+                if (config.metrics.interval.count() == 0)
+                {
+                    config.metrics.interval = std::chrono::seconds(1);
+                }
+                break;
+
             case 'p':
-                port = std::stoi(optarg);
+                ports = ParsePortList(optarg);
+                break;
+
+            case 'q':
+                quiet = true;
+                break;
+
+            case 'r':
+                capturePath = optarg;
+                break;
+
+            case 'R':
+                captureMiB = std::stoull(optarg);
+                if (captureMiB == 0 || captureMiB > MAX_CAPTURE_MIB)
+                {
+                    throw std::out_of_range("Capture size must be between 1 and " + std::to_string(MAX_CAPTURE_MIB)
+                                            + " MiB");
+                }
+                break;
+
+            case 't':
+                threadCount = ParseBounded(optarg, 1, MAX_WORKERS,
+                                           "Thread count must be between 1 and " + std::to_string(MAX_WORKERS));
+                break;
+
+            case 'u':
+                config.useUring = true;
+                break;
+
+            case 'v':
+                config.verifyPayload = true;
+                break;
+
+            case 'W':
+                config.tuning.bufferBytes = std::stoi(optarg);
+                if (config.tuning.bufferBytes <= 0)
+                {
+                    throw std::out_of_range("Socket buffer size must be at least 1 byte");
+                }
+                break;
+
+            case 'x':
+                config.flowIdleSeconds = ParseBounded(optarg, 0, MAX_FLOW_SECONDS,
+                                                      "Flow idle timeout must be between 0 and "
+                                                      + std::to_string(MAX_FLOW_SECONDS) + " seconds");
+                break;
+
+            case 'X':
+                transportOptions.Parse(optarg);
+                break;
+
+            case 'Z':
+                config.tuning.busyPollMicros = ParseBounded(optarg, 0, SocketTuning::MAX_BUSY_POLL_MICROS,
+                                                            "Busy poll budget must be between 0 and "
+                                                            + std::to_string(SocketTuning::MAX_BUSY_POLL_MICROS)
+                                                            + " microseconds");
                 break;
 
             default:
@@ -251,6 +2202,77 @@ int main(int argc, char* argv[])
                 throw UNKNOWN_ARGUMENT;
             }
         }
+
+        if (useEpoll && threadCount > 0)
+        {
+            throw std::invalid_argument("-e and -t cannot be combined");
+        }
+        if (useEpoll && config.useUring)
+        {
+            throw std::invalid_argument("-e and -u cannot be combined");
+        }
+        if (config.ackBatch > 0 && config.useUring)
+        {
+            throw std::invalid_argument("-a and -u cannot be combined");
+        }
+        if (config.useGro && (useEpoll || config.useUring || config.batchSize > 0))
+        {
+            throw std::invalid_argument("-g cannot be combined with -e, -u or -b");
+        }
+        if (config.useGro && config.bufferSize != MAX_RECIEVE_BUFFER)
+        {
+            throw std::invalid_argument("-g always recieves whole bursts and cannot be combined with -m");
+        }
+        if (config.timestamps && (useEpoll || config.useUring || config.useGro || config.batchSize > 0 ||
+                                  config.ackBatch > 0))
+        {
+            throw std::invalid_argument("-K needs the plain loop and cannot be combined with -e, -u, -g, -b or -a");
+        }
+        if (quiet && (debug || useEpoll || config.useUring || config.useGro || config.batchSize > 0))
+        {
+            throw std::invalid_argument("-q needs the plain loop and cannot be combined with -d, -e, -u, -g or -b");
+        }
+        if (quiet && (config.flowCapacity > 0 || config.verifyPayload || config.timestamps))
+        {
+            throw std::invalid_argument("-q skips inspecting datagrams and cannot be combined with -f, -v or -K");
+        }
+        if (transportOptions.kind != TransportOptions::Kind::None &&
+            (useEpoll || threadCount > 0 || config.useUring || config.useGro || config.batchSize > 0 ||
+             config.ackBatch > 0 || config.timestamps || config.flowCapacity > 0 || config.verifyPayload || quiet))
+        {
+            throw std::invalid_argument("-X runs its own plain loop and cannot be combined with -e, -t, -u, -g, -b, "
+                                        "-a, -K, -f, -v or -q");
+        }
+        if (transportOptions.kind == TransportOptions::Kind::Shm &&
+            (config.tuning.bufferBytes > 0 || config.tuning.busyPollMicros > 0))
+        {
+            throw std::invalid_argument("-X shm has no socket to apply -W or -Z to");
+        }
+        if (!capturePath.empty() &&
+            (threadCount > 0 || quiet || transportOptions.kind != TransportOptions::Kind::None))
+        {
+            throw std::invalid_argument("-r records from a single inspecting loop and cannot be combined with -t, -q "
+                                        "or -X");
+        }
+        if (!useEpoll && ports.size() > 1)
+        {
+            throw std::invalid_argument("Serving several ports requires -e");
+        }
+        if (useEpoll && config.batchSize == 0)
+        {
+            config.batchSize = DEFAULT_EPOLL_BATCH;
+        }
+
+        // The plain loop is specialized at compile time, this is the one place its build is picked
+        config.plainLoop = RecieveAndRespond<StatsPolicy>;
+        if (debug)
+        {
+            config.plainLoop = RecieveAndRespond<DebugPolicy>;
+        }
+        else if (quiet)
+        {
+            config.plainLoop = RecieveAndRespond<QuietPolicy>;
+        }
     }
     catch(const std::exception& e)
     {
@@ -272,7 +2294,7 @@ int main(int argc, char* argv[])
 
     if (debug)
     {
-        std::cout << "Server ready to run and bind to port " << port << "\n";
+        std::cout << "Server ready to run and bind to port " << ports[0] << "\n";
     }
 
     if (earlyStop)
@@ -280,11 +2302,113 @@ int main(int argc, char* argv[])
         return retval;
     }
 
+    // No SA_RESTART, so a blocked recieve returns EINTR and the loop gets to see the stop request
+    struct sigaction stopAction;
+    memset(&stopAction, 0, sizeof(stopAction));
+    stopAction.sa_handler = HandleStopSignal;
+    sigemptyset(&stopAction.sa_mask);
+    sigaction(SIGINT, &stopAction, nullptr);
+    sigaction(SIGTERM, &stopAction, nullptr);
+
     int socketFD = -1;
+    std::vector<int> listeners;
+    ServerStats stats;
     try
     {
-        socketFD = EstablishConnection(port, debug);
-        RecieveAndRespond(socketFD, debug);
+        std::unique_ptr<FlowTable> flowTable;
+        std::unique_ptr<AckAggregator> acks;
+        std::unique_ptr<CaptureWriter> capture;
+        if (!capturePath.empty())
+        {
+            capture.reset(new CaptureWriter(capturePath, captureMiB * 1024 * 1024));
+            stats.capture = capture.get();
+        }
+        if (threadCount == 0)
+        {
+            flowTable = MakeFlowTable(config, "Flow table");
+            stats.flows = flowTable.get();
+            acks = MakeAckAggregator(config);
+            stats.acks = acks.get();
+        }
+
+        if (useEpoll)
+        {
+            listeners = EstablishListeners(ports, debug);
+            TuneSockets(listeners, config.tuning);
+            std::unique_ptr<MetricsReporter> metrics = StartMetrics(config, &stats, 1);
+            PinToCore(pthread_self(), config.tuning.Cpu(0), true);
+            CountedRun(config, stats, [&]() { RecieveAndRespondEpoll(listeners, config, stats, debug); });
+            if (acks)
+            {
+                acks->FlushAll(stats);
+            }
+            if (metrics)
+            {
+                metrics->Stop();
+            }
+            for (int listener : listeners)
+            {
+                stats.kernelDrops += SocketDrops(listener);
+            }
+            PrintServerStats(stats);
+        }
+        else if (threadCount > 0)
+        {
+            RunWorkers(ports[0], threadCount, config, debug);
+        }
+        else if (transportOptions.kind == TransportOptions::Kind::Shm)
+        {
+            ShmTransport transport(transportOptions.shmName, true, config.bufferSize);
+            std::cout << "Serving shared memory " << transportOptions.shmName << std::endl;
+            std::unique_ptr<MetricsReporter> metrics = StartMetrics(config, &stats, 1);
+            PinToCore(pthread_self(), config.tuning.Cpu(0), true);
+            CountedRun(config, stats, [&]() { RecieveAndRespondTransport(transport, config, stats, debug); });
+            if (metrics)
+            {
+                metrics->Stop();
+            }
+            PrintServerStats(stats);
+            transport.PrintReport(std::cout);
+        }
+        else
+        {
+            socketFD = EstablishConnection(ports[0], false, debug);
+            if (ports[0] == 0)
+            {
+                std::cout << "Listening on port " << BoundPort(socketFD) << std::endl;
+            }
+            TuneSockets(std::vector<int>(1, socketFD), config.tuning);
+            std::unique_ptr<MetricsReporter> metrics = StartMetrics(config, &stats, 1);
+            PinToCore(pthread_self(), config.tuning.Cpu(0), true);
+            if (transportOptions.kind == TransportOptions::Kind::Udp)
+            {
+                UdpTransport transport(socketFD, true);
+                CountedRun(config, stats, [&]() { RecieveAndRespondTransport(transport, config, stats, debug); });
+            }
+            else
+            {
+                CountedRun(config, stats, [&]() { RunLoop(socketFD, config, stats, debug); });
+            }
+            if (acks)
+            {
+                acks->FlushAll(stats);
+            }
+            if (metrics)
+            {
+                metrics->Stop();
+            }
+            stats.kernelDrops = SocketDrops(socketFD);
+            PrintServerStats(stats);
+        }
+
+        if (flowTable)
+        {
+            flowTable->PrintTop(std::cout);
+        }
+        if (capture)
+        {
+            capture->PrintReport(std::cout);
+        }
     }
     catch(const std::exception& e)
     {
@@ -301,6 +2425,10 @@ int main(int argc, char* argv[])
     {
         close(socketFD);
     }
+    for (int listener : listeners)
+    {
+        close(listener);
+    }
 
 
     return retval;
@@ -0,0 +1,130 @@
+/* UDP Blaster -- Socket tuning
+ * Low-latency socket settings shared by the client and server: busy polling, larger socket buffers and CPU pinning,
+ * plus reading back what the kernel granted and how many datagrams it dropped.
+ */
+
+// C/C++ Standard Libraries
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+
+// System libraries
+#include <linux/sock_diag.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+// Local includes
+#include "socket_tuning.hpp"
+
+namespace
+{
+    void SetOption(int socketFD, int option, int value, const char* name)
+    {
+        if (setsockopt(socketFD, SOL_SOCKET, option, &value, sizeof(value)) == -1)
+        {
+            std::runtime_error ex(std::string("Unable to set ") + name + ": " + strerror(errno));
+            throw ex;
+        }
+    }
+
+    int GetOption(int socketFD, int option)
+    {
+        int value = 0;
+        socklen_t length = sizeof(value);
+        getsockopt(socketFD, SOL_SOCKET, option, &value, &length);
+        return value;
+    }
+
+    // The FORCE variants ignore the sysctl caps but need CAP_NET_ADMIN
+    void SetBuffer(int socketFD, int forced, int capped, int bytes, const char* name)
+    {
+        if (setsockopt(socketFD, SOL_SOCKET, forced, &bytes, sizeof(bytes)) == 0)
+        {
+            return;
+        }
+        SetOption(socketFD, capped, bytes, name);
+    }
+}
+
+std::vector<int> ParseCpuList(const std::string& text)
+{
+    std::vector<int> cpus;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        size_t dash = item.find('-');
+        int first = std::stoi(item.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+        {
+            throw std::out_of_range("CPU range " + item + " is out of order or out of range");
+        }
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty())
+    {
+        throw std::invalid_argument("No CPU given");
+    }
+    return cpus;
+}
+
+void TuneSocket(int socketFD, const SocketTuning& tuning)
+{
+    if (tuning.busyPollMicros > 0)
+    {
+        SetOption(socketFD, SO_BUSY_POLL, tuning.busyPollMicros, "SO_BUSY_POLL");
+#ifdef SO_PREFER_BUSY_POLL
+        int enable = 1;
+        setsockopt(socketFD, SOL_SOCKET, SO_PREFER_BUSY_POLL, &enable, sizeof(enable));
+#endif
+    }
+    if (tuning.bufferBytes > 0)
+    {
+        SetBuffer(socketFD, SO_RCVBUFFORCE, SO_RCVBUF, tuning.bufferBytes, "SO_RCVBUF");
+        SetBuffer(socketFD, SO_SNDBUFFORCE, SO_SNDBUF, tuning.bufferBytes, "SO_SNDBUF");
+    }
+}
+
+uint64_t SocketDrops(int socketFD)
+{
+    uint32_t memInfo[SK_MEMINFO_VARS];
+    socklen_t length = sizeof(memInfo);
+    if (getsockopt(socketFD, SOL_SOCKET, SO_MEMINFO, memInfo, &length) == -1 || length <= SK_MEMINFO_DROPS * 4)
+    {
+        return 0;
+    }
+    return memInfo[SK_MEMINFO_DROPS];
+}
+
+void PrintSocketBuffers(std::ostream& out, int socketFD, const SocketTuning& tuning)
+{
+    // The kernel doubles every request to leave room for its own bookkeeping, so a granted request reads back as 2x
+    out << "Socket buffers: recieve " << GetOption(socketFD, SO_RCVBUF) << " bytes, send "
+        << GetOption(socketFD, SO_SNDBUF) << " bytes";
+    if (tuning.bufferBytes > 0)
+    {
+        out << " (asked for " << tuning.bufferBytes << ", the kernel reports double what it grants)";
+    }
+    if (tuning.busyPollMicros > 0)
+    {
+        out << ", busy poll " << GetOption(socketFD, SO_BUSY_POLL) << "us";
+    }
+    out << "\n";
+}
+
+int PinThread(pthread_t thread, int cpu)
+{
+    if (cpu < 0)
+    {
+        return 0;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus);
+}
@@ -0,0 +1,74 @@
+#pragma once
+/* UDP Blaster -- Socket tuning
+ * Low-latency socket settings shared by the client and server: busy polling, larger socket buffers and CPU pinning,
+ * plus reading back what the kernel granted and how many datagrams it dropped.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/* SocketTuning
+ * Opt-in low-latency settings, all off by default.
+ */
+struct SocketTuning
+{
+    // SO_BUSY_POLL takes an int, so a larger budget would reach the kernel as a negative one
+    static const unsigned int MAX_BUSY_POLL_MICROS = INT_MAX;
+
+    unsigned int busyPollMicros = 0;   // SO_BUSY_POLL budget for blocking recieves, 0 to leave busy polling off
+    int bufferBytes = 0;               // SO_RCVBUF and SO_SNDBUF to ask for, 0 for the system default
+    std::vector<int> cpus;             // CPUs to pin the datagram threads to, handed out round robin
+
+    bool Active() const { return busyPollMicros > 0 || bufferBytes > 0 || !cpus.empty(); }
+
+    /* Cpu
+     * Returns:
+     *   The CPU for the thread in the given slot, or -1 if no CPUs were chosen.
+     */
+    int Cpu(unsigned int slot) const { return cpus.empty() ? -1 : cpus[slot % cpus.size()]; }
+};
+
+/* ParseCpuList
+ * Reads a comma separated list of CPUs and ranges, such as 0,2-3.
+ * Exceptions:
+ *   Will throw an exception if an entry is not a number or a range runs backwards.
+ */
+std::vector<int> ParseCpuList(const std::string& text);
+
+/* TuneSocket
+ * Applies the busy poll and buffer settings to a socket. SO_PREFER_BUSY_POLL is set along with SO_BUSY_POLL where
+ * the kernel knows it (5.11 and later), so busy polling is not cut short by softirq processing under load. Buffers
+ * are forced past net.core.rmem_max/wmem_max when the process is allowed to (CAP_NET_ADMIN) and capped otherwise.
+ * Parameters:
+ *   int                 socketFD -- Socket to tune
+ *   const SocketTuning& tuning   -- Settings to apply
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if the kernel refuses SO_BUSY_POLL or the buffer sizes.
+ */
+void TuneSocket(int socketFD, const SocketTuning& tuning);
+
+/* SocketDrops
+ * Reads the socket's drop counter: datagrams the kernel threw away because the recieve queue was full, the same
+ * count SO_RXQ_OVFL attaches to recieved datagrams.
+ * Returns:
+ *   The count, or 0 if the kernel does not report it.
+ */
+uint64_t SocketDrops(int socketFD);
+
+/* PrintSocketBuffers
+ * Writes the buffer sizes the kernel actually granted a socket, which can differ from what was asked for.
+ */
+void PrintSocketBuffers(std::ostream& out, int socketFD, const SocketTuning& tuning);
+
+/* PinThread
+ * Restricts a thread to a single CPU.
+ * Returns:
+ *   0 on success (or for a negative CPU, which leaves the thread alone), otherwise the error number.
+ */
+int PinThread(pthread_t thread, int cpu);
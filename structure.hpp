@@ -15,3 +15,23 @@ struct ServerDatagram
 	uint16_t  datagram_length;
 };
 
+
+// Aggregated reply used when the server coalesces acks (server -a). Told apart from ServerDatagram by its size.
+#define AGGREGATE_ACK_WINDOW	256
+
+struct AggregateAck
+{
+	uint32_t  base_sequence;    // Sequence number of bit 0
+	uint16_t  datagram_length;  // Length of every datagram acknowledged
+	uint16_t  ack_count;        // Number of bits set
+	uint8_t   bitmap[AGGREGATE_ACK_WINDOW / 8]; // Bit n (byte n / 8, bit n % 8) acknowledges base_sequence + n
+};
+
+// Reply used when the server stamps its recieves (server -K). Told apart from the others by its size.
+struct TimedServerDatagram
+{
+	uint32_t  sequence_number;
+	uint16_t  datagram_length;
+	uint16_t  reserved;
+	uint32_t  turnaround_ns;    // Kernel recieve stamp to just before the reply was sent, 0 if there was no stamp
+};
@@ -0,0 +1,137 @@
+/* UDP Blaster -- Timer wheel
+ * Hashed timer wheel of datagrams waiting to be forwarded, backed by a fixed pool of datagram buffers.
+ */
+
+// C/C++ Standard Libraries
+#include <stdexcept>
+
+// Local includes
+#include "timer_wheel.hpp"
+
+const uint32_t TimerWheel::NONE;
+
+TimerWheel::TimerWheel(uint32_t capacity, uint32_t bufferSize, uint64_t tickNs, uint32_t slots, uint64_t now)
+    : capacity(capacity), bufferSize(bufferSize), tickNs(tickNs), cursor(now / tickNs)
+{
+    if (capacity == 0 || tickNs == 0)
+    {
+        throw std::invalid_argument("Timer wheel needs at least one buffer and a nonzero tick");
+    }
+
+    // A power of two number of slots, so the tick maps to its slot with a mask
+    uint32_t size = 64;
+    while (size < slots)
+    {
+        size <<= 1;
+    }
+    mask = size - 1;
+    wheel.resize(size);
+    occupied.resize(size / 64, 0);
+
+    buffers.resize(static_cast<size_t>(capacity) * bufferSize);
+    datagrams.resize(capacity);
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        datagrams[i].data = &buffers[static_cast<size_t>(i) * bufferSize];
+        datagrams[i].next = i + 1 < capacity ? i + 1 : NONE;
+    }
+    freeList = 0;
+    released.reserve(capacity);
+}
+
+QueuedDatagram* TimerWheel::Allocate()
+{
+    if (freeList == NONE)
+    {
+        return nullptr;
+    }
+    QueuedDatagram* datagram = &datagrams[freeList];
+    freeList = datagram->next;
+    return datagram;
+}
+
+void TimerWheel::Free(QueuedDatagram* datagram)
+{
+    datagram->next = freeList;
+    freeList = static_cast<uint32_t>(datagram - datagrams.data());
+}
+
+void TimerWheel::Append(uint32_t slot, uint32_t index)
+{
+    datagrams[index].next = NONE;
+    if (wheel[slot].tail == NONE)
+    {
+        wheel[slot].head = index;
+        occupied[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+    else
+    {
+        datagrams[wheel[slot].tail].next = index;
+    }
+    wheel[slot].tail = index;
+}
+
+void TimerWheel::Schedule(QueuedDatagram* datagram, uint64_t due)
+{
+    uint64_t tick = due / tickNs;
+    if (tick < cursor)
+    {
+        tick = cursor;
+    }
+    datagram->due = tick * tickNs > due ? tick * tickNs : due;
+    Append(static_cast<uint32_t>(tick & mask), static_cast<uint32_t>(datagram - datagrams.data()));
+    queued++;
+}
+
+void TimerWheel::Release(uint32_t slot, uint64_t lastTick, std::vector<uint32_t>& due)
+{
+    // Split the slot's list into what is due now and what waits for a later turn, keeping both in order
+    uint32_t index = wheel[slot].head;
+    wheel[slot].head = NONE;
+    wheel[slot].tail = NONE;
+    occupied[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    while (index != NONE)
+    {
+        uint32_t next = datagrams[index].next;
+        if (datagrams[index].due / tickNs <= lastTick)
+        {
+            due.push_back(index);
+        }
+        else
+        {
+            Append(slot, index);
+        }
+        index = next;
+    }
+}
+
+uint64_t TimerWheel::NextDue() const
+{
+    if (queued == 0)
+    {
+        return UINT64_MAX;
+    }
+
+    // Look from the cursor's slot to the end of its word, then whole words round the ring back to it
+    uint32_t start = static_cast<uint32_t>(cursor & mask);
+    uint32_t words = static_cast<uint32_t>(occupied.size());
+    for (uint32_t step = 0; step <= words; step++)
+    {
+        uint32_t word = (start / 64 + step) % words;
+        uint64_t bits = occupied[word];
+        if (step == 0)
+        {
+            bits &= ~uint64_t(0) << (start % 64);
+        }
+        else if (step == words)
+        {
+            bits &= (uint64_t(1) << (start % 64)) - 1;
+        }
+        if (bits != 0)
+        {
+            uint32_t slot = word * 64 + __builtin_ctzll(bits);
+            return (cursor + ((slot - start) & mask)) * tickNs;
+        }
+    }
+    return UINT64_MAX;
+}
@@ -0,0 +1,130 @@
+#pragma once
+/* UDP Blaster -- Timer wheel
+ * Hashed timer wheel of datagrams waiting to be forwarded, backed by a fixed pool of datagram buffers.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/* QueuedDatagram
+ * One pooled datagram buffer and where it goes once it is due. The relay fills in everything but due and next.
+ */
+struct QueuedDatagram
+{
+    uint8_t* data;          // Pool buffer of TimerWheel::BufferSize bytes
+    uint32_t length;
+    uint32_t session;       // Which client the datagram belongs to
+    bool toServer;          // Direction: client to server, or the reply on its way back
+    uint64_t due;           // Monotonic nanoseconds
+    uint32_t next;          // Next datagram in the same slot, or the free list
+};
+
+/* TimerWheel
+ * Datagrams are hashed by due tick into a ring of slots, each a FIFO list, so scheduling is O(1) and datagrams due in
+ * the same tick come out together (and in arrival order) for one batched send. Due times further out than one turn
+ * of the wheel share slots with nearer ones and are simply skipped until their turn comes round. A bitmap of
+ * non-empty slots lets NextDue find the next wakeup with one scan per 64 slots.
+ * All buffers come from a pool sized at construction, so nothing allocates once the relay is running. Not thread
+ * safe.
+ */
+class TimerWheel
+{
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    /* Parameters:
+     *   uint32_t capacity   -- Most datagrams that can be queued at once
+     *   uint32_t bufferSize -- Bytes per datagram buffer
+     *   uint64_t tickNs     -- Slot width in nanoseconds, datagrams are released at most this late
+     *   uint32_t slots      -- Number of slots, rounded up to a multiple of 64
+     *   uint64_t now        -- Current monotonic time, the wheel starts turning here
+     */
+    TimerWheel(uint32_t capacity, uint32_t bufferSize, uint64_t tickNs, uint32_t slots, uint64_t now);
+
+    /* Allocate
+     * Takes a buffer from the pool.
+     * Returns:
+     *   The datagram, or nullptr if every buffer is queued.
+     */
+    QueuedDatagram* Allocate();
+    void Free(QueuedDatagram* datagram);
+
+    /* Schedule
+     * Queues an allocated datagram to come out of Expire once its due time has passed. Due times already in the past
+     * come out on the next call.
+     */
+    void Schedule(QueuedDatagram* datagram, uint64_t due);
+
+    /* Expire
+     * Unlinks every datagram due by now and passes it to onDue, which owns it from then on and must Free it.
+     * Returns:
+     *   The number of datagrams passed to onDue.
+     */
+    template <typename OnDue>
+    size_t Expire(uint64_t now, OnDue onDue);
+
+    /* NextDue
+     * Returns:
+     *   The start of the next tick with anything queued in its slot, or UINT64_MAX if the wheel is empty. The slot
+     *   may only hold datagrams for a later turn, in which case Expire releases nothing and the wait starts again.
+     */
+    uint64_t NextDue() const;
+
+    uint32_t Queued() const { return queued; }
+    uint32_t Available() const { return capacity - queued; }
+    uint32_t BufferSize() const { return bufferSize; }
+
+private:
+    struct Slot
+    {
+        uint32_t head = NONE;
+        uint32_t tail = NONE;
+    };
+
+    void Append(uint32_t slot, uint32_t index);
+    void Release(uint32_t slot, uint64_t lastTick, std::vector<uint32_t>& due);
+
+    uint32_t capacity;
+    uint32_t bufferSize;
+    uint64_t tickNs;
+    uint32_t mask;
+    uint64_t cursor;                 // First tick not yet expired
+    uint32_t queued = 0;
+    uint32_t freeList = NONE;
+    std::vector<uint8_t> buffers;
+    std::vector<QueuedDatagram> datagrams;
+    std::vector<Slot> wheel;
+    std::vector<uint64_t> occupied;  // Bit per slot, set while its list is not empty
+    std::vector<uint32_t> released;  // Preallocated scratch for Expire
+};
+
+template <typename OnDue>
+size_t TimerWheel::Expire(uint64_t now, OnDue onDue)
+{
+    uint64_t lastTick = now / tickNs;
+    if (lastTick < cursor)
+    {
+        return 0;
+    }
+
+    // After a long wait every slot is visited once, releasing whatever is due by now
+    uint64_t ticks = lastTick - cursor + 1;
+    if (ticks > wheel.size())
+    {
+        ticks = wheel.size();
+    }
+    released.clear();
+    for (uint64_t t = 0; t < ticks; t++)
+    {
+        Release(static_cast<uint32_t>((cursor + t) & mask), lastTick, released);
+    }
+    cursor = lastTick + 1;
+
+    for (uint32_t index : released)
+    {
+        queued--;
+        onDue(&datagrams[index]);
+    }
+    return released.size();
+}
@@ -0,0 +1,141 @@
+/* UDP Blaster -- Kernel timestamping
+ * SO_TIMESTAMPING helpers shared by the client and server: enabling stamps on a socket and reading them back from
+ * recieve control messages and the transmit error queue.
+ */
+
+// C/C++ Standard Libraries
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// System libraries
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+// Local includes
+#include "timestamping.hpp"
+
+namespace
+{
+    // Room for the stamps plus the extended error that comes with a transmit stamp
+    const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(scm_timestamping)) + CMSG_SPACE(sizeof(sock_extended_err) +
+                                                                                  sizeof(sockaddr_storage));
+
+    uint64_t ToNs(const timespec& ts)
+    {
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    /* ParseTimestamps
+     * Picks the SCM_TIMESTAMPING message out of a recieved control buffer. The kernel fills ts[0] with the software
+     * stamp and ts[2] with the raw hardware one.
+     */
+    bool ParseTimestamps(msghdr& message, KernelTimestamps& stamps)
+    {
+        stamps = KernelTimestamps();
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+            {
+                scm_timestamping tss;
+                memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+                stamps.software = ToNs(tss.ts[0]);
+                stamps.hardware = ToNs(tss.ts[2]);
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+void EnableTimestamping(int socketFD, bool transmit)
+{
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+                SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (transmit)
+    {
+        // OPT_TSONLY keeps the kernel from looping the whole datagram back with every stamp
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_OPT_ID |
+                 SOF_TIMESTAMPING_OPT_TSONLY;
+    }
+
+    if (setsockopt(socketFD, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1)
+    {
+        std::runtime_error ex(std::string("Unable to enable SO_TIMESTAMPING: ") + strerror(errno));
+        throw ex;
+    }
+}
+
+ssize_t RecieveTimestamped(int socketFD, void* buffer, size_t length, int flags, sockaddr* from,
+                           socklen_t* fromLength, KernelTimestamps& stamps)
+{
+    iovec iov = {buffer, length};
+    alignas(cmsghdr) char control[CONTROL_SIZE];
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = from;
+    message.msg_namelen = fromLength != nullptr ? *fromLength : 0;
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t recvBytes = recvmsg(socketFD, &message, flags);
+    if (recvBytes >= 0 && fromLength != nullptr)
+    {
+        *fromLength = message.msg_namelen;
+    }
+    if (recvBytes >= 0)
+    {
+        ParseTimestamps(message, stamps);
+    }
+    else
+    {
+        stamps = KernelTimestamps();
+    }
+    return recvBytes;
+}
+
+bool ReadTransmitTimestamp(int socketFD, uint32_t& id, KernelTimestamps& stamps)
+{
+    alignas(cmsghdr) char control[CONTROL_SIZE];
+    msghdr message;
+    while (true)
+    {
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socketFD, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return false;
+        }
+
+        // Anything on the error queue that is not a stamp (an ICMP error, say) is skipped
+        bool stamped = ParseTimestamps(message, stamps);
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            bool isError = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!stamped || !isError)
+            {
+                continue;
+            }
+            const sock_extended_err* error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+            if (error->ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+            {
+                id = error->ee_data;
+                return true;
+            }
+        }
+    }
+}
+
+uint64_t RealtimeNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ToNs(now);
+}
@@ -0,0 +1,67 @@
+#pragma once
+/* UDP Blaster -- Kernel timestamping
+ * SO_TIMESTAMPING helpers shared by the client and server: enabling stamps on a socket and reading them back from
+ * recieve control messages and the transmit error queue.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/* KernelTimestamps
+ * One SO_TIMESTAMPING result in nanoseconds, 0 where the kernel did not provide that stamp. Software stamps are
+ * taken from CLOCK_REALTIME and can be compared with RealtimeNs(); hardware stamps come from the NIC's clock and can
+ * only be compared with other hardware stamps from the same NIC.
+ */
+struct KernelTimestamps
+{
+    uint64_t software = 0;
+    uint64_t hardware = 0;
+};
+
+/* EnableTimestamping
+ * Asks for software recieve stamps and, with transmit set, software transmit stamps on the error queue keyed by a
+ * per-socket send counter (SOF_TIMESTAMPING_OPT_ID). Hardware stamps are requested as well; they only show up if
+ * the NIC supports them and has been configured for them (SIOCSHWTSTAMP, e.g. with hwstamp_ctl).
+ * Parameters:
+ *   int  socketFD -- Socket to enable stamps on
+ *   bool transmit -- Also stamp sends
+ * Returns:
+ *   Nothing.
+ * Exceptions:
+ *   Will throw an exception if the kernel refuses SO_TIMESTAMPING.
+ */
+void EnableTimestamping(int socketFD, bool transmit);
+
+/* RecieveTimestamped
+ * recvfrom() that also collects the recieve stamps of the datagram.
+ * Parameters:
+ *   int               socketFD   -- Socket with timestamping enabled
+ *   void*             buffer     -- Where to put the datagram
+ *   size_t            length     -- Size of buffer
+ *   int               flags      -- As for recvfrom
+ *   sockaddr*         from       -- Where to put the sender's address, may be nullptr
+ *   socklen_t*        fromLength -- Size of from, updated to the address length, may be nullptr
+ *   KernelTimestamps& stamps     -- Recieve stamps, zeroed if there were none
+ * Returns:
+ *   As recvfrom.
+ */
+ssize_t RecieveTimestamped(int socketFD, void* buffer, size_t length, int flags, sockaddr* from,
+                           socklen_t* fromLength, KernelTimestamps& stamps);
+
+/* ReadTransmitTimestamp
+ * Takes one transmit stamp off the socket's error queue without blocking.
+ * Parameters:
+ *   int               socketFD -- Socket with transmit stamps enabled
+ *   uint32_t&         id       -- Send counter of the stamped datagram, 0 for the first send after enabling
+ *   KernelTimestamps& stamps   -- The stamps
+ * Returns:
+ *   true if a stamp was read, false once the error queue holds no more.
+ */
+bool ReadTransmitTimestamp(int socketFD, uint32_t& id, KernelTimestamps& stamps);
+
+/* RealtimeNs
+ * CLOCK_REALTIME in nanoseconds, the clock kernel software stamps are taken from.
+ */
+uint64_t RealtimeNs();
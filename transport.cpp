@@ -0,0 +1,377 @@
+/* UDP Blaster -- Transports
+ * One datagram interface over either the kernel's UDP path or a shared memory ring pair between co-located processes,
+ * so the cost the network stack adds to a round trip can be measured against a path that skips it.
+ */
+
+// C/C++ Standard Libraries
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// System libraries
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Local includes
+#include "transport.hpp"
+
+const uint32_t ShmTransport::RING_SLOTS;
+const uint32_t ShmTransport::MAX_REPLY;
+const unsigned int ShmTransport::SPIN_CHECKS;
+
+/* ShmRing
+ * Shared state of one ring. The indices run freely and wrap at 2^32, the slot of an index is its low bits. Each index
+ * sits on its own cache line so the producer and consumer do not bounce one line between them.
+ */
+struct ShmRing
+{
+    uint64_t offset;                    // Offset of the first slot from the start of the region
+    uint32_t stride;                    // Bytes per slot: a uint32_t length, then the datagram
+    alignas(64) std::atomic<uint32_t> tail;       // Next index the producer fills, and the consumer's futex word
+    alignas(64) std::atomic<uint32_t> head;       // Next index the consumer empties
+    std::atomic<uint32_t> sleeping;     // Set by the consumer before it sleeps on tail
+};
+
+/* ShmRegion
+ * Start of the shared memory object, followed by the slots of both rings.
+ */
+struct ShmRegion
+{
+    uint64_t magic;
+    uint32_t slots;
+    std::atomic<uint32_t> attached;     // 1 while a client is attached
+    ShmRing toServer;
+    ShmRing toClient;
+};
+
+namespace
+{
+    // "UDPBSHM" and a version number, so a client never reads a region laid out differently
+    const uint64_t SHM_MAGIC = 0x55445042534d0001ULL;
+    const size_t CACHE_LINE = 64;
+
+    size_t RoundUp(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    /* FutexWait
+     * Sleeps while word still holds expected, for up to timeoutNs. The word is in shared memory, so the futex is
+     * not a private one.
+     */
+    int FutexWait(std::atomic<uint32_t>& word, uint32_t expected, uint64_t timeoutNs)
+    {
+        timespec timeout;
+        timeout.tv_sec = timeoutNs / 1000000000;
+        timeout.tv_nsec = timeoutNs % 1000000000;
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    }
+
+    void FutexWake(std::atomic<uint32_t>& word)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+
+    uint64_t MonotonicNs()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    }
+
+    inline void CpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+void TransportOptions::Parse(const std::string& text)
+{
+    const std::string SHM_PREFIX = "shm:";
+    if (text == "udp")
+    {
+        kind = Kind::Udp;
+        return;
+    }
+    if (text.compare(0, SHM_PREFIX.size(), SHM_PREFIX) != 0 || text.size() == SHM_PREFIX.size())
+    {
+        throw std::invalid_argument("Unknown transport " + text + ", expected udp or shm:name");
+    }
+
+    kind = Kind::Shm;
+    shmName = text.substr(SHM_PREFIX.size());
+    if (shmName[0] != '/')
+    {
+        shmName = "/" + shmName;
+    }
+    if (shmName.find('/', 1) != std::string::npos)
+    {
+        throw std::invalid_argument("Shared memory name " + shmName + " may not contain a slash");
+    }
+}
+
+UdpTransport::UdpTransport(int socketFD, bool replyToSender) : socketFD(socketFD), replyToSender(replyToSender)
+{
+    memset(&peer, 0, sizeof(peer));
+}
+
+ssize_t UdpTransport::Send(const void* datagram, size_t length)
+{
+    if (replyToSender)
+    {
+        return sendto(socketFD, datagram, length, 0, reinterpret_cast<const sockaddr*>(&peer), peerLength);
+    }
+    return send(socketFD, datagram, length, 0);
+}
+
+ssize_t UdpTransport::Recieve(void* buffer, size_t length, int timeoutMs)
+{
+    while (true)
+    {
+        peerLength = sizeof(peer);
+        ssize_t recvBytes = recvfrom(socketFD, buffer, length, MSG_DONTWAIT | MSG_TRUNC,
+                                     reinterpret_cast<sockaddr*>(&peer), &peerLength);
+        if (recvBytes != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            return recvBytes;
+        }
+
+        pollfd waitFor;
+        waitFor.fd = socketFD;
+        waitFor.events = POLLIN;
+        waitFor.revents = 0;
+        int ready = poll(&waitFor, 1, timeoutMs);
+        if (ready == 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (ready == -1)
+        {
+            return -1;
+        }
+    }
+}
+
+ShmTransport::ShmTransport(const std::string& name, bool create, size_t maxDatagram) : name(name), server(create)
+{
+    spinChecks = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_CHECKS : 0;
+
+    int shmFD;
+    if (create)
+    {
+        // A server that died left its object behind, start from a fresh one rather than its stale indices
+        shm_unlink(name.c_str());
+        shmFD = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (shmFD == -1)
+        {
+            std::runtime_error ex("Unable to create shared memory " + name + ": " + strerror(errno));
+            throw ex;
+        }
+
+        const size_t requestStride = RoundUp(sizeof(uint32_t) + maxDatagram, CACHE_LINE);
+        const size_t replyStride = RoundUp(sizeof(uint32_t) + MAX_REPLY, CACHE_LINE);
+        const size_t requestOffset = RoundUp(sizeof(ShmRegion), CACHE_LINE);
+        const size_t replyOffset = requestOffset + requestStride * RING_SLOTS;
+        size = replyOffset + replyStride * RING_SLOTS;
+        if (ftruncate(shmFD, size) == -1)
+        {
+            std::runtime_error ex("Unable to size shared memory " + name + ": " + strerror(errno));
+            close(shmFD);
+            shm_unlink(name.c_str());
+            throw ex;
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFD, 0);
+        close(shmFD);
+        if (mapping == MAP_FAILED)
+        {
+            std::runtime_error ex("Unable to map shared memory " + name + ": " + strerror(errno));
+            shm_unlink(name.c_str());
+            throw ex;
+        }
+
+        // The object starts out zeroed, so the indices and flags are already in their initial state
+        region = new (mapping) ShmRegion();
+        region->slots = RING_SLOTS;
+        region->toServer.offset = requestOffset;
+        region->toServer.stride = requestStride;
+        region->toClient.offset = replyOffset;
+        region->toClient.stride = replyStride;
+        std::atomic_thread_fence(std::memory_order_release);
+        region->magic = SHM_MAGIC;
+        outgoing = &region->toClient;
+        incoming = &region->toServer;
+        return;
+    }
+
+    shmFD = shm_open(name.c_str(), O_RDWR, 0);
+    if (shmFD == -1)
+    {
+        std::runtime_error ex("Unable to open shared memory " + name + " (is a server running with -X shm:" +
+                              name.substr(1) + "?): " + strerror(errno));
+        throw ex;
+    }
+    struct stat info;
+    if (fstat(shmFD, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(ShmRegion))
+    {
+        close(shmFD);
+        std::runtime_error ex("Shared memory " + name + " is too small to be a server's");
+        throw ex;
+    }
+    size = info.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFD, 0);
+    close(shmFD);
+    if (mapping == MAP_FAILED)
+    {
+        std::runtime_error ex("Unable to map shared memory " + name + ": " + strerror(errno));
+        throw ex;
+    }
+
+    region = static_cast<ShmRegion*>(mapping);
+    std::string problem;
+    uint32_t detached = 0;
+    if (region->magic != SHM_MAGIC || region->slots != RING_SLOTS ||
+        region->toClient.offset + static_cast<uint64_t>(region->toClient.stride) * RING_SLOTS > size)
+    {
+        problem = "Shared memory " + name + " was not made by this version of the server";
+    }
+    else if (!region->attached.compare_exchange_strong(detached, 1))
+    {
+        problem = "Another client is already attached to " + name;
+    }
+    if (!problem.empty())
+    {
+        munmap(mapping, size);
+        std::runtime_error ex(problem);
+        throw ex;
+    }
+
+    outgoing = &region->toServer;
+    incoming = &region->toClient;
+    incoming->head.store(incoming->tail.load(std::memory_order_acquire), std::memory_order_release);
+    cachedHead = outgoing->head.load(std::memory_order_acquire);
+}
+
+ShmTransport::~ShmTransport()
+{
+    if (server)
+    {
+        shm_unlink(name.c_str());
+    }
+    else
+    {
+        region->attached.store(0);
+    }
+    munmap(region, size);
+}
+
+uint8_t* ShmTransport::Slot(const ShmRing& ring, uint32_t index) const
+{
+    return reinterpret_cast<uint8_t*>(region) + ring.offset + static_cast<size_t>(index % RING_SLOTS) * ring.stride;
+}
+
+ssize_t ShmTransport::Send(const void* datagram, size_t length)
+{
+    ShmRing& ring = *outgoing;
+    if (length > ring.stride - sizeof(uint32_t))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    // Only this side moves tail, so it needs no more than a relaxed load
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - cachedHead == RING_SLOTS)
+    {
+        cachedHead = ring.head.load(std::memory_order_acquire);
+        if (tail - cachedHead == RING_SLOTS)
+        {
+            // A full socket buffer drops the datagram too
+            full++;
+            errno = ENOBUFS;
+            return -1;
+        }
+    }
+
+    uint8_t* slot = Slot(ring, tail);
+    uint32_t length32 = length;
+    memcpy(slot, &length32, sizeof(length32));
+    memcpy(slot + sizeof(length32), datagram, length);
+
+    // Sequentially consistent so the store cannot pass the load of sleeping below, pairing with the consumer setting
+    // sleeping before it checks tail one last time
+    ring.tail.store(tail + 1, std::memory_order_seq_cst);
+    if (ring.sleeping.load(std::memory_order_seq_cst) != 0)
+    {
+        wakes++;
+        FutexWake(ring.tail);
+    }
+    return length;
+}
+
+ssize_t ShmTransport::Recieve(void* buffer, size_t length, int timeoutMs)
+{
+    ShmRing& ring = *incoming;
+    const uint32_t head = ring.head.load(std::memory_order_relaxed);
+    uint32_t tail = ring.tail.load(std::memory_order_acquire);
+    for (unsigned int i = 0; tail == head && i < spinChecks; i++)
+    {
+        CpuRelax();
+        tail = ring.tail.load(std::memory_order_acquire);
+    }
+
+    const uint64_t deadline = MonotonicNs() + static_cast<uint64_t>(timeoutMs) * 1000000;
+    while (tail == head)
+    {
+        ring.sleeping.store(1, std::memory_order_seq_cst);
+        tail = ring.tail.load(std::memory_order_seq_cst);
+        if (tail != head)
+        {
+            ring.sleeping.store(0, std::memory_order_relaxed);
+            break;
+        }
+
+        uint64_t now = MonotonicNs();
+        if (now >= deadline)
+        {
+            ring.sleeping.store(0, std::memory_order_relaxed);
+            errno = EAGAIN;
+            return -1;
+        }
+        sleeps++;
+        int waited = FutexWait(ring.tail, tail, deadline - now);
+        int error = errno;
+        ring.sleeping.store(0, std::memory_order_relaxed);
+        if (waited == -1 && error == EINTR)
+        {
+            errno = EINTR;
+            return -1;
+        }
+        tail = ring.tail.load(std::memory_order_acquire);
+    }
+
+    const uint8_t* slot = Slot(ring, head);
+    uint32_t datagramLength;
+    memcpy(&datagramLength, slot, sizeof(datagramLength));
+    memcpy(buffer, slot + sizeof(datagramLength), std::min<size_t>(datagramLength, length));
+    ring.head.store(head + 1, std::memory_order_release);
+    return datagramLength;
+}
+
+void ShmTransport::PrintReport(std::ostream& out) const
+{
+    out << "Shared memory " << name << ": " << sleeps << " futex waits recieving, " << wakes
+        << " futex wakes sending, " << full << " sends dropped with the ring full\n";
+}
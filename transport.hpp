@@ -0,0 +1,153 @@
+#pragma once
+/* UDP Blaster -- Transports
+ * One datagram interface over either the kernel's UDP path or a shared memory ring pair between co-located processes,
+ * so the cost the network stack adds to a round trip can be measured against a path that skips it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <ostream>
+#include <string>
+
+/* TransportOptions
+ * Which transport -X asked for, if any.
+ */
+struct TransportOptions
+{
+    enum class Kind
+    {
+        None,   // The ordinary socket loops
+        Udp,    // The transport loop over the usual UDP socket
+        Shm     // The transport loop over a shared memory ring pair
+    };
+
+    Kind kind = Kind::None;
+    std::string shmName;    // Name of the shared memory object, as passed to shm_open
+
+    /* Parse
+     * Reads udp or shm:name.
+     * Exceptions:
+     *   Will throw an exception if the text is neither.
+     */
+    void Parse(const std::string& text);
+};
+
+/* Transport
+ * Carries ClientDatagram/ServerDatagram framed datagrams between the client and the server. Whole datagrams go in and
+ * come out, as with UDP: a datagram too long for the reciever's buffer is truncated and its real length returned.
+ */
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    /* Send
+     * Sends one datagram, to the server from the client or back to whoever sent the last one from the server.
+     * Returns:
+     *   As send: the length on success, -1 with errno set on failure.
+     */
+    virtual ssize_t Send(const void* datagram, size_t length) = 0;
+
+    /* Recieve
+     * Waits up to timeoutMs for one datagram.
+     * Returns:
+     *   The datagram's full length, which may be more than length, or -1 with errno set to EAGAIN on timeout, EINTR
+     *   when a signal arrived, or to the error of a failed syscall.
+     */
+    virtual ssize_t Recieve(void* buffer, size_t length, int timeoutMs) = 0;
+
+    // Short name for reports, such as udp or shm:/blaster
+    virtual std::string Describe() const = 0;
+
+    /* PrintReport
+     * Writes whatever the transport counted about itself, nothing by default.
+     */
+    virtual void PrintReport(std::ostream& out) const { (void)out; }
+};
+
+/* UdpTransport
+ * The kernel UDP path over an already open socket, which it does not own. The first recieve of each call is
+ * nonblocking and only an empty socket costs a poll, so a busy transport makes one syscall per datagram like the
+ * plain loops do.
+ */
+class UdpTransport : public Transport
+{
+public:
+    /* Parameters:
+     *   int  socketFD      -- Open socket, connected on the client side
+     *   bool replyToSender -- Send to the source of the last recieved datagram (server) rather than the connected peer
+     */
+    UdpTransport(int socketFD, bool replyToSender);
+
+    ssize_t Send(const void* datagram, size_t length) override;
+    ssize_t Recieve(void* buffer, size_t length, int timeoutMs) override;
+    std::string Describe() const override { return "udp"; }
+
+private:
+    int socketFD;
+    bool replyToSender;
+    sockaddr_storage peer;
+    socklen_t peerLength = 0;
+};
+
+struct ShmRegion;
+struct ShmRing;
+
+/* ShmTransport
+ * Two single producer, single consumer rings of fixed size slots in a POSIX shared memory object, one carrying
+ * datagrams to the server and one carrying replies back. Each side only ever writes its own ring index and publishes
+ * with a release store, so a datagram costs two copies and no syscall while the reciever is busy. An idle reciever
+ * spins briefly if there is another CPU, then sleeps on a futex over the producer's index, and the producer only
+ * makes the wake syscall when the reciever has said it is asleep.
+ * The server creates the object and unlinks it when it is done, a client attaches to it by name. One client at a time
+ * may attach; a client that dies without detaching leaves the server to be restarted.
+ */
+class ShmTransport : public Transport
+{
+public:
+    // Slots in each ring, a power of two
+    static const uint32_t RING_SLOTS = 256;
+    // Largest reply, enough for any reply format the server sends
+    static const uint32_t MAX_REPLY = 64;
+    // Times an empty ring is checked again before the reciever goes to sleep, when there is another CPU the sender
+    // could be running on; with one CPU spinning only keeps the sender from running
+    static const unsigned int SPIN_CHECKS = 128;
+
+    /* Parameters:
+     *   const std::string& name        -- Name for shm_open
+     *   bool               create      -- Create the object as the server, replacing any left behind under the same
+     *                                     name, rather than attach to it as a client
+     *   size_t             maxDatagram -- Server only: longest datagram the client may send, longer ones fail with
+     *                                     EMSGSIZE
+     * Exceptions:
+     *   Will throw an exception if the object cannot be created or mapped, or when attaching, if there is no such
+     *   object, it was made by another version, or another client is attached.
+     */
+    ShmTransport(const std::string& name, bool create, size_t maxDatagram);
+    ~ShmTransport() override;
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    ssize_t Send(const void* datagram, size_t length) override;
+    ssize_t Recieve(void* buffer, size_t length, int timeoutMs) override;
+    std::string Describe() const override { return "shm:" + name; }
+    void PrintReport(std::ostream& out) const override;
+
+private:
+    uint8_t* Slot(const ShmRing& ring, uint32_t index) const;
+
+    std::string name;
+    bool server;
+    ShmRegion* region = nullptr;
+    size_t size = 0;
+    ShmRing* outgoing = nullptr;
+    ShmRing* incoming = nullptr;
+    unsigned int spinChecks = 0;
+    uint32_t cachedHead = 0;    // Last seen consumer index of the outgoing ring, reread only when it looks full
+    uint64_t full = 0;          // Sends dropped with the outgoing ring full
+    uint64_t sleeps = 0;        // Futex waits while recieving
+    uint64_t wakes = 0;         // Futex wakes while sending
+};
@@ -0,0 +1,245 @@
+/* UDP Blaster -- io_uring engine
+ * Thin wrapper over the raw io_uring syscalls: submission and completion rings plus one provided buffer ring.
+ */
+
+// C/C++ Standard Libraries
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <errno.h>
+
+// System libraries
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Local includes
+#include "uring_engine.hpp"
+
+namespace
+{
+    std::runtime_error SyscallError(const std::string& what)
+    {
+        return std::runtime_error(what + ": " + strerror(errno));
+    }
+
+    void* MapRing(int ringFD, size_t size, off_t offset)
+    {
+        void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+}
+
+UringEngine::UringEngine(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    ringFD = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFD == -1)
+    {
+        throw SyscallError("io_uring_setup");
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        close(ringFD);
+        ringFD = -1;
+        std::runtime_error ex("io_uring_setup: kernel lacks wait timeouts (IORING_FEAT_EXT_ARG)");
+        throw ex;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap && cqRingSize > sqRingSize)
+    {
+        sqRingSize = cqRingSize;
+    }
+
+    sqRing = MapRing(ringFD, sqRingSize, IORING_OFF_SQ_RING);
+    cqRing = singleMap ? sqRing : MapRing(ringFD, cqRingSize, IORING_OFF_CQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(MapRing(ringFD, sqesSize, IORING_OFF_SQES));
+    if (sqRing == nullptr || cqRing == nullptr || sqes == nullptr)
+    {
+        std::runtime_error ex = SyscallError("io_uring mmap");
+        Release();
+        throw ex;
+    }
+
+    uint8_t* sq = static_cast<uint8_t*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+
+    // Entries are always used in ring order, so the indirection array is the identity and only needs filling once
+    unsigned* sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries; i++)
+    {
+        sqArray[i] = i;
+    }
+
+    uint8_t* cq = static_cast<uint8_t*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+UringEngine::~UringEngine()
+{
+    Release();
+}
+
+void UringEngine::Release()
+{
+    // Closing the ring first lets the kernel drop its references to the buffers before they are unmapped
+    if (ringFD >= 0)
+    {
+        close(ringFD);
+        ringFD = -1;
+    }
+    if (bufferBase != nullptr)
+    {
+        munmap(bufferBase, bufferAreaSize);
+        bufferBase = nullptr;
+    }
+    if (bufRing != nullptr)
+    {
+        munmap(bufRing, bufRingSize);
+        bufRing = nullptr;
+    }
+    if (sqes != nullptr)
+    {
+        munmap(sqes, sqesSize);
+        sqes = nullptr;
+    }
+    if (cqRing != nullptr && cqRing != sqRing)
+    {
+        munmap(cqRing, cqRingSize);
+    }
+    cqRing = nullptr;
+    if (sqRing != nullptr)
+    {
+        munmap(sqRing, sqRingSize);
+        sqRing = nullptr;
+    }
+}
+
+io_uring_sqe* UringEngine::NextSqe()
+{
+    if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+    {
+        return nullptr;
+    }
+
+    io_uring_sqe* sqe = &sqes[sqLocalTail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqLocalTail++;
+    return sqe;
+}
+
+int UringEngine::Submit(unsigned waitFor, int64_t timeoutNs)
+{
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    unsigned pending = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (pending == 0 && waitFor == 0)
+    {
+        return 0;
+    }
+
+    unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (waitFor == 0 || timeoutNs < 0)
+    {
+        return syscall(__NR_io_uring_enter, ringFD, pending, waitFor, flags, nullptr, 0);
+    }
+
+    __kernel_timespec timeout;
+    timeout.tv_sec = timeoutNs / 1000000000;
+    timeout.tv_nsec = timeoutNs % 1000000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    return syscall(__NR_io_uring_enter, ringFD, pending, waitFor, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+io_uring_cqe* UringEngine::PeekCqe()
+{
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+    {
+        return nullptr;
+    }
+    return &cqes[head & cqMask];
+}
+
+void UringEngine::SeenCqe()
+{
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+void UringEngine::RegisterBufferRing(uint16_t group, unsigned count, size_t size)
+{
+    if (count == 0 || count > 32768 || (count & (count - 1)) != 0)
+    {
+        std::invalid_argument ex("Buffer ring size must be a power of two up to 32768");
+        throw ex;
+    }
+
+    bufRingSize = count * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+    {
+        throw SyscallError("Buffer ring mmap");
+    }
+    bufRing = static_cast<io_uring_buf_ring*>(ring);
+
+    bufferAreaSize = count * size;
+    void* area = mmap(nullptr, bufferAreaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        throw SyscallError("Buffer mmap");
+    }
+    bufferBase = static_cast<uint8_t*>(area);
+    bufferSize = size;
+    bufferCount = count;
+
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+    registration.ring_entries = count;
+    registration.bgid = group;
+    if (syscall(__NR_io_uring_register, ringFD, IORING_REGISTER_PBUF_RING, &registration, 1) == -1)
+    {
+        throw SyscallError("io_uring_register(PBUF_RING)");
+    }
+
+    bufTail = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        RecycleBuffer(static_cast<uint16_t>(i));
+    }
+    PublishBuffers();
+}
+
+void UringEngine::RecycleBuffer(uint16_t id)
+{
+    /* The ring tail overlays the reserved field of the first entry, so only the named fields may be written. The
+     * entries are indexed from the ring itself rather than through bufs, which the kernel header's flexible array
+     * wrapper pushes 8 bytes in when compiled as C++.
+     */
+    io_uring_buf* slot = reinterpret_cast<io_uring_buf*>(bufRing) + (bufTail & (bufferCount - 1));
+    slot->addr = reinterpret_cast<uint64_t>(Buffer(id));
+    slot->len = bufferSize;
+    slot->bid = id;
+    bufTail++;
+}
+
+void UringEngine::PublishBuffers()
+{
+    __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
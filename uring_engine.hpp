@@ -0,0 +1,114 @@
+#pragma once
+/* UDP Blaster -- io_uring engine
+ * Thin wrapper over the raw io_uring syscalls: submission and completion rings plus one provided buffer ring.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/* UringEngine
+ * Owns one io_uring instance. Submission queue entries are handed out by NextSqe and only become visible to the
+ * kernel on Submit, completions are read in order with PeekCqe/SeenCqe. One provided buffer ring can be registered,
+ * so multishot recieves pick their own buffer and the caller hands each buffer back once it is done with it.
+ * Not thread safe, each thread that wants a ring needs its own engine.
+ */
+class UringEngine
+{
+public:
+    /* Parameters:
+     *   unsigned entries -- Submission queue depth. The completion queue is made four times deeper, since one
+     *                       multishot recieve can post many completions.
+     * Exceptions:
+     *   Will throw an exception if the kernel does not offer io_uring or refuses to set up the ring.
+     */
+    explicit UringEngine(unsigned entries);
+    ~UringEngine();
+
+    UringEngine(const UringEngine&) = delete;
+    UringEngine& operator=(const UringEngine&) = delete;
+
+    /* NextSqe
+     * Hands out a zeroed submission queue entry.
+     * Returns:
+     *   The entry, or nullptr if the submission queue is full and needs a Submit first.
+     */
+    io_uring_sqe* NextSqe();
+
+    /* Submit
+     * Passes every entry handed out since the last submit to the kernel, and optionally waits for completions.
+     * Parameters:
+     *   unsigned waitFor   -- Completions to wait for, 0 to return straight away
+     *   int64_t  timeoutNs -- Longest to wait in nanoseconds, negative to wait indefinitely
+     * Returns:
+     *   The number of entries submitted, or -1 with errno set (EINTR if a signal cut the wait short, ETIME if the
+     *   timeout passed first).
+     */
+    int Submit(unsigned waitFor, int64_t timeoutNs = -1);
+
+    /* PeekCqe
+     * Returns:
+     *   The oldest unseen completion, or nullptr if there is none.
+     */
+    io_uring_cqe* PeekCqe();
+
+    /* SeenCqe
+     * Releases the completion returned by PeekCqe back to the kernel.
+     */
+    void SeenCqe();
+
+    /* RegisterBufferRing
+     * Allocates count buffers of bufferSize bytes and registers them as a provided buffer ring, all of them
+     * initially available to the kernel.
+     * Parameters:
+     *   uint16_t group      -- Buffer group ID used by IOSQE_BUFFER_SELECT entries
+     *   unsigned count      -- Number of buffers, a power of two up to 32768
+     *   size_t   bufferSize -- Bytes per buffer
+     * Exceptions:
+     *   Will throw an exception if the buffers cannot be allocated or the kernel does not support buffer rings.
+     */
+    void RegisterBufferRing(uint16_t group, unsigned count, size_t bufferSize);
+
+    uint8_t* Buffer(uint16_t id) const { return bufferBase + static_cast<size_t>(id) * bufferSize; }
+    size_t BufferSize() const { return bufferSize; }
+
+    /* RecycleBuffer
+     * Queues a buffer to go back to the kernel. Queued buffers are only handed over on PublishBuffers, so a whole
+     * pass of completions can be returned with one store.
+     */
+    void RecycleBuffer(uint16_t id);
+    void PublishBuffers();
+
+private:
+    void Release();
+
+    int ringFD = -1;
+
+    // Submission queue
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqLocalTail = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    // Completion queue, shares sqRing when the kernel maps both rings at once
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    // Provided buffer ring
+    io_uring_buf_ring* bufRing = nullptr;
+    size_t bufRingSize = 0;
+    uint8_t* bufferBase = nullptr;
+    size_t bufferSize = 0;
+    size_t bufferAreaSize = 0;
+    unsigned bufferCount = 0;
+    uint16_t bufTail = 0;
+};
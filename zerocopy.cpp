@@ -0,0 +1,170 @@
+/* UDP Blaster -- Zero-copy sends
+ * MSG_ZEROCOPY sending from a pool of locked datagram buffers, recycled as the kernel's completions come back.
+ */
+
+// C/C++ Standard Libraries
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <iomanip>
+
+// System libraries
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// Local includes
+#include "zerocopy.hpp"
+
+const int ZeroCopySender::COMPLETION_TIMEOUT_MS;
+
+namespace
+{
+    // Room for the extended error a completion arrives in
+    const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_storage));
+}
+
+ZeroCopySender::ZeroCopySender(int socketFD, const std::vector<uint8_t>& prototype, uint32_t slots)
+    : socketFD(socketFD), pool(slots, prototype), busy(pool.Slots(), 0), slotOfID(pool.Slots(), 0)
+{
+    int enable = 1;
+    if (setsockopt(socketFD, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == -1)
+    {
+        std::runtime_error ex(std::string("Unable to enable SO_ZEROCOPY: ") + strerror(errno));
+        throw ex;
+    }
+
+    // Locking is only a head start, the kernel pins the pages of each send itself, so a low RLIMIT_MEMLOCK is fine
+    locked = mlock(pool.Slot(0), static_cast<size_t>(pool.Slots()) * pool.Stride()) == 0;
+}
+
+ZeroCopySender::~ZeroCopySender()
+{
+    if (locked)
+    {
+        munlock(pool.Slot(0), static_cast<size_t>(pool.Slots()) * pool.Stride());
+    }
+}
+
+bool ZeroCopySender::Reap()
+{
+    bool any = false;
+    char control[CONTROL_SIZE];
+    msghdr message;
+    while (true)
+    {
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socketFD, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return any;
+        }
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            bool isError = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!isError)
+            {
+                continue;
+            }
+            const sock_extended_err* error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+            if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0)
+            {
+                continue;
+            }
+
+            // Sends ee_info through ee_data inclusive are done, the range may wrap past 2^32
+            uint32_t count = error->ee_data - error->ee_info + 1;
+            for (uint32_t id = error->ee_info; id != error->ee_data + 1; id++)
+            {
+                busy[slotOfID[id % slotOfID.size()]] = 0;
+            }
+            completed += count;
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                copied += count;
+            }
+            any = true;
+        }
+    }
+}
+
+void ZeroCopySender::WaitForCompletions()
+{
+    // Completions only make the socket report POLLERR, which poll always watches for
+    pollfd waitFor;
+    waitFor.fd = socketFD;
+    waitFor.events = 0;
+    waitFor.revents = 0;
+    if (poll(&waitFor, 1, COMPLETION_TIMEOUT_MS) <= 0 || !Reap())
+    {
+        std::runtime_error ex("Zero-copy completions stopped arriving");
+        throw ex;
+    }
+}
+
+uint8_t* ZeroCopySender::Acquire(uint32_t sequence)
+{
+    currentSlot = nextSlot;
+    nextSlot = (nextSlot + 1) % pool.Slots();
+    if (busy[currentSlot])
+    {
+        Reap();
+    }
+    while (busy[currentSlot])
+    {
+        WaitForCompletions();
+    }
+    return pool.Stamp(currentSlot, sequence);
+}
+
+ssize_t ZeroCopySender::Send(const uint8_t* datagram, size_t length)
+{
+    ssize_t sentBytes = send(socketFD, datagram, length, MSG_ZEROCOPY);
+    if (sentBytes != -1)
+    {
+        slotOfID[nextID % slotOfID.size()] = currentSlot;
+        busy[currentSlot] = 1;
+        nextID++;
+        zeroCopySends++;
+        return sentBytes;
+    }
+    if (errno != ENOBUFS)
+    {
+        return sentBytes;
+    }
+
+    fallbacks++;
+    return send(socketFD, datagram, length, 0);
+}
+
+void ZeroCopySender::Finish()
+{
+    while (completed < zeroCopySends)
+    {
+        if (!Reap())
+        {
+            WaitForCompletions();
+        }
+    }
+}
+
+void ZeroCopySender::PrintReport(std::ostream& out) const
+{
+    uint64_t sends = zeroCopySends + fallbacks;
+    out << "Zero-copy sends: " << zeroCopySends << " (" << completed << " completed, pool of " << pool.Slots()
+        << " buffers" << (locked ? ", locked" : "") << ")\n"
+        << "Copy fallbacks: " << copied << " copied by the kernel anyway, " << fallbacks
+        << " sent by copy after ENOBUFS (" << std::fixed << std::setprecision(1)
+        << (sends > 0 ? 100.0 * (copied + fallbacks) / sends : 0.0) << std::defaultfloat << "% of sends)\n";
+    if (completed > 0 && copied == completed)
+    {
+        out << "Every send was copied after all, as happens when the reciever is local (loopback) or the device "
+            << "cannot scatter-gather\n";
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+/* UDP Blaster -- Zero-copy sends
+ * MSG_ZEROCOPY sending from a pool of locked datagram buffers, recycled as the kernel's completions come back.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <ostream>
+#include <vector>
+
+// Local includes
+#include "datagram_pool.hpp"
+
+/* ZeroCopySender
+ * Sends datagrams with MSG_ZEROCOPY, so the kernel pins the user pages instead of copying them. A buffer then
+ * belongs to the kernel until the completion for its send is read off the socket's error queue, so every datagram
+ * goes out from its own slot of a pool and a slot is only stamped again once its last send has completed. The kernel
+ * numbers zero-copy sends per socket and reports ranges of them as complete, flagging the ones it ended up copying
+ * after all (always the case on loopback, where the reciever cannot keep the sender's pages).
+ * Not thread safe, and the socket's error queue must not be read by anyone else (so no kernel transmit stamps).
+ */
+class ZeroCopySender
+{
+public:
+    // Longest Acquire or Finish waits for completions before giving up on them
+    static const int COMPLETION_TIMEOUT_MS = 1000;
+
+    /* Parameters:
+     *   int                         socketFD  -- Connected socket to send on
+     *   const std::vector<uint8_t>& prototype -- Formatted datagram every slot starts out as
+     *   uint32_t                    slots     -- Number of buffers, and so the most sends in flight at once
+     * Exceptions:
+     *   Will throw an exception if the kernel refuses SO_ZEROCOPY.
+     */
+    ZeroCopySender(int socketFD, const std::vector<uint8_t>& prototype, uint32_t slots);
+    ~ZeroCopySender();
+
+    ZeroCopySender(const ZeroCopySender&) = delete;
+    ZeroCopySender& operator=(const ZeroCopySender&) = delete;
+
+    /* Acquire
+     * Waits until the next slot's previous send has completed, then stamps the sequence number into it.
+     * Returns:
+     *   The slot, ready for Send.
+     * Exceptions:
+     *   Will throw an exception if no completion arrives within COMPLETION_TIMEOUT_MS.
+     */
+    uint8_t* Acquire(uint32_t sequence);
+
+    /* Send
+     * Sends the slot returned by the last Acquire with MSG_ZEROCOPY. If the kernel is out of option memory to track
+     * the pages (ENOBUFS), the datagram is sent the ordinary copying way instead and counted as a fallback.
+     * Returns:
+     *   As send.
+     */
+    ssize_t Send(const uint8_t* datagram, size_t length);
+
+    /* Finish
+     * Waits for every outstanding completion, so all the pool's buffers are back before it is destroyed.
+     */
+    void Finish();
+
+    /* PrintReport
+     * Writes how many sends went out zero-copy and how many the kernel or ENOBUFS turned back into copies.
+     */
+    void PrintReport(std::ostream& out) const;
+
+private:
+    bool Reap();
+    void WaitForCompletions();
+
+    int socketFD;
+    DatagramPool pool;
+    bool locked = false;
+    uint32_t nextSlot = 0;
+    uint32_t currentSlot = 0;
+    uint32_t nextID = 0;              // The kernel's number for the next zero-copy send
+    std::vector<uint8_t> busy;        // Per slot, set while the kernel may still read it
+    std::vector<uint32_t> slotOfID;   // Slot of each in-flight send, indexed by its number modulo the pool size
+    uint64_t zeroCopySends = 0;
+    uint64_t completed = 0;
+    uint64_t copied = 0;              // Completed sends the kernel copied anyway
+    uint64_t fallbacks = 0;           // Sends made by copy after ENOBUFS
+};